@@ -1,4 +1,13 @@
 set glslc=C:/VulkanSDK/1.3.231.1/Bin/glslc.exe
 for %%a in (*.vert) do glslc %%a -o %%a.spv
 for %%a in (*.frag) do glslc %%a -o %%a.spv
+for %%a in (*.comp) do glslc %%a -o %%a.spv
+glslc -DBINDLESS phong.frag -o phong_bindless.frag.spv
+glslc -DBINDLESS unlit.frag -o unlit_bindless.frag.spv
+glslc -DPACKED phong.vert -o phong_packed.vert.spv
+glslc -DPACKED unlit.vert -o unlit_packed.vert.spv
+glslc -DMSAA hiz_depth.comp -o hiz_depth_msaa.comp.spv
+glslc --target-spv=spv1.4 meshlet.task -o meshlet.task.spv
+glslc --target-spv=spv1.4 meshlet.mesh -o meshlet.mesh.spv
+glslc --target-spv=spv1.4 -DPACKED meshlet.mesh -o meshlet_packed.mesh.spv
 pause
\ No newline at end of file
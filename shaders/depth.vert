@@ -0,0 +1,31 @@
+#version 450 
+
+layout(set = 0, binding = 0) uniform GlobalUBO {
+    mat4 view;
+    mat4 proj;
+    mat4 viewproj;
+    vec4 viewPos;
+    // ...
+} global;
+
+struct InstanceData {
+    mat4 model;
+    mat3x4 normal;
+    uint materialIndex;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+// Position stream of the meshes. Packed positions are UNORM and relative to the
+// mesh bounds, like in the full vertices, so both formats read the same here.
+layout(location = 0) in vec3 inPosition;
+
+// Bit exact with phong.vert and unlit.vert, which are drawn with an EQUAL test after this
+invariant gl_Position;
+
+void main() {
+    InstanceData instance = instances[gl_InstanceIndex];
+    gl_Position = global.viewproj * instance.model * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,102 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform GlobalUBO {
+    mat4 view;
+    mat4 proj;
+    mat4 viewproj;
+    vec4 viewPos;
+    // ...
+} global;
+
+layout(push_constant) uniform GridConstants {
+    vec4 minorColor;    // a: line spacing
+    vec4 majorColor;    // a: line spacing
+    float fadeDistance;
+    float lineWidth;    // Pixels
+    uint flags;         // 1: grid, 2: axes
+} grid;
+
+layout(location = 0) in vec3 nearPoint;
+layout(location = 1) in vec3 farPoint;
+
+layout(location = 0) out vec4 outColor;
+
+const uint GRID_LINES = 1u;
+const uint GRID_AXES = 2u;
+
+// Coverage of a line at 'pixels' from the fragment
+float LineCoverage(float pixels) {
+    return clamp(grid.lineWidth * 0.5 + 0.5 - pixels, 0.0, 1.0);
+}
+
+// Lines every 'spacing' units along x and z, faded out when they get closer
+// than a couple of pixels to avoid moire
+float GridCoverage(vec2 coord, float spacing) {
+    vec2 c = coord / spacing;
+    vec2 footprint = max(fwidth(c), vec2(1e-6));
+    vec2 pixels = abs(fract(c - 0.5) - 0.5) / footprint;
+    float density = 1.0 - smoothstep(0.2, 0.5, max(footprint.x, footprint.y));
+    return LineCoverage(min(pixels.x, pixels.y)) * density;
+}
+
+float Depth(vec3 position) {
+    vec4 clip = global.viewproj * vec4(position, 1.0);
+    return clip.z / clip.w;
+}
+
+float Fade(vec3 position) {
+    return 1.0 - smoothstep(grid.fadeDistance * 0.5, grid.fadeDistance, distance(global.viewPos.xyz, position));
+}
+
+void main() {
+    // Everything is computed for every fragment, derivatives need uniform control flow
+    vec3 ray = farPoint - nearPoint;
+
+    // Ground plane y = 0
+    float t = -nearPoint.y / (abs(ray.y) > 1e-6 ? ray.y : 1e-6);
+    vec3 planePoint = nearPoint + t * ray;
+    vec2 coord = planePoint.xz;
+
+    float minor = (grid.flags & GRID_LINES) != 0 ? GridCoverage(coord, grid.minorColor.a) : 0.0;
+    float major = (grid.flags & GRID_LINES) != 0 ? GridCoverage(coord, grid.majorColor.a) : 0.0;
+    vec4 plane = vec4(mix(grid.minorColor.rgb, grid.majorColor.rgb, major), max(minor, major));
+
+    // Positive x (red) and z (blue) axes on the plane, y (green) is the closest point of the ray
+    vec2 axisFootprint = max(fwidth(coord), vec2(1e-6));
+    float xAxis = LineCoverage(abs(coord.y) / axisFootprint.y) * step(0.0, coord.x);
+    float zAxis = LineCoverage(abs(coord.x) / axisFootprint.x) * step(0.0, coord.y);
+
+    float s = clamp(-dot(nearPoint.xz, ray.xz) / max(dot(ray.xz, ray.xz), 1e-12), 0.0, 1.0);
+    vec3 axisPoint = nearPoint + s * ray;
+    float axisDistance = length(axisPoint.xz);
+    float yAxis = LineCoverage(axisDistance / max(fwidth(axisDistance), 1e-6)) * step(0.0, axisPoint.y);
+
+    if ((grid.flags & GRID_AXES) == 0) {
+        xAxis = 0.0;
+        zAxis = 0.0;
+        yAxis = 0.0;
+    }
+
+    plane.rgb = mix(plane.rgb, vec3(1.0, 0.0, 0.0), xAxis);
+    plane.a = max(plane.a, xAxis);
+    plane.rgb = mix(plane.rgb, vec3(0.0, 0.0, 1.0), zAxis);
+    plane.a = max(plane.a, zAxis);
+
+    bool planeHit = t > 0.0 && t < 1.0;
+    plane.a *= planeHit ? Fade(planePoint) : 0.0;
+    yAxis *= Fade(axisPoint);
+
+    float planeDepth = Depth(planePoint);
+    float axisDepth = Depth(axisPoint);
+    if (yAxis > 0.0 && (plane.a <= 0.0 || axisDepth < planeDepth)) {
+        outColor = vec4(0.0, 1.0, 0.0, yAxis);
+        gl_FragDepth = axisDepth;
+    }
+    else if (plane.a > 0.0) {
+        outColor = plane;
+        gl_FragDepth = planeDepth;
+    }
+    else {
+        discard;
+    }
+}
@@ -0,0 +1,26 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform GlobalUBO {
+    mat4 view;
+    mat4 proj;
+    mat4 viewproj;
+    vec4 viewPos;
+    // ...
+} global;
+
+// World space points of the view ray on the near and far planes
+layout(location = 0) out vec3 nearPoint;
+layout(location = 1) out vec3 farPoint;
+
+// Full screen triangle, without vertex buffer
+void main() {
+    vec2 ndc = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) * 2.0 - 1.0;
+
+    mat4 invViewProj = inverse(global.viewproj);
+    vec4 nearWorld = invViewProj * vec4(ndc, 0.0, 1.0);
+    vec4 farWorld = invViewProj * vec4(ndc, 1.0, 1.0);
+    nearPoint = nearWorld.xyz / nearWorld.w;
+    farPoint = farWorld.xyz / farWorld.w;
+
+    gl_Position = vec4(ndc, 0.0, 1.0);
+}
@@ -1,5 +1,10 @@
 #version 450
 
+// Compiled twice, with -DBINDLESS the textures come from the TextureTable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
 #define MAX_LIGHTS 8
 
 struct Light {
@@ -21,35 +26,65 @@ layout(set = 0, binding = 0) uniform GlobalUBO {
     ivec4 numLights; // x:directional, y:point, z:spot
 } global;
 
-layout(set = 1, binding = 0) uniform MaterialUBO {
+struct MaterialData {
     vec3 diffuse;
-    vec3 specular;
     float shininess;
+    vec3 specular;
+    uint diffuseTexture;
     vec3 ambient;
+    uint specularTexture;
     vec3 emissive;
-} material;
-layout(set = 1, binding = 1) uniform sampler2D diffuseSampler;
-layout(set = 1, binding = 2) uniform sampler2D specularSampler;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer MaterialTable {
+    MaterialData materials[];
+};
+
+#ifdef BINDLESS
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+#else
+layout(set = 1, binding = 0) uniform sampler2D diffuseSampler;
+layout(set = 1, binding = 1) uniform sampler2D specularSampler;
+#endif
 
 layout(location = 0) in vec3 fragPosition;
 layout(location = 1) in vec3 fragNormal;
 layout(location = 2) in vec3 fragColor;
 layout(location = 3) in vec2 fragTexCoord;
+layout(location = 4) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
+MaterialData material;
+
+#ifdef BINDLESS
+vec4 DiffuseTexel() {
+    uint index = material.diffuseTexture;
+    return texture(sampler2D(textures[nonuniformEXT(index)], samplers[nonuniformEXT(index)]), fragTexCoord);
+}
+
+vec4 SpecularTexel() {
+    uint index = material.specularTexture;
+    return texture(sampler2D(textures[nonuniformEXT(index)], samplers[nonuniformEXT(index)]), fragTexCoord);
+}
+#else
+vec4 DiffuseTexel() { return texture(diffuseSampler, fragTexCoord); }
+vec4 SpecularTexel() { return texture(specularSampler, fragTexCoord); }
+#endif
+
 vec3 DirLight(Light light, vec3 normal, vec3 viewDir) {
     vec3 lightDir = normalize(-vec3(light.direction));
 
-    vec3 ambient = vec3(light.ambient * texture(diffuseSampler, fragTexCoord) * vec4(material.ambient, 0));
+    vec3 ambient = vec3(light.ambient * DiffuseTexel() * vec4(material.ambient, 0));
     
     float diffuseIntensity = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = vec3(light.diffuse * texture(diffuseSampler, fragTexCoord) * diffuseIntensity * vec4(material.diffuse, 0));
+    vec3 diffuse = vec3(light.diffuse * DiffuseTexel() * diffuseIntensity * vec4(material.diffuse, 0));
 
     vec3 reflectDir = reflect(-lightDir, normal);
     // pow: The result is undefined if x<0 or if x=0 and y≤0
     float specularIntensity = pow(max(dot(viewDir, reflectDir), 0.0), max(material.shininess, 0.001));
-    vec3 specular = vec3(light.specular * texture(specularSampler, fragTexCoord) * specularIntensity * vec4(material.specular, 0));
+    vec3 specular = vec3(light.specular * SpecularTexel() * specularIntensity * vec4(material.specular, 0));
 
     return (ambient + diffuse + specular);
 }
@@ -67,9 +102,9 @@ vec3 PointLight(Light light, vec3 normal, vec3 viewDir) {
     float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + 
   			     light.attenuation.z * (distance * distance));    
     // combine results
-    vec3 ambient = vec3(light.ambient * texture(diffuseSampler, fragTexCoord) * vec4(material.ambient, 0));
-    vec3 diffuse = vec3(light.diffuse * texture(diffuseSampler, fragTexCoord) * diffuseIntensity * vec4(material.diffuse, 0));
-    vec3 specular = vec3(light.specular * texture(specularSampler, fragTexCoord) * specularIntensity * vec4(material.specular, 0));
+    vec3 ambient = vec3(light.ambient * DiffuseTexel() * vec4(material.ambient, 0));
+    vec3 diffuse = vec3(light.diffuse * DiffuseTexel() * diffuseIntensity * vec4(material.diffuse, 0));
+    vec3 specular = vec3(light.specular * SpecularTexel() * specularIntensity * vec4(material.specular, 0));
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
@@ -84,17 +119,17 @@ vec3 SpotLight(Light light, vec3 normal, vec3 viewDir) {
     float intensity = clamp((theta - light.cutOff.y) / epsilon, 0.0, 1.0);
     
     // ambient
-    vec3 ambient = vec3(light.ambient * texture(diffuseSampler, fragTexCoord) * vec4(material.ambient, 0));
+    vec3 ambient = vec3(light.ambient * DiffuseTexel() * vec4(material.ambient, 0));
         
     // diffuse 
     float diffuseIntensity = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = vec3(light.diffuse * texture(diffuseSampler, fragTexCoord) * diffuseIntensity * vec4(material.diffuse, 0));
+    vec3 diffuse = vec3(light.diffuse * DiffuseTexel() * diffuseIntensity * vec4(material.diffuse, 0));
         
     // specular
     vec3 reflectDir = reflect(-lightDir, normal);
     // pow: The result is undefined if x<0 or if x=0 and y≤0
     float specularIntensity = pow(max(dot(viewDir, reflectDir), 0.0), max(material.shininess, 0.001));
-    vec3 specular = vec3(light.specular * texture(specularSampler, fragTexCoord) * specularIntensity * vec4(material.specular, 0));
+    vec3 specular = vec3(light.specular * SpecularTexel() * specularIntensity * vec4(material.specular, 0));
 
     // attenuation
     float distance    = length(vec3(light.position) - fragPosition);
@@ -113,6 +148,7 @@ vec3 SpotLight(Light light, vec3 normal, vec3 viewDir) {
 }
 
 void main() {
+    material = materials[fragMaterial];
     vec3 normal = normalize(fragNormal);
     vec3 viewDir = normalize(vec3(global.viewPos) - fragPosition);
     
@@ -1,5 +1,10 @@
 #version 450
 
+// Compiled twice, with -DBINDLESS the textures come from the TextureTable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
 layout(set = 0, binding = 0) uniform GlobalUBO {
     mat4 view;
     mat4 proj;
@@ -7,31 +12,64 @@ layout(set = 0, binding = 0) uniform GlobalUBO {
     vec4 viewPos;
 } global;
 
-layout(set = 1, binding = 0) uniform MaterialUBO {
+struct MaterialData {
     vec3 diffuse;
-    vec3 specular;
     float shininess;
+    vec3 specular;
+    uint diffuseTexture;
     vec3 ambient;
-} material;
-layout(set = 1, binding = 1) uniform sampler2D diffuseSampler;
-layout(set = 1, binding = 2) uniform sampler2D specularSampler;
+    uint specularTexture;
+    vec3 emissive;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer MaterialTable {
+    MaterialData materials[];
+};
+
+#ifdef BINDLESS
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+#else
+layout(set = 1, binding = 0) uniform sampler2D diffuseSampler;
+layout(set = 1, binding = 1) uniform sampler2D specularSampler;
+#endif
 
 layout(location = 0) in vec3 fragPosition;
 layout(location = 1) in vec3 fragNormal;
 layout(location = 2) in vec3 fragColor;
 layout(location = 3) in vec2 fragTexCoord;
+layout(location = 4) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
+MaterialData material;
+
+#ifdef BINDLESS
+vec4 DiffuseTexel() {
+    uint index = material.diffuseTexture;
+    return texture(sampler2D(textures[nonuniformEXT(index)], samplers[nonuniformEXT(index)]), fragTexCoord);
+}
+
+vec4 SpecularTexel() {
+    uint index = material.specularTexture;
+    return texture(sampler2D(textures[nonuniformEXT(index)], samplers[nonuniformEXT(index)]), fragTexCoord);
+}
+#else
+vec4 DiffuseTexel() { return texture(diffuseSampler, fragTexCoord); }
+vec4 SpecularTexel() { return texture(specularSampler, fragTexCoord); }
+#endif
+
 void main() {
+    material = materials[fragMaterial];
+
     // ambient
-    vec3 ambient = texture(diffuseSampler, fragTexCoord).rgb * material.ambient;
+    vec3 ambient = DiffuseTexel().rgb * material.ambient;
         
     // diffuse
-    vec3 diffuse = texture(diffuseSampler, fragTexCoord).rgb * material.diffuse;
+    vec3 diffuse = DiffuseTexel().rgb * material.diffuse;
         
     // specular
-    vec3 specular = texture(specularSampler, fragTexCoord).rgb * material.specular;
+    vec3 specular = SpecularTexel().rgb * material.specular;
 
     outColor = vec4(fragColor*(ambient + diffuse + specular), 1);
 }
\ No newline at end of file
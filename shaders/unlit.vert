@@ -8,25 +8,59 @@ layout(set = 0, binding = 0) uniform GlobalUBO {
     // ...
 } global;
 
-layout( push_constant ) uniform PushConstants {
-	mat4 model;
-	mat3x4 normal;
-} pushConsts;
+struct InstanceData {
+    mat4 model;
+    mat3x4 normal;
+    uint materialIndex;
+};
 
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+#ifdef PACKED
+// PackedVertex: the position is relative to the mesh bounds, already folded in
+// the model matrix, and the normal is octahedral. The formats unpack the rest.
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec2 inNormal;
+layout(location = 2) in vec4 inColor;
+layout(location = 3) in vec2 inTexCoord;
+
+vec3 DecodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec3 inColor;
 layout(location = 3) in vec2 inTexCoord;
+#endif
 
 layout(location = 0) out vec3 fragPosition;
 layout(location = 1) out vec3 fragNormal;
 layout(location = 2) out vec3 fragColor;
 layout(location = 3) out vec2 fragTexCoord;
+layout(location = 4) flat out uint fragMaterial;
+
+// Bit exact with depth.vert, the depth prepass leaves the draws an EQUAL test
+invariant gl_Position;
 
 void main() {
-    fragPosition = vec3(pushConsts.model * vec4(inPosition, 1.0)); // Posicion del vertice en world space
-    fragNormal = mat3(pushConsts.normal) * inNormal;
+    // gl_InstanceIndex includes the firstInstance of the draw
+    InstanceData instance = instances[gl_InstanceIndex];
+    fragPosition = vec3(instance.model * vec4(inPosition, 1.0)); // Posicion del vertice en world space
+#ifdef PACKED
+    fragNormal = mat3(instance.normal) * DecodeOctahedral(inNormal);
+    fragColor = inColor.rgb;
+#else
+    fragNormal = mat3(instance.normal) * inNormal;
     fragColor = inColor;
+#endif
     fragTexCoord = inTexCoord;
-    gl_Position = global.viewproj * pushConsts.model * vec4(inPosition, 1.0);
+    fragMaterial = instance.materialIndex;
+    gl_Position = global.viewproj * instance.model * vec4(inPosition, 1.0);
 }
\ No newline at end of file
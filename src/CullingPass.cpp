@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "DepthPyramid.h"
+#include "Device.h"
+#include "Shader.h"
+#include "CullingPass.h"
+
+constexpr uint32_t CULL_GROUP_SIZE = 64;   // local_size_x of cull.comp
+
+CullingPass::CullingPass(Device& device, DescriptorAllocator& descriptors, VkDescriptorSetLayout globalLayout, Shader* shader, uint32_t frameCount, uint32_t capacity) :
+    m_device(device),
+    m_descriptors(descriptors)
+{
+    // 0: objects, 1: indirect commands, 2: draw counts, 3: visibility, 4: depth pyramid
+    std::vector<VkDescriptorSetLayoutBinding> bindings(5);
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = i == 4 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    m_layout = m_device.CreateDescriptorSetLayout(bindings);
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(PushConstants);
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayout layouts[] = { globalLayout, m_layout };
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = layouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+    if (m_device.CreatePipelineLayout(&pipelineLayoutInfo, &m_pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = shader->GetStages()[0];
+    pipelineInfo.layout = m_pipelineLayout;
+
+    if (m_device.CreateComputePipeline(&pipelineInfo, &m_pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+
+    m_frames.resize(frameCount);
+    for (uint32_t i = 0; i < m_frames.size(); i++) {
+        m_frames[i].desc = m_descriptors.Allocate(m_layout);
+        CreateBuffer(i, std::max(capacity, 1u));
+    }
+}
+
+CullingPass::~CullingPass() {
+    for (uint32_t i = 0; i < m_frames.size(); i++) {
+        DestroyBuffer(i);
+        m_descriptors.Free(m_frames[i].desc);
+    }
+    m_device.DestroyPipeline(m_pipeline);
+    m_device.DestroyPipelineLayout(m_pipelineLayout);
+    m_device.DestroyDescriptorSetLayout(m_layout);
+}
+
+void CullingPass::CreateBuffer(uint32_t frame, uint32_t capacity) {
+    Frame& f = m_frames[frame];
+    f.capacity = capacity;
+    m_device.CreateBuffer(sizeof(CullObject) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, f.buffer, f.memory);
+    // Host visible for the counts in the header
+    VkDeviceSize visibilitySize = sizeof(VisibilityHeader) + sizeof(uint32_t) * capacity;
+    m_device.CreateBuffer(visibilitySize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, f.visibility, f.visibilityMemory);
+    *(VisibilityHeader*)f.visibilityMemory.mapped = VisibilityHeader();
+    m_device.FlushMemory(f.visibilityMemory, 0, sizeof(VisibilityHeader));
+
+    std::vector<VkDescriptorSet> set = { f.desc.set };
+    m_device.UpdateStorageDescriptorSets(set, 0, f.buffer, 0, sizeof(CullObject) * capacity);
+    m_device.UpdateStorageDescriptorSets(set, 3, f.visibility, 0, visibilitySize);
+}
+
+void CullingPass::DestroyBuffer(uint32_t frame) {
+    Frame& f = m_frames[frame];
+    if (f.buffer == VK_NULL_HANDLE)
+        return;
+    m_device.DestroyBuffer(f.buffer);
+    m_device.FreeMemory(f.memory);
+    m_device.DestroyBuffer(f.visibility);
+    m_device.FreeMemory(f.visibilityMemory);
+    f.buffer = VK_NULL_HANDLE;
+    f.visibility = VK_NULL_HANDLE;
+    f.capacity = 0;
+}
+
+CullObject* CullingPass::Map(uint32_t frame, uint32_t count) {
+    // The frame's previous submission has finished, its buffer can be replaced
+    if (count > m_frames[frame].capacity) {
+        uint32_t capacity = m_frames[frame].capacity;
+        while (capacity < count)
+            capacity *= 2;
+        DestroyBuffer(frame);
+        CreateBuffer(frame, capacity);
+        spdlog::debug("CullingPass: frame {} grown to {} objects", frame, capacity);
+    }
+    return (CullObject*)m_frames[frame].memory.mapped;
+}
+
+void CullingPass::Flush(uint32_t frame, uint32_t first, uint32_t count) {
+    m_device.FlushMemory(m_frames[frame].memory, sizeof(CullObject) * first, sizeof(CullObject) * count);
+}
+
+OcclusionStats CullingPass::ReadStats(uint32_t frame) {
+    Frame& f = m_frames[frame];
+    m_device.InvalidateMemory(f.visibilityMemory, 0, sizeof(VisibilityHeader));
+    VisibilityHeader* header = (VisibilityHeader*)f.visibilityMemory.mapped;
+
+    OcclusionStats stats;
+    stats.frustumCulled = header->frustumCulled;
+    stats.backfacing = header->backfacing;
+    stats.occluded = header->occluded;
+    stats.disoccluded = header->disoccluded;
+
+    *header = VisibilityHeader();
+    m_device.FlushMemory(f.visibilityMemory, 0, sizeof(VisibilityHeader));
+    return stats;
+}
+
+void CullingPass::Prepare(uint32_t frame, VkBuffer commands, VkBuffer counts, const DepthPyramid* pyramid) {
+    // The indirect buffers and the pyramid may have been replaced since the frame's last submission
+    std::vector<VkDescriptorSet> set = { m_frames[frame].desc.set };
+    m_device.UpdateStorageDescriptorSets(set, 1, commands, 0, VK_WHOLE_SIZE);
+    m_device.UpdateStorageDescriptorSets(set, 2, counts, 0, VK_WHOLE_SIZE);
+
+    VkDescriptorImageInfo pyramidInfo{};
+    pyramidInfo.sampler = pyramid->GetSampler();
+    pyramidInfo.imageView = pyramid->GetView();
+    pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_device.UpdateSamplerDescriptorSet(set[0], 4, pyramidInfo);
+}
+
+void CullingPass::Record(VkCommandBuffer commandBuffer, uint32_t frame, VkDescriptorSet globalSet, uint32_t first, uint32_t count, bool compact, const CullOcclusion& occlusion) {
+    if (count == 0)
+        return;
+
+    VkDescriptorSet descSets[] = { globalSet, m_frames[frame].desc.set };
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 2, descSets, 0, nullptr);
+
+    VkExtent2D pyramidExtent = occlusion.pyramid->GetExtent();
+    PushConstants constants{};
+    constants.pyramidViewproj = occlusion.viewproj;
+    constants.pyramidSize = glm::vec2(pyramidExtent.width, pyramidExtent.height);
+    constants.pyramidLevels = occlusion.pyramid->GetLevelCount();
+    constants.first = first;
+    constants.count = count;
+    constants.compact = compact ? 1u : 0u;
+    constants.phase = (uint32_t)occlusion.phase;
+    constants.commandOffset = occlusion.commandOffset;
+    constants.bucketOffset = occlusion.bucketOffset;
+    vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+    vkCmdDispatch(commandBuffer, (count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // The draws read what the dispatch wrote, the late phase its visibility
+    // and the host its counts
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
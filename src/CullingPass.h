@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "DescriptorAllocator.h"
+#include "MemoryAllocator.h"
+
+class DepthPyramid;
+class Device;
+class Shader;
+
+// Same layout as the std430 CullObject struct of cull.comp
+struct CullObject {
+	glm::vec3 bboxMin;          // Local space bounds
+	uint32_t bucket;            // Entry of the count buffer
+	glm::vec3 bboxMax;
+	uint32_t firstCommand;      // First command slot of the bucket
+	glm::vec3 coneApex;         // Normal cone of a meshlet, see Meshlet
+	uint32_t indexCount;
+	glm::vec3 coneAxis;
+	float coneCutoff;           // MESHLET_NO_CONE for whole meshes
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t command;           // Own command slot when the output is not compacted
+	uint32_t instance;          // Instance data it is culled and drawn with
+};
+
+enum class CullPhase : uint32_t {
+	Frustum,    // Frustum test only
+	Early,      // Frustum and occlusion against the pyramid of the last frame
+	Late        // What the early phase found occluded, against the pyramid of this frame
+};
+
+// Occlusion parameters of a Record. The early and late phases of a frame share
+// 'first' and 'count', the late one writes its draws 'commandOffset' command slots
+// and 'bucketOffset' draw counts after the early one.
+struct CullOcclusion {
+	CullPhase phase = CullPhase::Frustum;
+	const DepthPyramid* pyramid = nullptr;  // The one given to Prepare, only read by the early and late phases
+	glm::mat4 viewproj{ 1.0f };               // The pyramid depth was rendered with
+	uint32_t commandOffset = 0;
+	uint32_t bucketOffset = 0;
+};
+
+// Counted on the GPU by the early (or frustum) and late phases of a frame
+struct OcclusionStats {
+	uint32_t frustumCulled = 0;
+	uint32_t backfacing = 0;
+	uint32_t occluded = 0;      // Occluded in the early phase
+	uint32_t disoccluded = 0;   // Drawn by the late phase
+};
+
+// Compute pass that tests the objects against the frustum of the GlobalUBO,
+// and optionally a DepthPyramid, and writes the indirect draws of the visible
+// ones. An object is a whole draw or one of its meshlets, each one names the
+// instance whose model matrix it is culled and drawn with.
+class CullingPass
+{
+public:
+	// shader: cull.comp, globalLayout: set 0 of the graphics pipelines
+	CullingPass(Device& device, DescriptorAllocator& descriptors, VkDescriptorSetLayout globalLayout, Shader* shader, uint32_t frameCount, uint32_t capacity);
+	~CullingPass();
+
+	CullingPass(const CullingPass&) = delete;
+	CullingPass& operator=(const CullingPass&) = delete;
+
+	// Write only pointer to the first 'count' objects, grows the buffer if needed
+	CullObject* Map(uint32_t frame, uint32_t count);
+	void Flush(uint32_t frame, uint32_t first, uint32_t count);
+
+	// Points the frame's descriptor set at the indirect commands and counts it
+	// writes and the pyramid it reads. Must be called before the first Record of
+	// the frame, the set can't be updated once a command buffer has bound it.
+	void Prepare(uint32_t frame, VkBuffer commands, VkBuffer counts, const DepthPyramid* pyramid);
+
+	// Must be recorded outside of a render pass. compact: visible objects are
+	// appended to their bucket and counted in counts[bucket] (which must be zero),
+	// otherwise every object writes its own command with 0 or 1 instances.
+	void Record(VkCommandBuffer commandBuffer, uint32_t frame, VkDescriptorSet globalSet, uint32_t first, uint32_t count, bool compact, const CullOcclusion& occlusion);
+
+	// Counts of the last submission of the frame, once its fence has signaled.
+	// Resets them for the next one.
+	OcclusionStats ReadStats(uint32_t frame);
+
+private:
+	struct Frame {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkBuffer visibility = VK_NULL_HANDLE;   // VisibilityHeader, then one entry per object
+		MemoryAllocation visibilityMemory;
+		uint32_t capacity = 0;
+		DescriptorAllocation desc;
+	};
+
+	// Same layout as the start of the Visibility buffer of cull.comp
+	struct VisibilityHeader {
+		uint32_t frustumCulled;
+		uint32_t occluded;
+		uint32_t disoccluded;
+		uint32_t backfacing;
+	};
+
+	// Same layout as the push constants of cull.comp
+	struct PushConstants {
+		glm::mat4 pyramidViewproj;
+		glm::vec2 pyramidSize;
+		uint32_t pyramidLevels;
+		uint32_t first;
+		uint32_t count;
+		uint32_t compact;
+		uint32_t phase;
+		uint32_t commandOffset;
+		uint32_t bucketOffset;
+	};
+
+	Device& m_device;
+	DescriptorAllocator& m_descriptors;
+	VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+	VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_pipeline = VK_NULL_HANDLE;
+	std::vector<Frame> m_frames;
+
+	void CreateBuffer(uint32_t frame, uint32_t capacity);
+	void DestroyBuffer(uint32_t frame);
+};
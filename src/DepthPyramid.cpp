@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "Device.h"
+#include "Shader.h"
+#include "DepthPyramid.h"
+
+constexpr uint32_t PYRAMID_GROUP_SIZE = 8;   // local_size_x/y of hiz_depth.comp and hiz_reduce.comp
+constexpr VkFormat PYRAMID_FORMAT = VK_FORMAT_R32_SFLOAT;
+
+static uint32_t PreviousPowerOfTwo(uint32_t value) {
+    uint32_t result = 1;
+    while (result * 2 <= value)
+        result *= 2;
+    return result;
+}
+
+DepthPyramid::DepthPyramid(Device& device, Shader* depthShader, Shader* reduceShader) :
+    m_device(device)
+{
+    // 0: source, 1: destination level
+    std::vector<VkDescriptorSetLayoutBinding> bindings(2);
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = 1;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    m_layout = m_device.CreateDescriptorSetLayout(bindings);
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(PushConstants);
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_layout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+    if (m_device.CreatePipelineLayout(&pipelineLayoutInfo, &m_pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    m_depthPipeline = CreatePipeline(depthShader);
+    m_reducePipeline = CreatePipeline(reduceShader);
+
+    // Texels are fetched, never filtered
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    if (m_device.CreateSampler(&samplerInfo, &m_sampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture sampler!");
+    }
+}
+
+DepthPyramid::~DepthPyramid() {
+    DestroyLevels();
+    m_device.DestroySampler(m_sampler);
+    m_device.DestroyPipeline(m_depthPipeline);
+    m_device.DestroyPipeline(m_reducePipeline);
+    m_device.DestroyPipelineLayout(m_pipelineLayout);
+    m_device.DestroyDescriptorSetLayout(m_layout);
+}
+
+VkPipeline DepthPyramid::CreatePipeline(Shader* shader) {
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = shader->GetStages()[0];
+    pipelineInfo.layout = m_pipelineLayout;
+
+    VkPipeline pipeline;
+    if (m_device.CreateComputePipeline(&pipelineInfo, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+    return pipeline;
+}
+
+void DepthPyramid::DestroyLevels() {
+    if (m_image == VK_NULL_HANDLE)
+        return;
+
+    for (Level& level : m_levels)
+        m_device.DestroyImageView(level.view);
+    m_levels.clear();
+    m_device.DestroyDescriptorPool(m_pool);
+    m_device.DestroyImageView(m_view);
+    m_device.DestroyImage(m_image);
+    m_device.FreeMemory(m_memory);
+    m_pool = VK_NULL_HANDLE;
+    m_view = VK_NULL_HANDLE;
+    m_image = VK_NULL_HANDLE;
+}
+
+void DepthPyramid::SetSource(VkImageView depthView, VkExtent2D extent, VkSampleCountFlagBits samples) {
+    DestroyLevels();
+
+    m_sourceExtent = extent;
+    m_samples = (uint32_t)samples;
+    m_extent = { PreviousPowerOfTwo(std::max(extent.width, 1u)), PreviousPowerOfTwo(std::max(extent.height, 1u)) };
+    uint32_t levelCount = 1;
+    while ((m_extent.width >> levelCount) > 0 || (m_extent.height >> levelCount) > 0)
+        levelCount++;
+
+    m_device.CreateImage(m_extent.width, m_extent.height, levelCount, VK_SAMPLE_COUNT_1_BIT, PYRAMID_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_image, m_memory);
+    m_view = m_device.CreateImageView(m_image, PYRAMID_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
+    // Never leaves GENERAL, so the CullingPass can bind it before the first Build
+    m_device.TransitionImageLayout(m_image, PYRAMID_FORMAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, levelCount);
+
+    std::vector<VkDescriptorPoolSize> poolSizes = {
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, levelCount },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levelCount }
+    };
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = levelCount;
+
+    if (m_device.CreateDescriptorPool(&poolInfo, &m_pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    m_levels.resize(levelCount);
+    for (uint32_t i = 0; i < levelCount; i++) {
+        Level& level = m_levels[i];
+        level.view = m_device.CreateImageView(m_image, PYRAMID_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, i);
+        level.set = m_device.AllocateDescriptorSet(m_pool, m_layout);
+        level.extent = { std::max(m_extent.width >> i, 1u), std::max(m_extent.height >> i, 1u) };
+
+        VkDescriptorImageInfo srcInfo{};
+        srcInfo.sampler = m_sampler;
+        srcInfo.imageView = i == 0 ? depthView : m_levels[i - 1].view;
+        srcInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+        m_device.UpdateSamplerDescriptorSet(level.set, 0, srcInfo);
+
+        VkDescriptorImageInfo dstInfo{};
+        dstInfo.imageView = level.view;
+        dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet descWrite{};
+        descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrite.dstSet = level.set;
+        descWrite.dstBinding = 1;
+        descWrite.descriptorCount = 1;
+        descWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descWrite.pImageInfo = &dstInfo;
+        m_device.UpdateDescriptorSets(1, &descWrite);
+    }
+
+    m_valid = false;
+    spdlog::debug("DepthPyramid: {}x{}, {} levels", m_extent.width, m_extent.height, levelCount);
+}
+
+void DepthPyramid::Build(VkCommandBuffer commandBuffer) {
+    // The culling dispatches of this and previous frames are done reading it
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Each level reads what the previous dispatch wrote
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    for (uint32_t i = 0; i < m_levels.size(); i++) {
+        const Level& level = m_levels[i];
+        VkExtent2D src = i == 0 ? m_sourceExtent : m_levels[i - 1].extent;
+        PushConstants constants{ src.width, src.height, level.extent.width, level.extent.height, m_samples };
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, i == 0 ? m_depthPipeline : m_reducePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &level.set, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+        vkCmdDispatch(commandBuffer, (level.extent.width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (level.extent.height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    m_valid = true;
+}
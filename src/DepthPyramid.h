@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "MemoryAllocator.h"
+
+class Device;
+class Shader;
+
+// Mip chain of the farthest depth of the depth attachment (Hi-Z), read by the
+// CullingPass to reject boxes behind what was already drawn. Level 0 is the
+// previous power of two of the attachment size, so a texel of any level covers
+// the same screen area as 2x2 texels of the level below. Kept in GENERAL layout.
+class DepthPyramid
+{
+public:
+	// depthShader: hiz_depth.comp, its MSAA variant for multisampled depth. reduceShader: hiz_reduce.comp
+	DepthPyramid(Device& device, Shader* depthShader, Shader* reduceShader);
+	~DepthPyramid();
+
+	DepthPyramid(const DepthPyramid&) = delete;
+	DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+	// Recreates the levels for a depth attachment of 'extent'. The contents are
+	// invalid until the next Build.
+	void SetSource(VkImageView depthView, VkExtent2D extent, VkSampleCountFlagBits samples);
+
+	// Must be recorded outside of a render pass, with the depth attachment in
+	// DEPTH_STENCIL_READ_ONLY_OPTIMAL and its writes made visible to compute.
+	void Build(VkCommandBuffer commandBuffer);
+	void Invalidate() { m_valid = false; }
+	bool IsValid() const { return m_valid; }
+
+	VkImageView GetView() const { return m_view; }     // All the levels
+	VkSampler GetSampler() const { return m_sampler; }
+	VkExtent2D GetExtent() const { return m_extent; }  // Of level 0
+	uint32_t GetLevelCount() const { return (uint32_t)m_levels.size(); }
+
+private:
+	struct Level {
+		VkImageView view = VK_NULL_HANDLE;
+		VkDescriptorSet set = VK_NULL_HANDLE;   // 0: previous level or depth, 1: this level
+		VkExtent2D extent;
+	};
+
+	// Same layout as the push constants of hiz_depth.comp and hiz_reduce.comp
+	struct PushConstants {
+		uint32_t srcWidth;
+		uint32_t srcHeight;
+		uint32_t dstWidth;
+		uint32_t dstHeight;
+		uint32_t samples;
+	};
+
+	Device& m_device;
+	VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+	VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_depthPipeline = VK_NULL_HANDLE;
+	VkPipeline m_reducePipeline = VK_NULL_HANDLE;
+	VkSampler m_sampler = VK_NULL_HANDLE;
+	VkDescriptorPool m_pool = VK_NULL_HANDLE;
+	VkImage m_image = VK_NULL_HANDLE;
+	MemoryAllocation m_memory;
+	VkImageView m_view = VK_NULL_HANDLE;
+	std::vector<Level> m_levels;
+	VkExtent2D m_extent{};
+	VkExtent2D m_sourceExtent{};
+	uint32_t m_samples = 1;
+	bool m_valid = false;
+
+	VkPipeline CreatePipeline(Shader* shader);
+	void DestroyLevels();
+};
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "Device.h"
+#include "DescriptorAllocator.h"
+
+constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+DescriptorAllocator::DescriptorAllocator(Device& device, const std::vector<VkDescriptorPoolSize>& poolSizes, uint32_t setsPerPool) :
+    m_device(device),
+    m_poolSizes(poolSizes),
+    m_setsPerPool(setsPerPool)
+{
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+    DescriptorStats stats = GetStats();
+    if (stats.setCount > 0)
+        spdlog::warn("DescriptorAllocator: {} descriptor sets still alive at destruction", stats.setCount);
+
+    for (Pool& pool : m_pools) {
+        if (pool.pool != VK_NULL_HANDLE)
+            m_device.DestroyDescriptorPool(pool.pool);
+    }
+}
+
+int32_t DescriptorAllocator::CreatePool() {
+    Pool pool;
+    pool.maxSets = m_setsPerPool;
+
+    std::vector<VkDescriptorPoolSize> poolSizes = m_poolSizes;
+    for (VkDescriptorPoolSize& size : poolSizes)
+        size.descriptorCount *= pool.maxSets;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = pool.maxSets;
+
+    if (m_device.CreateDescriptorPool(&poolInfo, &pool.pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    spdlog::debug("DescriptorAllocator: new pool of {} sets", pool.maxSets);
+
+    // Scenes that needed more pools will probably keep growing
+    m_setsPerPool = std::min(m_setsPerPool * 2, MAX_SETS_PER_POOL);
+
+    for (size_t i = 0; i < m_pools.size(); i++) {
+        if (m_pools[i].pool == VK_NULL_HANDLE) {
+            m_pools[i] = pool;
+            return (int32_t)i;
+        }
+    }
+    m_pools.push_back(pool);
+    return (int32_t)m_pools.size() - 1;
+}
+
+void DescriptorAllocator::ReleasePool(int32_t index) {
+    m_device.DestroyDescriptorPool(m_pools[index].pool);
+    m_pools[index] = Pool();
+}
+
+DescriptorAllocation DescriptorAllocator::Allocate(VkDescriptorSetLayout layout) {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    DescriptorAllocation allocation;
+    for (size_t i = 0; i < m_pools.size(); i++) {
+        Pool& pool = m_pools[i];
+        if (pool.pool == VK_NULL_HANDLE || pool.full)
+            continue;
+
+        allocInfo.descriptorPool = pool.pool;
+        VkResult result = m_device.AllocateDescriptorSets(&allocInfo, &allocation.set);
+        if (result == VK_SUCCESS) {
+            pool.sets++;
+            allocation.pool = (int32_t)i;
+            return allocation;
+        }
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+        pool.full = true;
+    }
+
+    int32_t index = CreatePool();
+    Pool& pool = m_pools[index];
+    allocInfo.descriptorPool = pool.pool;
+    if (m_device.AllocateDescriptorSets(&allocInfo, &allocation.set) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+    pool.sets++;
+    allocation.pool = index;
+    return allocation;
+}
+
+void DescriptorAllocator::Free(DescriptorAllocation& allocation) {
+    if (allocation.set == VK_NULL_HANDLE)
+        return;
+
+    Pool& pool = m_pools[allocation.pool];
+    m_device.FreeDescriptorSets(pool.pool, 1, &allocation.set);
+    pool.sets--;
+    pool.full = false;
+
+    // Empty pools are reset, which also undoes any fragmentation. Only one
+    // empty pool is kept around, the rest are destroyed.
+    if (pool.sets == 0) {
+        bool otherEmpty = false;
+        for (size_t i = 0; i < m_pools.size(); i++) {
+            if ((int32_t)i != allocation.pool && m_pools[i].pool != VK_NULL_HANDLE && m_pools[i].sets == 0)
+                otherEmpty = true;
+        }
+        if (otherEmpty)
+            ReleasePool(allocation.pool);
+        else
+            m_device.ResetDescriptorPool(pool.pool);
+    }
+
+    allocation = DescriptorAllocation();
+}
+
+DescriptorStats DescriptorAllocator::GetStats() const {
+    DescriptorStats stats;
+    for (const Pool& pool : m_pools) {
+        if (pool.pool == VK_NULL_HANDLE)
+            continue;
+        stats.poolCount++;
+        stats.setCount += pool.sets;
+        stats.setCapacity += pool.maxSets;
+    }
+    return stats;
+}
+
+void DescriptorAllocator::LogStats() const {
+    DescriptorStats stats = GetStats();
+    spdlog::info("Descriptor sets: {}/{} in {} pools", stats.setCount, stats.setCapacity, stats.poolCount);
+}
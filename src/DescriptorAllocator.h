@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+class Device;
+
+// A descriptor set and the pool it came from, needed to give it back
+struct DescriptorAllocation {
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	int32_t pool = -1;
+};
+
+struct DescriptorStats {
+	uint32_t poolCount = 0;
+	uint32_t setCount = 0;          // Live sets
+	uint32_t setCapacity = 0;       // maxSets of all pools
+};
+
+// Hands out descriptor sets from a chain of pools. A new, bigger pool is created
+// when the others run out of memory or get fragmented, and pools are reset when
+// their last set is freed.
+class DescriptorAllocator
+{
+public:
+	// poolSizes: descriptors of each type per set, scaled by the sets of each pool
+	DescriptorAllocator(Device& device, const std::vector<VkDescriptorPoolSize>& poolSizes, uint32_t setsPerPool);
+	~DescriptorAllocator();
+
+	DescriptorAllocator(const DescriptorAllocator&) = delete;
+	DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+	DescriptorAllocation Allocate(VkDescriptorSetLayout layout);
+	void Free(DescriptorAllocation& allocation);
+
+	DescriptorStats GetStats() const;
+	void LogStats() const;
+
+private:
+	struct Pool {
+		VkDescriptorPool pool = VK_NULL_HANDLE;
+		uint32_t maxSets = 0;
+		uint32_t sets = 0;
+		bool full = false;              // Failed an allocation, skipped until a set is freed
+	};
+
+	Device& m_device;
+	std::vector<VkDescriptorPoolSize> m_poolSizes;
+	uint32_t m_setsPerPool;
+	std::vector<Pool> m_pools;          // Released pools have pool == VK_NULL_HANDLE
+
+	int32_t CreatePool();
+	void ReleasePool(int32_t index);
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <map>
 #include <set>
@@ -5,16 +7,19 @@
 #include <spdlog/spdlog.h>
 
 #include "Swapchain.h"
+#include "UploadBatch.h"
 #include "ValidationLayers.h"
 #include "Window.h"
 
 #include "Device.h"
 
+constexpr VkDeviceSize STAGING_RING_SIZE = 32ull * 1024 * 1024;
+
 bool QueueFamilyIndices::isComplete() {
     return graphicsFamily.has_value() && presentFamily.has_value();
 }
 
-Device::Device(VkInstance instance, Window &window, ValidationLayers &validationLayers) {
+Device::Device(VkInstance instance, Window &window, ValidationLayers &validationLayers, bool descriptorIndexing) {
     m_instance = instance;
     m_window = &window;
 
@@ -23,11 +28,32 @@ Device::Device(VkInstance instance, Window &window, ValidationLayers &validation
     PrintAllPhysicalDevices();
     m_physicalDevice = SelectPhysicalDevice(surface);
     m_msaaSamples = GetMaxUsableSampleCount(m_physicalDevice);
+    if (descriptorIndexing) {
+        m_descriptorIndexing = CheckDescriptorIndexingSupport(m_physicalDevice);
+        if (!m_descriptorIndexing)
+            spdlog::warn("VK_EXT_descriptor_indexing not supported, bindless textures disabled");
+    }
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+    m_multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    m_drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+    m_drawIndirectCount = IsExtensionAvailable(m_physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    m_meshShader = CheckMeshShaderSupport(m_physicalDevice);
     m_device = CreateLogicalDevice(m_physicalDevice, surface, validationLayers);
+    if (m_drawIndirectCount)
+        m_cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(m_device, "vkCmdDrawIndexedIndirectCountKHR");
+    if (m_meshShader)
+        m_cmdDrawMeshTasks = (PFN_vkCmdDrawMeshTasksEXT)vkGetDeviceProcAddr(m_device, "vkCmdDrawMeshTasksEXT");
     m_commandPool = CreateCommandPool();
+    m_transferCommandPool = CreateCommandPool(m_transferFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    m_allocator = new MemoryAllocator(m_device, m_physicalDevice);
+    CreateStagingRing();
 }
 
 Device::~Device() {
+    DestroyStagingRing();
+    delete m_allocator;
+    vkDestroyCommandPool(m_device, m_transferCommandPool, nullptr);
     vkDestroyCommandPool(m_device, m_commandPool, nullptr);
     vkDestroyDevice(m_device, nullptr);
 }
@@ -73,7 +99,7 @@ VkDevice Device::CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceK
     QueueFamilyIndices indices = FindQueueFamilies(physicalDevice, surface);
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+    std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value(), indices.transferFamily.value() };
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -88,14 +114,46 @@ VkDevice Device::CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceK
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
     deviceFeatures.fillModeNonSolid = VK_TRUE;
+    deviceFeatures.multiDrawIndirect = m_multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = m_drawIndirectFirstInstance;
+
+    std::vector<const char*> extensions = m_extensions;
+    if (m_drawIndirectCount)
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+    // Only what the bindless texture table needs
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    if (m_descriptorIndexing) {
+        extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    }
+
+    // Task and mesh shaders are SPIR-V 1.4
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{};
+    meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+    meshShaderFeatures.pNext = m_descriptorIndexing ? &indexingFeatures : nullptr;
+    if (m_meshShader) {
+        extensions.push_back(VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_SPIRV_1_4_EXTENSION_NAME);
+        extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+        meshShaderFeatures.taskShader = VK_TRUE;
+        meshShaderFeatures.meshShader = VK_TRUE;
+    }
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = m_meshShader ? &meshShaderFeatures : meshShaderFeatures.pNext;
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());;
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(m_extensions.size());
-    createInfo.ppEnabledExtensionNames = m_extensions.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
     validationLayers.FillVkDeviceCreateInfo(createInfo);
 
     if (vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
@@ -104,6 +162,11 @@ VkDevice Device::CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceK
 
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &m_graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &m_presentQueue);
+    vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &m_transferQueue);
+    m_graphicsFamily = indices.graphicsFamily.value();
+    m_transferFamily = indices.transferFamily.value();
+    if (HasTransferQueue())
+        spdlog::info("Using dedicated transfer queue family {}", m_transferFamily);
 
     return device;
 }
@@ -204,6 +267,19 @@ QueueFamilyIndices Device::FindQueueFamilies(VkPhysicalDevice physicalDevice, Vk
         i++;
     }
 
+    // Prefer a transfer only family (usually a DMA engine) that can copy sub-regions of images
+    for (uint32_t j = 0; j < queueFamilyCount; j++) {
+        const VkQueueFamilyProperties& family = queueFamilies[j];
+        VkExtent3D granularity = family.minImageTransferGranularity;
+        if ((family.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+            indices.transferFamily = j;
+            break;
+        }
+    }
+    if (!indices.transferFamily.has_value())
+        indices.transferFamily = indices.graphicsFamily;
+
     return indices;
 }
 
@@ -227,14 +303,63 @@ bool Device:: CheckExtensionSupport(VkPhysicalDevice physicalDevice) {
     return requiredExtensions.empty();
 }
 
-VkImageView Device::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
+bool Device::IsExtensionAvailable(VkPhysicalDevice physicalDevice, const char* extensionName) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool Device::CheckDescriptorIndexingSupport(VkPhysicalDevice physicalDevice) {
+    if (!IsExtensionAvailable(physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) ||
+        !IsExtensionAvailable(physicalDevice, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+        return false;
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &indexingFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+    return indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+        indexingFeatures.runtimeDescriptorArray &&
+        indexingFeatures.descriptorBindingPartiallyBound &&
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending;
+}
+
+bool Device::CheckMeshShaderSupport(VkPhysicalDevice physicalDevice) {
+    if (!IsExtensionAvailable(physicalDevice, VK_EXT_MESH_SHADER_EXTENSION_NAME) ||
+        !IsExtensionAvailable(physicalDevice, VK_KHR_SPIRV_1_4_EXTENSION_NAME) ||
+        !IsExtensionAvailable(physicalDevice, VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME))
+        return false;
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{};
+    meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &meshShaderFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+    return meshShaderFeatures.taskShader && meshShaderFeatures.meshShader;
+}
+
+VkImageView Device::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel) {
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.image = image;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectFlags;
-    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
     viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
@@ -254,10 +379,14 @@ void Device::DestroyImageView(VkImageView imageView) {
 VkCommandPool Device::CreateCommandPool() {
     QueueFamilyIndices queueFamilyIndices = FindQueueFamilies();
 
+    return CreateCommandPool(queueFamilyIndices.graphicsFamily.value(), VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+}
+
+VkCommandPool Device::CreateCommandPool(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags) {
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+    poolInfo.flags = flags;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
 
     VkCommandPool commandPool;
 
@@ -305,6 +434,13 @@ VkResult Device::CreateGraphicsPipeline(
     return vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, pCreateInfo, nullptr, pPipeline);
 }
 
+VkResult Device::CreateComputePipeline(
+    const VkComputePipelineCreateInfo* pCreateInfo,
+    VkPipeline* pPipeline)
+{
+    return vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, pCreateInfo, nullptr, pPipeline);
+}
+
 VkShaderModule Device::CreateShaderModule(const std::vector<char>& code)
 {
     VkShaderModuleCreateInfo createInfo{};
@@ -375,7 +511,7 @@ void Device::CreateBuffer(
     VkBufferUsageFlags usage, 
     VkMemoryPropertyFlags properties, 
     VkBuffer& buffer, 
-    VkDeviceMemory& bufferMemory) 
+    MemoryAllocation& bufferMemory) 
 {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -390,51 +526,21 @@ void Device::CreateBuffer(
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+    bufferMemory = m_allocator->Allocate(memRequirements, properties, true);
 
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-
-    vkBindBufferMemory(m_device, buffer, bufferMemory, 0);
+    vkBindBufferMemory(m_device, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
-void Device::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+void Device::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset) {
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
 
     VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0; // Optional
-    copyRegion.dstOffset = 0; // Optional
+    copyRegion.srcOffset = 0;
+    copyRegion.dstOffset = dstOffset;
     copyRegion.size = size;
     vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(m_graphicsQueue);
-
-    vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+    EndSingleTimeCommands(commandBuffer);
 }
 
 void Device::CreateImage(
@@ -447,7 +553,7 @@ void Device::CreateImage(
     VkImageUsageFlags usage, 
     VkMemoryPropertyFlags properties, 
     VkImage& image, 
-    VkDeviceMemory& imageMemory) 
+    MemoryAllocation& imageMemory) 
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -471,16 +577,9 @@ void Device::CreateImage(
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(m_device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+    imageMemory = m_allocator->Allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR);
 
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(m_device, image, imageMemory, 0);
+    vkBindImageMemory(m_device, image, imageMemory.memory, imageMemory.offset);
 }
 
 void Device::DestroyImage(VkImage image) { vkDestroyImage(m_device, image, nullptr); }
@@ -502,6 +601,152 @@ VkResult Device::MapMemory(
     return vkMapMemory(m_device, memory, offset, size, flags, ppData);
 }
 
+void Device::CreateStagingRing() {
+    CreateBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_stagingBuffer, m_stagingMemory);
+    m_stagingRing.Reset(STAGING_RING_SIZE);
+}
+
+void Device::DestroyStagingRing() {
+    vkDeviceWaitIdle(m_device);
+    while (!m_pendingUploads.empty())
+        RetireUploads(true);
+    for (VkFence fence : m_freeFences)
+        vkDestroyFence(m_device, fence, nullptr);
+    m_freeFences.clear();
+    for (VkSemaphore semaphore : m_freeSemaphores)
+        vkDestroySemaphore(m_device, semaphore, nullptr);
+    m_freeSemaphores.clear();
+
+    vkDestroyBuffer(m_device, m_stagingBuffer, nullptr);
+    m_allocator->Free(m_stagingMemory);
+}
+
+void Device::RetireUploads(bool waitOldest) {
+    if (waitOldest && !m_pendingUploads.empty())
+        vkWaitForFences(m_device, 1, &m_pendingUploads.front().fence, VK_TRUE, UINT64_MAX);
+
+    // Submissions on both queues are retired in the order they were made
+    while (!m_pendingUploads.empty()) {
+        PendingUpload& upload = m_pendingUploads.front();
+        if (vkGetFenceStatus(m_device, upload.fence) != VK_SUCCESS)
+            break;
+        m_stagingRing.Release(upload.marker);
+        vkResetFences(m_device, 1, &upload.fence);
+        m_freeFences.push_back(upload.fence);
+        if (upload.waitSemaphore != VK_NULL_HANDLE)
+            m_freeSemaphores.push_back(upload.waitSemaphore);
+        vkFreeCommandBuffers(m_device, upload.commandPool, 1, &upload.commandBuffer);
+        if (upload.last)
+            m_completedUpload = upload.token;
+        m_pendingUploads.pop_front();
+    }
+}
+
+bool Device::IsUploadComplete(UploadToken token) {
+    RetireUploads(false);
+    return m_completedUpload >= token;
+}
+
+void Device::WaitUpload(UploadToken token) {
+    while (m_completedUpload < token && !m_pendingUploads.empty())
+        RetireUploads(true);
+}
+
+VkCommandBuffer Device::BeginUploadCommands(VkCommandPool commandPool) {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    return commandBuffer;
+}
+
+VkSemaphore Device::SubmitUploadCommands(VkQueue queue, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore, bool signal, UploadToken token, bool last) {
+    vkEndCommandBuffer(commandBuffer);
+
+    PendingUpload upload;
+    upload.token = token;
+    upload.last = last;
+    upload.commandPool = commandPool;
+    upload.commandBuffer = commandBuffer;
+    upload.waitSemaphore = waitSemaphore;
+    upload.marker = m_stagingRing.Commit();
+    if (!m_freeFences.empty()) {
+        upload.fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    }
+    else {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(m_device, &fenceInfo, nullptr, &upload.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+    }
+
+    VkSemaphore signalSemaphore = VK_NULL_HANDLE;
+    if (signal) {
+        if (!m_freeSemaphores.empty()) {
+            signalSemaphore = m_freeSemaphores.back();
+            m_freeSemaphores.pop_back();
+        }
+        else {
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &signalSemaphore) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create upload semaphore!");
+            }
+        }
+    }
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphores = &waitSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = signal ? 1 : 0;
+    submitInfo.pSignalSemaphores = &signalSemaphore;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, upload.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit upload command buffer!");
+    }
+
+    m_pendingUploads.push_back(upload);
+    return signalSemaphore;
+}
+
+UploadToken Device::UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    UploadBatch batch(*this);
+    batch.UploadBuffer(dstBuffer, dstOffset, data, size);
+    return batch.Submit();
+}
+
+UploadToken Device::UploadImage(
+    VkImage image,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mipLevels,
+    uint32_t texelSize,
+    const void* pixels,
+    const std::function<void(VkCommandBuffer)>& recordGraphics)
+{
+    UploadBatch batch(*this);
+    batch.UploadImage(image, width, height, mipLevels, texelSize, pixels, recordGraphics);
+    return batch.Submit();
+}
+
 VkCommandBuffer Device::BeginSingleTimeCommands() {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -529,8 +774,17 @@ void Device::EndSingleTimeCommands(VkCommandBuffer commandBuffer) {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
-    vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(m_graphicsQueue);
+    // Only wait for this submission, not for everything else in the queue
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    if (vkCreateFence(m_device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create fence!");
+    }
+
+    vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, fence);
+    vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(m_device, fence, nullptr);
 
     vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
 }
@@ -581,6 +835,13 @@ void Device::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout
         sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
         destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     }
+    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_GENERAL) {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        destinationStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
     else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
         barrier.srcAccessMask = 0;
         barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
@@ -676,27 +937,6 @@ VkResult Device::CreateDescriptorPool(
     return vkCreateDescriptorPool(m_device, pCreateInfo, nullptr, pDescriptorPool);
 }
 
-VkDescriptorPool Device::CreateDescriptorPool() {
-    std::vector<VkDescriptorPoolSize> poolSizes{
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 100 },
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 100 }
-    };
-
-    VkDescriptorPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = 200;
-
-    VkDescriptorPool descriptorPool;
-    if (CreateDescriptorPool(&poolInfo, &descriptorPool) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor pool!");
-    }
-
-    return descriptorPool;
-}
-
 VkResult Device::CreateDescriptorSetLayout(
     const VkDescriptorSetLayoutCreateInfo* pCreateInfo,
     VkDescriptorSetLayout* pSetLayout)
@@ -791,8 +1031,9 @@ void Device::UpdateUniformDescriptorSet(VkDescriptorSet descSet, uint32_t bindin
 
 void Device::UpdateUniformDescriptorSets(std::vector<VkDescriptorSet>& descSets, uint32_t bindingID, VkBuffer& buffer, VkDeviceSize size) {
     std::vector<VkWriteDescriptorSet> descWrites(descSets.size());
+    std::vector<VkDescriptorBufferInfo> bufferInfos(descSets.size());
     for (int i = 0; i < descSets.size(); i++) {
-        VkDescriptorBufferInfo bufferInfo{};
+        VkDescriptorBufferInfo& bufferInfo = bufferInfos[i];
         bufferInfo.buffer = buffer;
         bufferInfo.offset = PadUniformBufferSize(size) * i;
         bufferInfo.range = size;
@@ -807,6 +1048,25 @@ void Device::UpdateUniformDescriptorSets(std::vector<VkDescriptorSet>& descSets,
     UpdateDescriptorSets(static_cast<uint32_t>(descWrites.size()), descWrites.data());
 }
 
+void Device::UpdateStorageDescriptorSets(std::vector<VkDescriptorSet>& descSets, uint32_t bindingID, VkBuffer buffer, VkDeviceSize stride, VkDeviceSize size) {
+    std::vector<VkWriteDescriptorSet> descWrites(descSets.size());
+    std::vector<VkDescriptorBufferInfo> bufferInfos(descSets.size());
+    for (int i = 0; i < descSets.size(); i++) {
+        VkDescriptorBufferInfo& bufferInfo = bufferInfos[i];
+        bufferInfo.buffer = buffer;
+        bufferInfo.offset = stride * i;
+        bufferInfo.range = size;
+
+        descWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[i].dstSet = descSets[i];
+        descWrites[i].dstBinding = bindingID;
+        descWrites[i].descriptorCount = 1;
+        descWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descWrites[i].pBufferInfo = &bufferInfo;
+    }
+    UpdateDescriptorSets(static_cast<uint32_t>(descWrites.size()), descWrites.data());
+}
+
 void Device::UpdateSamplerDescriptorSet(VkDescriptorSet descSet, uint32_t bindingID, VkDescriptorImageInfo& imageInfo) {
     VkWriteDescriptorSet descWrite{};
     descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -819,11 +1079,37 @@ void Device::UpdateSamplerDescriptorSet(VkDescriptorSet descSet, uint32_t bindin
     UpdateDescriptorSets(1, &descWrite);
 }
 
-void Device::UpdateUniformBuffer(VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize size, void* data) {
-    void* dst;
-    MapMemory(memory, offset, size, 0, &dst);
-    memcpy(dst, data, size);
-    UnmapMemory(memory);
+void Device::FlushMemory(const MemoryAllocation& memory, VkDeviceSize offset, VkDeviceSize size) {
+    if (m_allocator->IsCoherent(memory))
+        return;
+
+    // The allocator keeps non coherent allocations aligned and padded to nonCoherentAtomSize
+    VkDeviceSize atomSize = m_allocator->GetNonCoherentAtomSize();
+    VkDeviceSize begin = (memory.offset + offset) / atomSize * atomSize;
+    VkDeviceSize end = std::min(FreeList::AlignUp(memory.offset + offset + size, atomSize), memory.offset + memory.size);
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = memory.memory;
+    range.offset = begin;
+    range.size = end - begin;
+    vkFlushMappedMemoryRanges(m_device, 1, &range);
+}
+
+void Device::InvalidateMemory(const MemoryAllocation& memory, VkDeviceSize offset, VkDeviceSize size) {
+    if (m_allocator->IsCoherent(memory))
+        return;
+
+    VkDeviceSize atomSize = m_allocator->GetNonCoherentAtomSize();
+    VkDeviceSize begin = (memory.offset + offset) / atomSize * atomSize;
+    VkDeviceSize end = std::min(FreeList::AlignUp(memory.offset + offset + size, atomSize), memory.offset + memory.size);
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = memory.memory;
+    range.offset = begin;
+    range.size = end - begin;
+    vkInvalidateMappedMemoryRanges(m_device, 1, &range);
 }
 
 size_t Device::PadUniformBufferSize(size_t originalSize)
@@ -838,3 +1124,15 @@ size_t Device::PadUniformBufferSize(size_t originalSize)
     }
     return alignedSize;
 }
+
+size_t Device::PadStorageBufferSize(size_t originalSize)
+{
+    VkPhysicalDeviceProperties properties;
+    GetProperties(&properties);
+    size_t minSsboAlignment = properties.limits.minStorageBufferOffsetAlignment;
+    size_t alignedSize = originalSize;
+    if (minSsboAlignment > 0) {
+        alignedSize = (alignedSize + minSsboAlignment - 1) & ~(minSsboAlignment - 1);
+    }
+    return alignedSize;
+}
@@ -1,8 +1,12 @@
 #pragma once
+#include <deque>
+#include <functional>
 #include <optional>
 
 #include <vulkan/vulkan.h>
 
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
 #include "ValidationLayers.h"
 
 class Window;
@@ -10,20 +14,43 @@ class Window;
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	std::optional<uint32_t> transferFamily;     // Transfer only family if there is one, graphics otherwise
 
 	bool isComplete();
 };
 
+// Increases with every upload. An upload is complete when all of its copies
+// have finished and the data can be used by the graphics queue.
+typedef uint64_t UploadToken;
+
 class Device
 {
 public:
-	Device(VkInstance instance, Window &window, ValidationLayers& validationLayers);
+	// descriptorIndexing: enable VK_EXT_descriptor_indexing if the GPU supports it
+	Device(VkInstance instance, Window &window, ValidationLayers& validationLayers, bool descriptorIndexing = false);
 	~Device();
 
 	VkDevice Get() const { return m_device; }
 
 	VkQueue GetGraphicsQueue() const { return m_graphicsQueue; }
 	VkQueue GetPresentQueue() const { return m_presentQueue; }
+	VkQueue GetTransferQueue() const { return m_transferQueue; }
+	bool HasTransferQueue() const { return m_transferFamily != m_graphicsFamily; }
+	bool HasDescriptorIndexing() const { return m_descriptorIndexing; }
+	bool HasMultiDrawIndirect() const { return m_multiDrawIndirect; }
+	bool HasDrawIndirectFirstInstance() const { return m_drawIndirectFirstInstance; }
+	bool HasDrawIndirectCount() const { return m_cmdDrawIndexedIndirectCount != nullptr; }
+	bool HasMeshShader() const { return m_cmdDrawMeshTasks != nullptr; }
+
+	// VK_KHR_draw_indirect_count, only if HasDrawIndirectCount()
+	void CmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) {
+		m_cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+	}
+
+	// VK_EXT_mesh_shader, task and mesh stages, only if HasMeshShader()
+	void CmdDrawMeshTasks(VkCommandBuffer commandBuffer, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) {
+		m_cmdDrawMeshTasks(commandBuffer, groupCountX, groupCountY, groupCountZ);
+	}
 
 	VkSampleCountFlagBits GetMSAASamples() const { return m_msaaSamples; }
 	VkCommandPool GetCommandPool() const { return m_commandPool; }
@@ -34,9 +61,11 @@ public:
 	VkPhysicalDevice GetPhysicalDevice() const { return m_physicalDevice; }
 
 	VkCommandPool CreateCommandPool();
+	VkCommandPool CreateCommandPool(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags);
 	void DestroyCommandPool(VkCommandPool commandPool);
+	VkResult ResetCommandPool(VkCommandPool commandPool) { return vkResetCommandPool(m_device, commandPool, 0); }
 	
-	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
+	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0);
 	void DestroyImageView(VkImageView imageView);
 
 	VkResult CreateRenderPass(
@@ -53,6 +82,10 @@ public:
 		const VkGraphicsPipelineCreateInfo* pCreateInfo,
 		VkPipeline* pPipeline);
 
+	VkResult CreateComputePipeline(
+		const VkComputePipelineCreateInfo* pCreateInfo,
+		VkPipeline* pPipeline);
+
 	void DestroyPipeline(VkPipeline pipeline) { vkDestroyPipeline(m_device, pipeline, nullptr); }
 
 	void DestroyPipelineLayout(VkPipelineLayout pipelineLayout) { vkDestroyPipelineLayout(m_device, pipelineLayout, nullptr); }
@@ -71,6 +104,8 @@ public:
 		const VkCommandBufferAllocateInfo* pAllocateInfo,
 		VkCommandBuffer* pCommandBuffers);
 
+	void FreeCommandBuffers(VkCommandPool commandPool, uint32_t count, const VkCommandBuffer* pCommandBuffers) { vkFreeCommandBuffers(m_device, commandPool, count, pCommandBuffers); }
+
 	VkResult CreateSemaphore(
 		const VkSemaphoreCreateInfo* pCreateInfo,
 		VkSemaphore* pSemaphore);
@@ -98,9 +133,29 @@ public:
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkBuffer& buffer,
-		VkDeviceMemory& bufferMemory);
-
-	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+		MemoryAllocation& bufferMemory);
+
+	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+	// Uploads go through the persistent staging ring and the transfer queue and
+	// are submitted without waiting, one submission per call (see UploadBatch).
+	// Ownership is handed back to the graphics queue, so later submissions on it
+	// see the data.
+	UploadToken UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+	// Fills mip 0, the other levels are left in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL.
+	// recordGraphics runs on a graphics command buffer once the image is owned by
+	// the graphics queue and must leave it in its final layout.
+	UploadToken UploadImage(
+		VkImage image,
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevels,
+		uint32_t texelSize,
+		const void* pixels,
+		const std::function<void(VkCommandBuffer)>& recordGraphics);
+	bool IsUploadComplete(UploadToken token);
+	void WaitUpload(UploadToken token);
+	UploadToken GetLastUploadToken() const { return m_lastUpload; }
 
 	void DestroyBuffer(VkBuffer buffer) { vkDestroyBuffer(m_device, buffer, nullptr); }
 
@@ -114,7 +169,7 @@ public:
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory);
+		MemoryAllocation& imageMemory);
 
 	void DestroyImage(VkImage image);
 
@@ -123,6 +178,8 @@ public:
 		VkDeviceMemory* pMemory);
 
 	void FreeMemory(VkDeviceMemory memory) { vkFreeMemory(m_device, memory, nullptr); }
+	void FreeMemory(MemoryAllocation& allocation) { m_allocator->Free(allocation); }
+	MemoryStats GetMemoryStats() const { return m_allocator->GetStats(); }
 
 	VkResult MapMemory(
 		VkDeviceMemory memory,
@@ -156,14 +213,14 @@ public:
 		const VkDescriptorPoolCreateInfo* pCreateInfo,
 		VkDescriptorPool* pDescriptorPool);
 
-	VkDescriptorPool CreateDescriptorPool();
-
 	VkDescriptorSet AllocateDescriptorSet(VkDescriptorPool pool, VkDescriptorSetLayout layout);
 
 	std::vector<VkDescriptorSet> AllocateDescriptorSets(VkDescriptorPool pool, VkDescriptorSetLayout layout, uint32_t count);
 
 	void DestroyDescriptorPool(VkDescriptorPool descriptorPool) { vkDestroyDescriptorPool(m_device, descriptorPool, nullptr); }
 
+	VkResult ResetDescriptorPool(VkDescriptorPool descriptorPool) { return vkResetDescriptorPool(m_device, descriptorPool, 0); }
+
 	VkResult CreateDescriptorSetLayout(
 		const VkDescriptorSetLayoutCreateInfo* pCreateInfo,
 		VkDescriptorSetLayout* pSetLayout);
@@ -187,9 +244,15 @@ public:
 
 	void UpdateUniformDescriptorSet(VkDescriptorSet descSet, uint32_t bindingID, VkBuffer buffer, VkDeviceSize size);
 	void UpdateUniformDescriptorSets(std::vector<VkDescriptorSet>& descSets, uint32_t bindingID, VkBuffer& buffer, VkDeviceSize size);
+	// One slice of 'stride' bytes per set, each one 'size' bytes long
+	void UpdateStorageDescriptorSets(std::vector<VkDescriptorSet>& descSets, uint32_t bindingID, VkBuffer buffer, VkDeviceSize stride, VkDeviceSize size);
 	void UpdateSamplerDescriptorSet(VkDescriptorSet descSet, uint32_t bindingID, VkDescriptorImageInfo& imageInfo);
-	void UpdateUniformBuffer(VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize size, void* data);
+	// Makes host writes to mapped memory visible, nothing to do for coherent memory
+	void FlushMemory(const MemoryAllocation& memory, VkDeviceSize offset, VkDeviceSize size);
+	// Makes device writes to mapped memory visible to the host, after the fence of the submission
+	void InvalidateMemory(const MemoryAllocation& memory, VkDeviceSize offset, VkDeviceSize size);
 	size_t PadUniformBufferSize(size_t originalSize);
+	size_t PadStorageBufferSize(size_t originalSize);
 
 	VkResult WaitIdle() { return vkDeviceWaitIdle(m_device); }
 
@@ -199,6 +262,8 @@ public:
 	static void Print(int id, VkPhysicalDevice device);
 
 private:
+	friend class UploadBatch;
+
 	const std::vector<const char*> m_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
 	VkInstance m_instance = VK_NULL_HANDLE;
@@ -208,13 +273,53 @@ private:
 	VkSampleCountFlagBits m_msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 	VkQueue m_graphicsQueue = VK_NULL_HANDLE;
 	VkQueue m_presentQueue = VK_NULL_HANDLE;
+	VkQueue m_transferQueue = VK_NULL_HANDLE;
+	uint32_t m_graphicsFamily = 0;
+	uint32_t m_transferFamily = 0;
+	bool m_descriptorIndexing = false;
+	bool m_multiDrawIndirect = false;
+	bool m_drawIndirectFirstInstance = false;
+	bool m_drawIndirectCount = false;
+	PFN_vkCmdDrawIndexedIndirectCountKHR m_cmdDrawIndexedIndirectCount = nullptr;
+	bool m_meshShader = false;
+	PFN_vkCmdDrawMeshTasksEXT m_cmdDrawMeshTasks = nullptr;
 	VkCommandPool m_commandPool = VK_NULL_HANDLE;
+	VkCommandPool m_transferCommandPool = VK_NULL_HANDLE;
+	MemoryAllocator* m_allocator = nullptr;
+
+	struct PendingUpload {
+		UploadToken token;
+		bool last;                      // Last submission of the upload
+		VkFence fence;
+		VkCommandPool commandPool;
+		VkCommandBuffer commandBuffer;
+		VkSemaphore waitSemaphore;      // Transfer -> graphics handoff, recycled with the fence
+		StagingMarker marker;
+	};
+
+	StagingRing m_stagingRing;
+	VkBuffer m_stagingBuffer = VK_NULL_HANDLE;
+	MemoryAllocation m_stagingMemory;
+	std::deque<PendingUpload> m_pendingUploads;  // In submission order
+	std::vector<VkFence> m_freeFences;
+	std::vector<VkSemaphore> m_freeSemaphores;
+	UploadToken m_lastUpload = 0;
+	UploadToken m_completedUpload = 0;
 
 	void PrintAllPhysicalDevices();
 	VkPhysicalDevice SelectPhysicalDevice(VkSurfaceKHR surface);
 	bool IsSuitable(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
 	VkSampleCountFlagBits GetMaxUsableSampleCount(VkPhysicalDevice physicalDevice);
 	bool CheckExtensionSupport(VkPhysicalDevice physicalDevice);
+	bool IsExtensionAvailable(VkPhysicalDevice physicalDevice, const char* extensionName);
+	bool CheckDescriptorIndexingSupport(VkPhysicalDevice physicalDevice);
+	bool CheckMeshShaderSupport(VkPhysicalDevice physicalDevice);
 
 	VkDevice CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, ValidationLayers& validationLayers);
+
+	void CreateStagingRing();
+	void DestroyStagingRing();
+	VkCommandBuffer BeginUploadCommands(VkCommandPool commandPool);
+	VkSemaphore SubmitUploadCommands(VkQueue queue, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore, bool signal, UploadToken token, bool last);
+	void RetireUploads(bool waitOldest);
 };
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// First-fit range allocator over [0, size). Used to sub-allocate device memory
+// blocks and the shared geometry buffers. Offsets/sizes are in bytes.
+class FreeList
+{
+public:
+	FreeList() = default;
+	FreeList(uint64_t size) { Reset(size); }
+
+	void Reset(uint64_t size) {
+		m_size = size;
+		m_used = 0;
+		m_ranges.clear();
+		if (size > 0)
+			m_ranges.push_back({ 0, size });
+	}
+
+	bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+		// The alignment padding in front of the allocation stays in the free list.
+		for (size_t i = 0; i < m_ranges.size(); i++) {
+			Range& range = m_ranges[i];
+			uint64_t aligned = AlignUp(range.offset, alignment);
+			uint64_t padding = aligned - range.offset;
+			if (padding + size > range.size)
+				continue;
+
+			uint64_t end = range.offset + range.size;
+			uint64_t allocEnd = aligned + size;
+			if (padding > 0) {
+				range.size = padding;
+				if (allocEnd < end)
+					m_ranges.insert(m_ranges.begin() + i + 1, { allocEnd, end - allocEnd });
+			}
+			else if (allocEnd < end) {
+				range.offset = allocEnd;
+				range.size = end - allocEnd;
+			}
+			else {
+				m_ranges.erase(m_ranges.begin() + i);
+			}
+
+			m_used += size;
+			offset = aligned;
+			return true;
+		}
+		return false;
+	}
+
+	void Free(uint64_t offset, uint64_t size) {
+		auto it = std::lower_bound(m_ranges.begin(), m_ranges.end(), offset,
+			[](const Range& range, uint64_t value) { return range.offset < value; });
+		it = m_ranges.insert(it, { offset, size });
+		m_used -= size;
+
+		// Coalesce with the next range
+		auto next = it + 1;
+		if (next != m_ranges.end() && it->offset + it->size == next->offset) {
+			it->size += next->size;
+			m_ranges.erase(next);
+		}
+		// Coalesce with the previous range
+		if (it != m_ranges.begin()) {
+			auto prev = it - 1;
+			if (prev->offset + prev->size == it->offset) {
+				prev->size += it->size;
+				m_ranges.erase(it);
+			}
+		}
+	}
+
+	uint64_t GetSize() const { return m_size; }
+	uint64_t GetUsed() const { return m_used; }
+	bool IsEmpty() const { return m_used == 0; }
+	// A fully packed list has at most one free range, at the end.
+	bool IsFragmented() const { return m_ranges.size() > 1 || (m_ranges.size() == 1 && m_ranges[0].offset + m_ranges[0].size != m_size); }
+
+	static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+		if (alignment <= 1)
+			return value;
+		return ((value + alignment - 1) / alignment) * alignment;
+	}
+
+private:
+	struct Range {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	uint64_t m_size = 0;
+	uint64_t m_used = 0;
+	std::vector<Range> m_ranges; // Sorted by offset
+};
@@ -0,0 +1,222 @@
+#include <cmath>
+
+#if defined(__AVX__)
+#define CULL_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULL_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define CULL_NEON
+#include <arm_neon.h>
+#endif
+
+#include "Mesh.h"
+#include "JobSystem.h"
+#include "FrustumCuller.h"
+
+constexpr uint32_t CULL_CHUNK_SIZE = 4096;     // Meshes per parallel task, multiple of the SIMD width
+
+const char* FrustumCuller::GetKernelName() {
+#if defined(CULL_AVX)
+    return "AVX";
+#elif defined(CULL_SSE)
+    return "SSE";
+#elif defined(CULL_NEON)
+    return "NEON";
+#else
+    return "Scalar";
+#endif
+}
+
+void FrustumCuller::Begin(const glm::mat4& viewproj) {
+    // Rows of the matrix (Gribb/Hartmann), the near plane is z >= 0
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewproj[0][i], viewproj[1][i], viewproj[2][i], viewproj[3][i]);
+
+    m_planes[0] = rows[3] + rows[0];
+    m_planes[1] = rows[3] - rows[0];
+    m_planes[2] = rows[3] + rows[1];
+    m_planes[3] = rows[3] - rows[1];
+    m_planes[4] = rows[2];
+    m_planes[5] = rows[3] - rows[2];
+    for (glm::vec4& plane : m_planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    m_items.clear();
+}
+
+void FrustumCuller::Add(Mesh* mesh, const glm::mat4* matrix, const glm::mat3x4* normalMatrix) {
+    m_items.push_back({ mesh, matrix, normalMatrix });
+}
+
+void FrustumCuller::Draw() {
+    uint32_t count = (uint32_t)m_items.size();
+    m_centerX.resize(count);
+    m_centerY.resize(count);
+    m_centerZ.resize(count);
+    m_extentX.resize(count);
+    m_extentY.resize(count);
+    m_extentZ.resize(count);
+    m_visible.resize(count);
+
+    JobSystem::ParallelFor(count, CULL_CHUNK_SIZE, [this](uint32_t first, uint32_t end) { CullRange(first, end); });
+
+    m_stats = CullingStats();
+    for (uint32_t i = 0; i < count; i++) {
+        if (m_visible[i]) {
+            m_items[i].mesh->Draw(*m_items[i].matrix, *m_items[i].normalMatrix);
+            m_stats.visible++;
+        }
+        else {
+            m_stats.culled++;
+        }
+    }
+}
+
+void FrustumCuller::CullRange(uint32_t first, uint32_t end) {
+    // Local bounds to world space: the center is transformed, the half extents
+    // are projected on the absolute value of the axes
+    for (uint32_t i = first; i < end; i++) {
+        const glm::mat4& m = *m_items[i].matrix;
+        glm::vec3 bboxMin = m_items[i].mesh->GetBBoxMin();
+        glm::vec3 bboxMax = m_items[i].mesh->GetBBoxMax();
+        glm::vec3 center = glm::vec3(m * glm::vec4((bboxMin + bboxMax) * 0.5f, 1.0f));
+        glm::vec3 extents = glm::mat3(glm::abs(glm::vec3(m[0])), glm::abs(glm::vec3(m[1])), glm::abs(glm::vec3(m[2]))) * ((bboxMax - bboxMin) * 0.5f);
+
+        m_centerX[i] = center.x;
+        m_centerY[i] = center.y;
+        m_centerZ[i] = center.z;
+        m_extentX[i] = extents.x;
+        m_extentY[i] = extents.y;
+        m_extentZ[i] = extents.z;
+    }
+
+    TestRange(first, end);
+}
+
+// A box is outside if it is behind any plane: distance(center) + radius < 0,
+// with radius = dot(extents, abs(plane normal))
+void FrustumCuller::TestRange(uint32_t first, uint32_t end) {
+    uint32_t i = first;
+
+#if defined(CULL_AVX)
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; p++) {
+        planeX[p] = _mm256_set1_ps(m_planes[p].x);
+        planeY[p] = _mm256_set1_ps(m_planes[p].y);
+        planeZ[p] = _mm256_set1_ps(m_planes[p].z);
+        planeW[p] = _mm256_set1_ps(m_planes[p].w);
+        absX[p] = _mm256_set1_ps(std::fabs(m_planes[p].x));
+        absY[p] = _mm256_set1_ps(std::fabs(m_planes[p].y));
+        absZ[p] = _mm256_set1_ps(std::fabs(m_planes[p].z));
+    }
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (; i + 8 <= end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&m_centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&m_centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&m_centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&m_extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&m_extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&m_extentZ[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(cx, planeX[p]), _mm256_mul_ps(cy, planeY[p])),
+                _mm256_add_ps(_mm256_mul_ps(cz, planeZ[p]), planeW[p]));
+            __m256 radius = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(ex, absX[p]), _mm256_mul_ps(ey, absY[p])),
+                _mm256_mul_ps(ez, absZ[p]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++)
+            m_visible[i + k] = (mask >> k) & 1;
+    }
+#elif defined(CULL_SSE)
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; p++) {
+        planeX[p] = _mm_set1_ps(m_planes[p].x);
+        planeY[p] = _mm_set1_ps(m_planes[p].y);
+        planeZ[p] = _mm_set1_ps(m_planes[p].z);
+        planeW[p] = _mm_set1_ps(m_planes[p].w);
+        absX[p] = _mm_set1_ps(std::fabs(m_planes[p].x));
+        absY[p] = _mm_set1_ps(std::fabs(m_planes[p].y));
+        absZ[p] = _mm_set1_ps(std::fabs(m_planes[p].z));
+    }
+    const __m128 zero = _mm_setzero_ps();
+
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&m_centerX[i]);
+        __m128 cy = _mm_loadu_ps(&m_centerY[i]);
+        __m128 cz = _mm_loadu_ps(&m_centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&m_extentX[i]);
+        __m128 ey = _mm_loadu_ps(&m_extentY[i]);
+        __m128 ez = _mm_loadu_ps(&m_extentZ[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cx, planeX[p]), _mm_mul_ps(cy, planeY[p])),
+                _mm_add_ps(_mm_mul_ps(cz, planeZ[p]), planeW[p]));
+            __m128 radius = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(ex, absX[p]), _mm_mul_ps(ey, absY[p])),
+                _mm_mul_ps(ez, absZ[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++)
+            m_visible[i + k] = (mask >> k) & 1;
+    }
+#elif defined(CULL_NEON)
+    float32x4_t planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; p++) {
+        planeX[p] = vdupq_n_f32(m_planes[p].x);
+        planeY[p] = vdupq_n_f32(m_planes[p].y);
+        planeZ[p] = vdupq_n_f32(m_planes[p].z);
+        planeW[p] = vdupq_n_f32(m_planes[p].w);
+        absX[p] = vdupq_n_f32(std::fabs(m_planes[p].x));
+        absY[p] = vdupq_n_f32(std::fabs(m_planes[p].y));
+        absZ[p] = vdupq_n_f32(std::fabs(m_planes[p].z));
+    }
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+
+    for (; i + 4 <= end; i += 4) {
+        float32x4_t cx = vld1q_f32(&m_centerX[i]);
+        float32x4_t cy = vld1q_f32(&m_centerY[i]);
+        float32x4_t cz = vld1q_f32(&m_centerZ[i]);
+        float32x4_t ex = vld1q_f32(&m_extentX[i]);
+        float32x4_t ey = vld1q_f32(&m_extentY[i]);
+        float32x4_t ez = vld1q_f32(&m_extentZ[i]);
+
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+        for (int p = 0; p < 6; p++) {
+            float32x4_t distance = vmlaq_f32(vmlaq_f32(vmlaq_f32(planeW[p], cx, planeX[p]), cy, planeY[p]), cz, planeZ[p]);
+            float32x4_t radius = vmlaq_f32(vmlaq_f32(vmulq_f32(ex, absX[p]), ey, absY[p]), ez, absZ[p]);
+            inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(distance, radius), zero));
+        }
+
+        m_visible[i + 0] = vgetq_lane_u32(inside, 0) != 0;
+        m_visible[i + 1] = vgetq_lane_u32(inside, 1) != 0;
+        m_visible[i + 2] = vgetq_lane_u32(inside, 2) != 0;
+        m_visible[i + 3] = vgetq_lane_u32(inside, 3) != 0;
+    }
+#endif
+
+    // Scalar kernel, and the tail of the SIMD ones
+    for (; i < end; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            const glm::vec4& plane = m_planes[p];
+            float distance = plane.x * m_centerX[i] + plane.y * m_centerY[i] + plane.z * m_centerZ[i] + plane.w;
+            float radius = std::fabs(plane.x) * m_extentX[i] + std::fabs(plane.y) * m_extentY[i] + std::fabs(plane.z) * m_extentZ[i];
+            inside = distance + radius >= 0.0f;
+        }
+        m_visible[i] = inside;
+    }
+}
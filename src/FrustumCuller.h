@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class Mesh;
+
+struct CullingStats {
+	uint32_t visible = 0;
+	uint32_t culled = 0;
+};
+
+// Frustum culling of mesh bounding boxes on the CPU. The world space boxes are
+// kept as structure of arrays and tested against the six planes with SIMD
+// kernels (AVX, SSE or NEON, whatever the build targets), in parallel chunks
+// when there are many meshes.
+class FrustumCuller
+{
+public:
+	// viewproj: projection * view, with depth from 0 to 1
+	void Begin(const glm::mat4& viewproj);
+	// The matrices are not copied, they must live until Draw
+	void Add(Mesh* mesh, const glm::mat4* matrix, const glm::mat3x4* normalMatrix);
+	// Culls the meshes added since Begin and draws the visible ones
+	void Draw();
+
+	const CullingStats& GetStats() const { return m_stats; }    // Last Draw
+	static const char* GetKernelName();
+
+private:
+	struct Item {
+		Mesh* mesh;
+		const glm::mat4* matrix;
+		const glm::mat3x4* normalMatrix;
+	};
+
+	glm::vec4 m_planes[6];
+	std::vector<Item> m_items;
+	// World space boxes: center and half extents
+	std::vector<float> m_centerX, m_centerY, m_centerZ;
+	std::vector<float> m_extentX, m_extentY, m_extentZ;
+	std::vector<uint8_t> m_visible;
+	CullingStats m_stats;
+
+	void CullRange(uint32_t first, uint32_t end);
+	void TestRange(uint32_t first, uint32_t end);
+};
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "Device.h"
+#include "GeometryArena.h"
+#include "UploadBatch.h"
+
+GeometryArena::GeometryArena(Device& device, VkDeviceSize vertexPageSize, VkDeviceSize indexPageSize) :
+    m_device(device),
+    m_vertexPageSize(vertexPageSize),
+    m_indexPageSize(indexPageSize)
+{
+
+}
+
+GeometryArena::~GeometryArena() {
+    for (Page& page : m_pages)
+        DestroyPageBuffers(page);
+}
+
+void GeometryArena::CreatePageBuffers(Page& page, VkDeviceSize vertexSize, VkDeviceSize indexSize) {
+    m_device.CreateBuffer(vertexSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, page.vertexBuffer, page.vertexMemory);
+    m_device.CreateBuffer(indexSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, page.indexBuffer, page.indexMemory);
+}
+
+void GeometryArena::DestroyPageBuffers(Page& page) {
+    if (page.vertexBuffer == VK_NULL_HANDLE)
+        return;
+    m_device.DestroyBuffer(page.vertexBuffer);
+    m_device.FreeMemory(page.vertexMemory);
+    m_device.DestroyBuffer(page.indexBuffer);
+    m_device.FreeMemory(page.indexMemory);
+    page.vertexBuffer = VK_NULL_HANDLE;
+    page.indexBuffer = VK_NULL_HANDLE;
+}
+
+uint32_t GeometryArena::CreatePage(VkDeviceSize vertexSize, VkDeviceSize indexSize) {
+    // Meshes bigger than a page get a page of their own
+    vertexSize = std::max(vertexSize, m_vertexPageSize);
+    indexSize = std::max(indexSize, m_indexPageSize);
+
+    Page page;
+    CreatePageBuffers(page, vertexSize, indexSize);
+    page.vertexFreeList.Reset(vertexSize);
+    page.indexFreeList.Reset(indexSize);
+
+    spdlog::debug("GeometryArena: new page ({} MB vertices, {} MB indices)", vertexSize / (1024 * 1024), indexSize / (1024 * 1024));
+
+    for (size_t i = 0; i < m_pages.size(); i++) {
+        if (m_pages[i].vertexBuffer == VK_NULL_HANDLE) {
+            m_pages[i] = std::move(page);
+            return (uint32_t)i;
+        }
+    }
+    m_pages.push_back(std::move(page));
+    return (uint32_t)m_pages.size() - 1;
+}
+
+uint32_t GeometryArena::Allocate(uint32_t vertexCount, uint32_t vertexStride, uint32_t indexCount, uint32_t indexStride, uint32_t positionStride) {
+    Slot slot;
+    slot.vertexSize = (VkDeviceSize)vertexCount * vertexStride;
+    slot.vertexStride = vertexStride;
+    slot.positionSize = (VkDeviceSize)vertexCount * positionStride;
+    slot.positionStride = positionStride;
+    slot.indexSize = (VkDeviceSize)indexCount * indexStride;
+    slot.indexStride = indexStride;
+    slot.used = true;
+
+    // vertexOffset/firstIndex are expressed in elements, so the byte offsets must be multiples of the strides
+    auto tryPage = [&](uint32_t pageIndex) {
+        Page& page = m_pages[pageIndex];
+        if (page.vertexBuffer == VK_NULL_HANDLE)
+            return false;
+        if (!page.vertexFreeList.Allocate(slot.vertexSize, vertexStride, slot.vertexOffset))
+            return false;
+        if (positionStride > 0 && !page.vertexFreeList.Allocate(slot.positionSize, positionStride, slot.positionOffset)) {
+            page.vertexFreeList.Free(slot.vertexOffset, slot.vertexSize);
+            return false;
+        }
+        if (!page.indexFreeList.Allocate(slot.indexSize, sizeof(uint32_t), slot.indexOffset)) {
+            page.vertexFreeList.Free(slot.vertexOffset, slot.vertexSize);
+            if (positionStride > 0)
+                page.vertexFreeList.Free(slot.positionOffset, slot.positionSize);
+            return false;
+        }
+        slot.page = pageIndex;
+        page.allocations++;
+        return true;
+    };
+
+    bool allocated = false;
+    for (uint32_t i = 0; i < m_pages.size() && !allocated; i++)
+        allocated = tryPage(i);
+
+    if (!allocated) {
+        // The positions may need up to a stride of padding after the vertices
+        uint32_t pageIndex = CreatePage(slot.vertexSize + slot.positionSize + positionStride, slot.indexSize);
+        if (!tryPage(pageIndex)) {
+            throw std::runtime_error("failed to allocate geometry!");
+        }
+    }
+
+    uint32_t handle;
+    if (!m_freeSlots.empty()) {
+        handle = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        m_slots[handle] = slot;
+    }
+    else {
+        handle = (uint32_t)m_slots.size();
+        m_slots.push_back(slot);
+    }
+    return handle;
+}
+
+void GeometryArena::Free(uint32_t handle) {
+    Slot& slot = m_slots[handle];
+    if (!slot.used)
+        return;
+
+    Page& page = m_pages[slot.page];
+    page.vertexFreeList.Free(slot.vertexOffset, slot.vertexSize);
+    if (slot.positionStride > 0)
+        page.vertexFreeList.Free(slot.positionOffset, slot.positionSize);
+    page.indexFreeList.Free(slot.indexOffset, slot.indexSize);
+    page.allocations--;
+
+    slot = Slot();
+    m_freeSlots.push_back(handle);
+}
+
+void GeometryArena::UploadVertices(uint32_t handle, const void* vertices, UploadBatch* batch) {
+    const Slot& slot = m_slots[handle];
+    if (batch)
+        batch->UploadBuffer(m_pages[slot.page].vertexBuffer, slot.vertexOffset, vertices, slot.vertexSize);
+    else
+        m_device.UploadBuffer(m_pages[slot.page].vertexBuffer, slot.vertexOffset, vertices, slot.vertexSize);
+}
+
+void GeometryArena::UploadIndices(uint32_t handle, const void* indices, UploadBatch* batch) {
+    const Slot& slot = m_slots[handle];
+    if (batch)
+        batch->UploadBuffer(m_pages[slot.page].indexBuffer, slot.indexOffset, indices, slot.indexSize);
+    else
+        m_device.UploadBuffer(m_pages[slot.page].indexBuffer, slot.indexOffset, indices, slot.indexSize);
+}
+
+void GeometryArena::UploadPositions(uint32_t handle, const void* positions, UploadBatch* batch) {
+    const Slot& slot = m_slots[handle];
+    if (batch)
+        batch->UploadBuffer(m_pages[slot.page].vertexBuffer, slot.positionOffset, positions, slot.positionSize);
+    else
+        m_device.UploadBuffer(m_pages[slot.page].vertexBuffer, slot.positionOffset, positions, slot.positionSize);
+}
+
+GeometryRange GeometryArena::GetRange(uint32_t handle) const {
+    const Slot& slot = m_slots[handle];
+    GeometryRange range;
+    range.page = slot.page;
+    range.vertexOffset = (int32_t)(slot.vertexOffset / slot.vertexStride);
+    range.positionOffset = slot.positionStride > 0 ? (int32_t)(slot.positionOffset / slot.positionStride) : 0;
+    range.firstIndex = (uint32_t)(slot.indexOffset / slot.indexStride);
+    range.indexCount = (uint32_t)(slot.indexSize / slot.indexStride);
+    range.indexType = slot.indexStride == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    return range;
+}
+
+void GeometryArena::Compact() {
+    // Keep the first live page even when empty, the next model will most likely fill it again
+    bool keptEmpty = false;
+    for (uint32_t i = 0; i < m_pages.size(); i++) {
+        Page& page = m_pages[i];
+        if (page.vertexBuffer == VK_NULL_HANDLE)
+            continue;
+
+        if (page.allocations == 0) {
+            if (keptEmpty)
+                DestroyPageBuffers(page);
+            keptEmpty = true;
+        }
+        else if (page.vertexFreeList.IsFragmented() || page.indexFreeList.IsFragmented()) {
+            CompactPage(i);
+        }
+    }
+}
+
+void GeometryArena::CompactPage(uint32_t pageIndex) {
+    Page& page = m_pages[pageIndex];
+
+    // vkCmdCopyBuffer does not allow overlapping regions, so copy into fresh buffers
+    Page packed;
+    CreatePageBuffers(packed, page.vertexFreeList.GetSize(), page.indexFreeList.GetSize());
+    packed.vertexFreeList.Reset(page.vertexFreeList.GetSize());
+    packed.indexFreeList.Reset(page.indexFreeList.GetSize());
+    packed.allocations = page.allocations;
+
+    // Re-allocating in offset order packs everything at the front
+    std::vector<uint32_t> handles;
+    for (uint32_t i = 0; i < m_slots.size(); i++) {
+        if (m_slots[i].used && m_slots[i].page == pageIndex)
+            handles.push_back(i);
+    }
+    std::sort(handles.begin(), handles.end(), [this](uint32_t a, uint32_t b) { return m_slots[a].vertexOffset < m_slots[b].vertexOffset; });
+
+    // Vertices and positions share the vertex buffer, their ranges are interleaved
+    struct VertexRange {
+        VkDeviceSize* offset;
+        VkDeviceSize size;
+        uint32_t stride;
+    };
+    std::vector<VertexRange> vertexRanges;
+
+    std::vector<VkBufferCopy> vertexRegions;
+    std::vector<VkBufferCopy> indexRegions;
+    for (uint32_t handle : handles) {
+        Slot& slot = m_slots[handle];
+        vertexRanges.push_back({ &slot.vertexOffset, slot.vertexSize, slot.vertexStride });
+        if (slot.positionStride > 0)
+            vertexRanges.push_back({ &slot.positionOffset, slot.positionSize, slot.positionStride });
+
+        VkDeviceSize indexOffset;
+        packed.indexFreeList.Allocate(slot.indexSize, sizeof(uint32_t), indexOffset);
+        if (slot.indexSize > 0)
+            indexRegions.push_back({ slot.indexOffset, indexOffset, slot.indexSize });
+        slot.indexOffset = indexOffset;
+    }
+
+    std::sort(vertexRanges.begin(), vertexRanges.end(), [](const VertexRange& a, const VertexRange& b) { return *a.offset < *b.offset; });
+    for (const VertexRange& range : vertexRanges) {
+        VkDeviceSize offset;
+        packed.vertexFreeList.Allocate(range.size, range.stride, offset);
+        if (range.size > 0)
+            vertexRegions.push_back({ *range.offset, offset, range.size });
+        *range.offset = offset;
+    }
+
+    VkCommandBuffer commandBuffer = m_device.BeginSingleTimeCommands();
+    if (!vertexRegions.empty())
+        vkCmdCopyBuffer(commandBuffer, page.vertexBuffer, packed.vertexBuffer, (uint32_t)vertexRegions.size(), vertexRegions.data());
+    if (!indexRegions.empty())
+        vkCmdCopyBuffer(commandBuffer, page.indexBuffer, packed.indexBuffer, (uint32_t)indexRegions.size(), indexRegions.data());
+    m_device.EndSingleTimeCommands(commandBuffer);
+
+    DestroyPageBuffers(page);
+    page = std::move(packed);
+
+    spdlog::debug("GeometryArena: compacted page {} ({} meshes)", pageIndex, handles.size());
+}
+
+GeometryStats GeometryArena::GetStats() const {
+    GeometryStats stats;
+    for (const Page& page : m_pages) {
+        if (page.vertexBuffer == VK_NULL_HANDLE)
+            continue;
+        stats.pageCount++;
+        stats.allocationCount += page.allocations;
+        stats.reservedBytes += page.vertexFreeList.GetSize() + page.indexFreeList.GetSize();
+        stats.usedBytes += page.vertexFreeList.GetUsed() + page.indexFreeList.GetUsed();
+    }
+    return stats;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "FreeList.h"
+#include "MemoryAllocator.h"
+
+class Device;
+class UploadBatch;
+
+// Everything a draw needs to locate a mesh inside the arena
+struct GeometryRange {
+	uint32_t page;
+	int32_t vertexOffset;
+	int32_t positionOffset;     // vertexOffset of the position stream, in the same vertex buffer. Only with a positionStride
+	uint32_t firstIndex;        // In elements of indexType
+	uint32_t indexCount;
+	VkIndexType indexType;      // From the index stride of the allocation
+};
+
+struct GeometryStats {
+	uint32_t pageCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize reservedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+};
+
+// Packs the vertices and indices of all meshes into a few large device local
+// buffers (pages). Meshes keep a handle; offsets can change after Compact().
+class GeometryArena
+{
+public:
+	GeometryArena(Device& device, VkDeviceSize vertexPageSize, VkDeviceSize indexPageSize);
+	~GeometryArena();
+
+	// indexStride: sizeof(uint16_t) or sizeof(uint32_t), both kinds share the index pages.
+	// positionStride: also reserves a position-only copy of the vertices, drawn with the same indices
+	uint32_t Allocate(uint32_t vertexCount, uint32_t vertexStride, uint32_t indexCount, uint32_t indexStride = sizeof(uint32_t), uint32_t positionStride = 0);
+	void Free(uint32_t handle);
+
+	// Without a batch the upload is submitted on its own
+	void UploadVertices(uint32_t handle, const void* vertices, UploadBatch* batch = nullptr);
+	void UploadIndices(uint32_t handle, const void* indices, UploadBatch* batch = nullptr);
+	void UploadPositions(uint32_t handle, const void* positions, UploadBatch* batch = nullptr);
+
+	// Moves live ranges to the front of their pages and releases empty pages.
+	// The caller must make sure the GPU is not using the arena.
+	void Compact();
+
+	GeometryRange GetRange(uint32_t handle) const;
+	VkBuffer GetVertexBuffer(uint32_t page) const { return m_pages[page].vertexBuffer; }
+	VkBuffer GetIndexBuffer(uint32_t page) const { return m_pages[page].indexBuffer; }
+	GeometryStats GetStats() const;
+
+private:
+	struct Page {
+		VkBuffer vertexBuffer = VK_NULL_HANDLE;
+		MemoryAllocation vertexMemory;
+		VkBuffer indexBuffer = VK_NULL_HANDLE;
+		MemoryAllocation indexMemory;
+		FreeList vertexFreeList;
+		FreeList indexFreeList;
+		uint32_t allocations = 0;
+	};
+
+	struct Slot {
+		uint32_t page = 0;
+		VkDeviceSize vertexOffset = 0;
+		VkDeviceSize vertexSize = 0;
+		uint32_t vertexStride = 0;
+		VkDeviceSize positionOffset = 0;    // In the vertex buffer too
+		VkDeviceSize positionSize = 0;
+		uint32_t positionStride = 0;
+		VkDeviceSize indexOffset = 0;
+		VkDeviceSize indexSize = 0;
+		uint32_t indexStride = 0;
+		bool used = false;
+	};
+
+	Device& m_device;
+	VkDeviceSize m_vertexPageSize;
+	VkDeviceSize m_indexPageSize;
+	std::vector<Page> m_pages;         // Released pages have vertexBuffer == VK_NULL_HANDLE
+	std::vector<Slot> m_slots;
+	std::vector<uint32_t> m_freeSlots;
+
+	uint32_t CreatePage(VkDeviceSize vertexSize, VkDeviceSize indexSize);
+	void CreatePageBuffers(Page& page, VkDeviceSize vertexSize, VkDeviceSize indexSize);
+	void DestroyPageBuffers(Page& page);
+	void CompactPage(uint32_t pageIndex);
+};
@@ -0,0 +1,62 @@
+#include <algorithm>
+
+#include "Device.h"
+#include "IndirectBuffer.h"
+
+IndirectBuffer::IndirectBuffer(Device& device, uint32_t frameCount, uint32_t capacity) :
+    m_device(device)
+{
+    m_frames.resize(frameCount);
+    for (Frame& frame : m_frames) {
+        Reserve(frame.commands, sizeof(VkDrawIndexedIndirectCommand) * std::max(capacity, 1u));
+        Reserve(frame.counts, sizeof(uint32_t) * std::max(capacity, 1u));
+    }
+}
+
+IndirectBuffer::~IndirectBuffer() {
+    for (Frame& frame : m_frames) {
+        Destroy(frame.commands);
+        Destroy(frame.counts);
+    }
+}
+
+void IndirectBuffer::Reserve(Buffer& buffer, VkDeviceSize size) {
+    if (size <= buffer.size)
+        return;
+
+    VkDeviceSize newSize = std::max(buffer.size, (VkDeviceSize)64);
+    while (newSize < size)
+        newSize *= 2;
+
+    // The frame's previous submission has finished, its buffers can be replaced
+    Destroy(buffer);
+    m_device.CreateBuffer(newSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, buffer.buffer, buffer.memory);
+    buffer.size = newSize;
+}
+
+void IndirectBuffer::Destroy(Buffer& buffer) {
+    if (buffer.buffer == VK_NULL_HANDLE)
+        return;
+    m_device.DestroyBuffer(buffer.buffer);
+    m_device.FreeMemory(buffer.memory);
+    buffer = Buffer();
+}
+
+VkDrawIndexedIndirectCommand* IndirectBuffer::MapCommands(uint32_t frame, uint32_t count) {
+    Buffer& buffer = m_frames[frame].commands;
+    Reserve(buffer, sizeof(VkDrawIndexedIndirectCommand) * count);
+    return (VkDrawIndexedIndirectCommand*)buffer.memory.mapped;
+}
+
+uint32_t* IndirectBuffer::MapCounts(uint32_t frame, uint32_t count) {
+    Buffer& buffer = m_frames[frame].counts;
+    Reserve(buffer, sizeof(uint32_t) * count);
+    return (uint32_t*)buffer.memory.mapped;
+}
+
+void IndirectBuffer::Flush(uint32_t frame, uint32_t commandCount, uint32_t countCount) {
+    if (commandCount > 0)
+        m_device.FlushMemory(m_frames[frame].commands.memory, 0, sizeof(VkDrawIndexedIndirectCommand) * commandCount);
+    if (countCount > 0)
+        m_device.FlushMemory(m_frames[frame].counts.memory, 0, sizeof(uint32_t) * countCount);
+}
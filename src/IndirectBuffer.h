@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "MemoryAllocator.h"
+
+class Device;
+
+// Per frame buffers with VkDrawIndexedIndirectCommand records and
+// the draw counts used by vkCmdDrawIndexedIndirectCount, written by the host or
+// by the CullingPass.
+class IndirectBuffer
+{
+public:
+	IndirectBuffer(Device& device, uint32_t frameCount, uint32_t capacity);
+	~IndirectBuffer();
+
+	IndirectBuffer(const IndirectBuffer&) = delete;
+	IndirectBuffer& operator=(const IndirectBuffer&) = delete;
+
+	// Write only pointers. Growing replaces the frame's buffers, so both must be
+	// mapped before any command of the frame references them.
+	VkDrawIndexedIndirectCommand* MapCommands(uint32_t frame, uint32_t count);
+	uint32_t* MapCounts(uint32_t frame, uint32_t count);
+	void Flush(uint32_t frame, uint32_t commandCount, uint32_t countCount);
+
+	VkBuffer GetCommandBuffer(uint32_t frame) const { return m_frames[frame].commands.buffer; }
+	VkBuffer GetCountBuffer(uint32_t frame) const { return m_frames[frame].counts.buffer; }
+
+private:
+	struct Buffer {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkDeviceSize size = 0;
+	};
+
+	struct Frame {
+		Buffer commands;
+		Buffer counts;
+	};
+
+	Device& m_device;
+	std::vector<Frame> m_frames;
+
+	void Reserve(Buffer& buffer, VkDeviceSize size);
+	void Destroy(Buffer& buffer);
+};
@@ -0,0 +1,57 @@
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include "Device.h"
+#include "InstanceBuffer.h"
+
+InstanceBuffer::InstanceBuffer(Device& device, const std::vector<VkDescriptorSet>& sets, uint32_t binding, uint32_t capacity) :
+    m_device(device),
+    m_sets(sets),
+    m_binding(binding)
+{
+    m_frames.resize(sets.size());
+    for (uint32_t i = 0; i < m_frames.size(); i++)
+        CreateBuffer(i, std::max(capacity, 1u));
+}
+
+InstanceBuffer::~InstanceBuffer() {
+    for (uint32_t i = 0; i < m_frames.size(); i++)
+        DestroyBuffer(i);
+}
+
+void InstanceBuffer::CreateBuffer(uint32_t frame, uint32_t capacity) {
+    Frame& f = m_frames[frame];
+    f.capacity = capacity;
+    // Not necessarily coherent, Flush() takes care of it
+    m_device.CreateBuffer(sizeof(InstanceData) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, f.buffer, f.memory);
+
+    std::vector<VkDescriptorSet> set = { m_sets[frame] };
+    m_device.UpdateStorageDescriptorSets(set, m_binding, f.buffer, 0, sizeof(InstanceData) * capacity);
+}
+
+void InstanceBuffer::DestroyBuffer(uint32_t frame) {
+    Frame& f = m_frames[frame];
+    if (f.buffer == VK_NULL_HANDLE)
+        return;
+    m_device.DestroyBuffer(f.buffer);
+    m_device.FreeMemory(f.memory);
+    f = Frame();
+}
+
+InstanceData* InstanceBuffer::Map(uint32_t frame, uint32_t count) {
+    // The frame's previous submission has finished, its buffer can be replaced
+    if (count > m_frames[frame].capacity) {
+        uint32_t capacity = m_frames[frame].capacity;
+        while (capacity < count)
+            capacity *= 2;
+        DestroyBuffer(frame);
+        CreateBuffer(frame, capacity);
+        spdlog::debug("InstanceBuffer: frame {} grown to {} instances", frame, capacity);
+    }
+    return (InstanceData*)m_frames[frame].memory.mapped;
+}
+
+void InstanceBuffer::Flush(uint32_t frame, uint32_t first, uint32_t count) {
+    m_device.FlushMemory(m_frames[frame].memory, sizeof(InstanceData) * first, sizeof(InstanceData) * count);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MemoryAllocator.h"
+
+class Device;
+
+// Same layout as the std430 InstanceData struct of the shaders
+struct InstanceData {
+	glm::mat4 model;
+	glm::mat3x4 normal;     // normalMatrix (3x3). Para evitar problemas de alineacion se usa una de 3x4
+	uint32_t materialIndex; // Entry of the MaterialTable
+	uint32_t pad[3];
+};
+
+// Per frame storage buffers with the instance data of every draw, read with
+// gl_InstanceIndex (firstInstance selects the range of a draw).
+class InstanceBuffer
+{
+public:
+	// The buffer of each frame is written to binding 'binding' of its set
+	InstanceBuffer(Device& device, const std::vector<VkDescriptorSet>& sets, uint32_t binding, uint32_t capacity);
+	~InstanceBuffer();
+
+	InstanceBuffer(const InstanceBuffer&) = delete;
+	InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+	// Write only pointer to the first 'count' instances. Grows the buffer if
+	// needed, which rewrites the descriptor, so it must be called before the
+	// frame's set is bound.
+	InstanceData* Map(uint32_t frame, uint32_t count);
+	void Flush(uint32_t frame, uint32_t first, uint32_t count);
+
+	uint32_t GetCapacity(uint32_t frame) const { return m_frames[frame].capacity; }
+
+private:
+	struct Frame {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		uint32_t capacity = 0;
+	};
+
+	Device& m_device;
+	std::vector<VkDescriptorSet> m_sets;
+	uint32_t m_binding;
+	std::vector<Frame> m_frames;
+
+	void CreateBuffer(uint32_t frame, uint32_t capacity);
+	void DestroyBuffer(uint32_t frame);
+};
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "JobSystem.h"
+
+struct Task {
+    Job job;
+    JobCounter* counter = nullptr;
+};
+
+struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::atomic<uint64_t> executed{ 0 };
+    std::atomic<uint64_t> steals{ 0 };
+};
+
+static std::vector<std::unique_ptr<Worker>> g_workers;
+static std::vector<std::thread> g_threads;
+static std::mutex g_mainThreadMutex;
+static std::deque<Task> g_mainThreadTasks;
+static std::mutex g_sleepMutex;
+static std::condition_variable g_wake;
+static std::atomic<uint32_t> g_queued{ 0 };     // Tasks in the worker deques
+static std::atomic<bool> g_running{ false };
+static thread_local uint32_t t_threadIndex = 0;
+
+static void Push(Task task) {
+    Worker& worker = *g_workers[t_threadIndex];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        // Counted while no thief can pop it yet, a pop decrements it
+        g_queued++;
+        worker.tasks.push_back(std::move(task));
+    }
+
+    // Taking the lock makes sure a thread going to sleep sees the new task
+    { std::lock_guard<std::mutex> lock(g_sleepMutex); }
+    g_wake.notify_one();
+}
+
+// Own deque from the back (last pushed, still in cache), others from the front
+static bool TryGetTask(Task& task) {
+    uint32_t index = t_threadIndex;
+    Worker& own = *g_workers[index];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            g_queued--;
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < g_workers.size(); i++) {
+        Worker& victim = *g_workers[(index + i) % g_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            g_queued--;
+            own.steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::Execute(Job& job, JobCounter* counter) {
+    job();
+    if (!g_workers.empty())
+        g_workers[t_threadIndex]->executed++;
+    if (counter)
+        Finish(counter);
+}
+
+void JobSystem::Finish(JobCounter* counter) {
+    std::vector<std::pair<Job, JobCounter*>> continuations;
+    {
+        // Under the lock, so Wait() can not return while the counter is in use
+        std::lock_guard<std::mutex> lock(counter->m_mutex);
+        if (counter->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            continuations.swap(counter->m_continuations);
+    }
+    for (auto& continuation : continuations)
+        Push({ std::move(continuation.first), continuation.second });
+}
+
+void JobSystem::WorkerLoop(uint32_t index) {
+    t_threadIndex = index;
+    while (g_running) {
+        Task task;
+        if (TryGetTask(task)) {
+            Execute(task.job, task.counter);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(g_sleepMutex);
+        g_wake.wait(lock, [] { return g_queued > 0 || !g_running; });
+    }
+}
+
+void JobSystem::Init(uint32_t threadCount) {
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (uint32_t i = 0; i < threadCount; i++)
+        g_workers.push_back(std::make_unique<Worker>());
+
+    g_running = true;
+    t_threadIndex = 0;
+    for (uint32_t i = 1; i < threadCount; i++)
+        g_threads.emplace_back(WorkerLoop, i);
+
+    spdlog::info("JobSystem: {} threads", threadCount);
+}
+
+void JobSystem::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(g_sleepMutex);
+        g_running = false;
+    }
+    g_wake.notify_all();
+    for (std::thread& thread : g_threads)
+        thread.join();
+    g_threads.clear();
+    g_workers.clear();
+}
+
+void JobSystem::Run(Job job, JobCounter* counter, JobCounter* dependency) {
+    if (counter)
+        counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (g_workers.empty()) {
+        Execute(job, counter);
+        return;
+    }
+
+    if (dependency) {
+        std::lock_guard<std::mutex> lock(dependency->m_mutex);
+        if (!dependency->IsDone()) {
+            dependency->m_continuations.push_back({ std::move(job), counter });
+            return;
+        }
+    }
+    Push({ std::move(job), counter });
+}
+
+void JobSystem::RunOnMainThread(Job job, JobCounter* counter) {
+    if (counter)
+        counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(g_mainThreadMutex);
+    g_mainThreadTasks.push_back({ std::move(job), counter });
+}
+
+void JobSystem::RunMainThreadJobs() {
+    // Only the ones queued so far, jobs can queue more for the next call
+    std::deque<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(g_mainThreadMutex);
+        tasks.swap(g_mainThreadTasks);
+    }
+    for (Task& task : tasks)
+        Execute(task.job, task.counter);
+}
+
+void JobSystem::Wait(JobCounter& counter) {
+    while (!counter.IsDone()) {
+        Task task;
+        if (!g_workers.empty() && TryGetTask(task))
+            Execute(task.job, task.counter);
+        else if (t_threadIndex == 0)
+            RunMainThreadJobs();
+        else
+            std::this_thread::yield();
+    }
+    // Finish() may still hold the lock
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t chunkSize, const std::function<void(uint32_t, uint32_t)>& fn) {
+    chunkSize = std::max(chunkSize, 1u);
+    uint32_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    if (chunkCount <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    for (uint32_t chunk = 1; chunk < chunkCount; chunk++) {
+        uint32_t first = chunk * chunkSize;
+        uint32_t end = std::min(count, first + chunkSize);
+        Run([&fn, first, end]() { fn(first, end); }, &counter);
+    }
+    fn(0, chunkSize);
+    Wait(counter);
+}
+
+uint32_t JobSystem::GetThreadCount() {
+    return std::max((uint32_t)g_workers.size(), 1u);
+}
+
+uint32_t JobSystem::GetThreadIndex() {
+    return t_threadIndex;
+}
+
+JobStats JobSystem::GetStats() {
+    JobStats stats;
+    for (const std::unique_ptr<Worker>& worker : g_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            stats.queueDepth.push_back((uint32_t)worker->tasks.size());
+        }
+        stats.executed += worker->executed;
+        stats.steals += worker->steals;
+    }
+    std::lock_guard<std::mutex> lock(g_mainThreadMutex);
+    stats.mainThreadQueueDepth = (uint32_t)g_mainThreadTasks.size();
+    return stats;
+}
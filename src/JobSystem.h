@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+typedef std::function<void()> Job;
+
+// Jobs of a group that have not finished yet. It can be waited on, or used as
+// the dependency of other jobs, which are queued when it reaches zero.
+class JobCounter
+{
+public:
+	JobCounter() = default;
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	bool IsDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+
+	std::atomic<uint32_t> m_pending{ 0 };
+	std::mutex m_mutex;
+	std::vector<std::pair<Job, JobCounter*>> m_continuations;
+};
+
+struct JobStats {
+	std::vector<uint32_t> queueDepth;   // Per thread, 0 is the main thread
+	uint64_t executed = 0;
+	uint64_t steals = 0;
+	uint32_t mainThreadQueueDepth = 0;
+};
+
+// Work-stealing scheduler. Every thread (the main thread is thread 0) pushes and
+// pops the jobs it creates at the back of its own deque, idle threads steal from
+// the front of the others. Jobs are not pinned to a thread, except the ones queued
+// with RunOnMainThread.
+class JobSystem
+{
+public:
+	// threadCount: including the main thread, 0 for one per hardware thread
+	static void Init(uint32_t threadCount = 0);
+	static void Shutdown();
+
+	// counter: incremented now, decremented once the job has run.
+	// dependency: the job is not queued before the dependency is done.
+	// Runs the job right away if the system is not initialized.
+	static void Run(Job job, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+	// For work that must stay on the main thread (Vulkan queue submits, window)
+	static void RunOnMainThread(Job job, JobCounter* counter = nullptr);
+	// Called by the main thread once per frame, and while it waits
+	static void RunMainThreadJobs();
+	// Runs queued jobs until the counter is done
+	static void Wait(JobCounter& counter);
+	// fn(first, end) over [0, count) in chunks of chunkSize, returns when all have run
+	static void ParallelFor(uint32_t count, uint32_t chunkSize, const std::function<void(uint32_t, uint32_t)>& fn);
+
+	static uint32_t GetThreadCount();
+	// Index of the calling thread, stable for its lifetime: per thread resources can use it
+	static uint32_t GetThreadIndex();
+	static JobStats GetStats();
+
+private:
+	static void WorkerLoop(uint32_t index);
+	static void Execute(Job& job, JobCounter* counter);
+	static void Finish(JobCounter* counter);
+};
@@ -10,6 +10,7 @@
 #include "Device.h"
 #include "Texture.h"
 #include "Material.h"
+#include "MaterialTable.h"
 
 #include "Vulkan.h"
 
@@ -21,13 +22,12 @@ Material::Material() :
 	m_emissiveColor(glm::vec3(0.0f)),
 	m_shininess(32.0f),
 	m_diffuseTex(nullptr),
-	m_specularTex(nullptr),
-	m_materialDescSet(VK_NULL_HANDLE)
+	m_specularTex(nullptr)
 {
 	Init();
 }
 
-Material::Material(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture *>& textures) :
+Material::Material(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture *>& textures, UploadBatch* batch) :
 	m_name("No name"),
 	m_diffuseColor(glm::vec3(1.0f)),
 	m_specularColor(glm::vec3(0.0f)),
@@ -35,40 +35,32 @@ Material::Material(const aiScene* scene, const aiMaterial* assimpMat, const std:
 	m_emissiveColor(glm::vec3(0.0f)),
 	m_shininess(32.0f),
 	m_diffuseTex(nullptr),
-	m_specularTex(nullptr),
-	m_materialDescSet(VK_NULL_HANDLE)
+	m_specularTex(nullptr)
 {
 	Init();
 
-	LoadFromAssimp(scene, assimpMat, directory, textures);
+	LoadFromAssimp(scene, assimpMat, directory, textures, batch);
 }
 
 Material::~Material() {
-	Device* device = Vulkan::GetDevice();
-	device->DestroyBuffer(m_materialBuffer);
-	device->FreeMemory(m_materialMemory);
+	Vulkan::GetDescriptorAllocator()->Free(m_materialDesc);
+	Vulkan::GetMaterialTable()->Free(m_index);
 }
 
 void Material::Init() {
-	VkDescriptorPool pool = Vulkan::GetDescriptorPool();
 	VkDescriptorSetLayout layout = Vulkan::GetMaterialLayout();
 
-	Device* device = Vulkan::GetDevice();
-
-	device->CreateBuffer(
-		sizeof(MaterialUBO),
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		m_materialBuffer,
-		m_materialMemory);
-
-	m_materialDescSet = device->AllocateDescriptorSet(pool, layout);
-	device->UpdateUniformDescriptorSet(m_materialDescSet, 0, m_materialBuffer, sizeof(MaterialUBO));
+	m_index = Vulkan::GetMaterialTable()->Allocate();
+	// Bindless materials only need their texture indices
+	if (!Vulkan::GetTextureTable())
+		m_materialDesc = Vulkan::GetDescriptorAllocator()->Allocate(layout);
 
 	SetDiffuseTexture(Vulkan::GetDummyTexture());
 	SetSpecularTexture(Vulkan::GetDummyTexture());
+	UpdateUniform();
 }
 
-void Material::LoadFromAssimp(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture*>& textures) {
+void Material::LoadFromAssimp(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture*>& textures, UploadBatch* batch) {
 	aiReturn r = aiReturn_FAILURE;
 
 	aiString name;
@@ -93,8 +85,8 @@ void Material::LoadFromAssimp(const aiScene* scene, const aiMaterial* assimpMat,
 	r = assimpMat->Get(AI_MATKEY_COLOR_EMISSIVE, vec3);
 	SetEmissiveColor(r == aiReturn_SUCCESS ? ToGlm(vec3) : glm::vec3(0));
 	
-	Texture* diffuseTex  = GetTexture(scene, assimpMat, directory, aiTextureType_DIFFUSE, 0);
-	Texture* specularTex = GetTexture(scene, assimpMat, directory, aiTextureType_SPECULAR, 0);
+	Texture* diffuseTex  = GetTexture(scene, assimpMat, directory, aiTextureType_DIFFUSE, 0, batch);
+	Texture* specularTex = GetTexture(scene, assimpMat, directory, aiTextureType_SPECULAR, 0, batch);
 	if (diffuseTex) {
 		SetDiffuseTexture(diffuseTex);
 		textures.push_back(diffuseTex);
@@ -107,7 +99,7 @@ void Material::LoadFromAssimp(const aiScene* scene, const aiMaterial* assimpMat,
 	UpdateUniform();
 }
 
-Texture* Material::GetTexture(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, aiTextureType type, unsigned int index) const {
+Texture* Material::GetTexture(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, aiTextureType type, unsigned int index, UploadBatch* batch) const {
 	aiString texPath;
 	aiReturn r = assimpMat->GetTexture(type, index, &texPath);
 	if (r == aiReturn_FAILURE)
@@ -116,7 +108,7 @@ Texture* Material::GetTexture(const aiScene* scene, const aiMaterial* assimpMat,
 	const aiTexture* embeddedTexture = scene->GetEmbeddedTexture(texPath.C_Str());
 	if (embeddedTexture != nullptr) {
 		if (embeddedTexture->mHeight == 0) { // embedded file
-			Texture* tex = new Texture((const unsigned char*)embeddedTexture->pcData, (size_t)embeddedTexture->mWidth, texPath.C_Str(), embeddedTexture->achFormatHint);
+			Texture* tex = new Texture((const unsigned char*)embeddedTexture->pcData, (size_t)embeddedTexture->mWidth, texPath.C_Str(), embeddedTexture->achFormatHint, batch);
 			return tex;
 		}
 		else {  // embedded raw data
@@ -138,7 +130,7 @@ Texture* Material::GetTexture(const aiScene* scene, const aiMaterial* assimpMat,
 			spdlog::error("Texture {} not found", texPath.C_Str());
 
 		if (!path.empty()) {
-			Texture* tex = new Texture(path);
+			Texture* tex = new Texture(path, true, batch);
 			if (tex->IsValid()) {
 				return tex;
 			}
@@ -159,25 +151,32 @@ const std::string& Material::GetShadingModelName() const {
 
 void Material::SetDiffuseTexture(Texture* texture) {
 	m_diffuseTex = texture;
-	VkDescriptorImageInfo imgInfo = texture->GetDescriptorImageInfo();
-	Vulkan::GetDevice()->UpdateSamplerDescriptorSet(m_materialDescSet, 1, imgInfo);
+	if (m_materialDesc.set != VK_NULL_HANDLE) {
+		VkDescriptorImageInfo imgInfo = texture->GetDescriptorImageInfo();
+		Vulkan::GetDevice()->UpdateSamplerDescriptorSet(m_materialDesc.set, 0, imgInfo);
+	}
 }
 
 void Material::SetSpecularTexture(Texture* texture) {
 	m_specularTex = texture;
-	VkDescriptorImageInfo imgInfo = texture->GetDescriptorImageInfo();
-	Vulkan::GetDevice()->UpdateSamplerDescriptorSet(m_materialDescSet, 2, imgInfo);
+	if (m_materialDesc.set != VK_NULL_HANDLE) {
+		VkDescriptorImageInfo imgInfo = texture->GetDescriptorImageInfo();
+		Vulkan::GetDevice()->UpdateSamplerDescriptorSet(m_materialDesc.set, 1, imgInfo);
+	}
 }
 
 void Material::UpdateUniform() {
-	MaterialUBO ubo{};
-	ubo.diffuse = m_diffuseColor;
-	ubo.specular = m_specularColor;
-	ubo.ambient = m_ambientColor;
-	ubo.shininess = m_shininess;
-	ubo.emissive = m_emissiveColor;
-
-	Vulkan::GetDevice()->UpdateUniformBuffer(m_materialMemory, 0, sizeof(MaterialUBO), &ubo);
+	MaterialData data{};
+	data.diffuse = m_diffuseColor;
+	data.specular = m_specularColor;
+	data.ambient = m_ambientColor;
+	data.shininess = m_shininess;
+	data.emissive = m_emissiveColor;
+	data.diffuseTexture = m_diffuseTex->GetTableIndex();
+	data.specularTexture = m_specularTex->GetTableIndex();
+
+	// Reaches the GPU at the start of the next frame
+	Vulkan::GetMaterialTable()->Set(m_index, data);
 }
 
 void Material::Log(const std::string& prefix, fmt::memory_buffer &out) const {
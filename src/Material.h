@@ -8,15 +8,18 @@
 #include "assimp/types.h"
 #include "assimp/material.h"
 
+#include "DescriptorAllocator.h"
+
 class Device;
 class Texture;
+class UploadBatch;
 struct aiMaterial;
 struct aiScene;
 
 class Material {
 public:
     Material();
-    Material(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture *>& textures);
+    Material(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture *>& textures, UploadBatch* batch = nullptr);
     ~Material();
 
     enum class ShadingModel {
@@ -49,7 +52,8 @@ public:
 
     void Log(const std::string& prefix, fmt::memory_buffer& out) const;
 
-    VkDescriptorSet GetDescriptorSet() const { return m_materialDescSet; }
+    VkDescriptorSet GetDescriptorSet() const { return m_materialDesc.set; }
+    uint32_t GetIndex() const { return m_index; }
 
     static glm::vec3 ToGlm(const aiColor3D& color3D) { return glm::vec3(color3D.r, color3D.g, color3D.b); };
 
@@ -68,19 +72,10 @@ private:
     Texture* m_diffuseTex;
     Texture* m_specularTex;
 
-    struct MaterialUBO {
-        alignas(16) glm::vec3 diffuse;
-        alignas(16) glm::vec3 specular;
-        alignas(4)  float shininess;
-        alignas(16) glm::vec3 ambient;
-        alignas(16) glm::vec3 emissive;
-    };
-
-    VkDescriptorSet m_materialDescSet;
-    VkBuffer m_materialBuffer;
-    VkDeviceMemory m_materialMemory;
+    DescriptorAllocation m_materialDesc;
+    uint32_t m_index;               // Entry of the MaterialTable
 
     void Init();
-    void LoadFromAssimp(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture*>& textures);
-    Texture* GetTexture(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, aiTextureType type, unsigned int index) const;
+    void LoadFromAssimp(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, std::vector<Texture*>& textures, UploadBatch* batch);
+    Texture* GetTexture(const aiScene* scene, const aiMaterial* assimpMat, const std::string& directory, aiTextureType type, unsigned int index, UploadBatch* batch) const;
 };
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "Device.h"
+#include "MaterialTable.h"
+
+MaterialTable::MaterialTable(Device& device, const std::vector<VkDescriptorSet>& sets, uint32_t binding, uint32_t capacity) :
+    m_device(device),
+    m_sets(sets),
+    m_binding(binding),
+    m_capacity(0),
+    m_sliceSize(0),
+    m_buffer(VK_NULL_HANDLE)
+{
+    m_dirty.resize(sets.size(), { 0, 0 });
+    CreateBuffer(std::max(capacity, 1u));
+}
+
+MaterialTable::~MaterialTable() {
+    DestroyBuffer();
+}
+
+void MaterialTable::CreateBuffer(uint32_t capacity) {
+    m_capacity = capacity;
+    m_sliceSize = m_device.PadStorageBufferSize(sizeof(MaterialData) * capacity);
+    // Not necessarily coherent, Update() flushes what it writes
+    m_device.CreateBuffer(m_sliceSize * m_sets.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, m_buffer, m_memory);
+    m_device.UpdateStorageDescriptorSets(m_sets, m_binding, m_buffer, m_sliceSize, sizeof(MaterialData) * capacity);
+}
+
+void MaterialTable::DestroyBuffer() {
+    if (m_buffer == VK_NULL_HANDLE)
+        return;
+    m_device.DestroyBuffer(m_buffer);
+    m_device.FreeMemory(m_memory);
+    m_buffer = VK_NULL_HANDLE;
+}
+
+uint32_t MaterialTable::Allocate() {
+    uint32_t index;
+    if (!m_freeIndices.empty()) {
+        index = m_freeIndices.back();
+        m_freeIndices.pop_back();
+    }
+    else {
+        index = (uint32_t)m_data.size();
+        m_data.push_back({});
+    }
+
+    if (index >= m_capacity) {
+        // The descriptor sets can only be rewritten while no frame uses them
+        m_device.WaitIdle();
+        DestroyBuffer();
+        CreateBuffer(m_capacity * 2);
+        MarkDirty(0, (uint32_t)m_data.size());
+        spdlog::debug("MaterialTable: grown to {} materials", m_capacity);
+    }
+
+    m_data[index] = {};
+    MarkDirty(index, index + 1);
+    return index;
+}
+
+void MaterialTable::Free(uint32_t index) {
+    m_freeIndices.push_back(index);
+}
+
+void MaterialTable::Set(uint32_t index, const MaterialData& data) {
+    m_data[index] = data;
+    MarkDirty(index, index + 1);
+}
+
+void MaterialTable::SetSets(const std::vector<VkDescriptorSet>& sets) {
+    DestroyBuffer();
+    m_sets = sets;
+    m_dirty.assign(sets.size(), { 0, 0 });
+    CreateBuffer(m_capacity);
+    MarkDirty(0, (uint32_t)m_data.size());
+}
+
+void MaterialTable::MarkDirty(uint32_t begin, uint32_t end) {
+    for (DirtyRange& range : m_dirty) {
+        if (range.begin >= range.end) {
+            range = { begin, end };
+        }
+        else {
+            range.begin = std::min(range.begin, begin);
+            range.end = std::max(range.end, end);
+        }
+    }
+}
+
+void MaterialTable::Update(uint32_t frame) {
+    DirtyRange& range = m_dirty[frame];
+    if (range.begin >= range.end)
+        return;
+
+    VkDeviceSize offset = m_sliceSize * frame + sizeof(MaterialData) * range.begin;
+    VkDeviceSize size = sizeof(MaterialData) * (range.end - range.begin);
+    memcpy((char*)m_memory.mapped + offset, &m_data[range.begin], size);
+    m_device.FlushMemory(m_memory, offset, size);
+
+    range = { 0, 0 };
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MemoryAllocator.h"
+
+class Device;
+
+// Same layout as the std430 MaterialData struct of the shaders
+struct MaterialData {
+	glm::vec3 diffuse;
+	float shininess;
+	glm::vec3 specular;
+	uint32_t diffuseTexture;    // TextureTable indices, only used by the bindless shaders
+	glm::vec3 ambient;
+	uint32_t specularTexture;
+	glm::vec3 emissive;
+	float pad;
+};
+
+// Parameters of every material packed into a single storage buffer, indexed
+// by material index in the shaders. Each frame in flight reads its own copy,
+// Update() copies the entries written since that copy was last refreshed.
+class MaterialTable
+{
+public:
+	// The table writes binding 'binding' of every set, one set per frame
+	MaterialTable(Device& device, const std::vector<VkDescriptorSet>& sets, uint32_t binding, uint32_t capacity);
+	~MaterialTable();
+
+	MaterialTable(const MaterialTable&) = delete;
+	MaterialTable& operator=(const MaterialTable&) = delete;
+
+	// Growing the table waits for the device to be idle
+	uint32_t Allocate();
+	void Free(uint32_t index);
+	void Set(uint32_t index, const MaterialData& data);
+
+	// Once per frame, after waiting for the frame fence
+	void Update(uint32_t frame);
+	// When the frames in flight change. The device must be idle
+	void SetSets(const std::vector<VkDescriptorSet>& sets);
+
+	uint32_t GetCount() const { return (uint32_t)(m_data.size() - m_freeIndices.size()); }
+	uint32_t GetCapacity() const { return m_capacity; }
+
+private:
+	struct DirtyRange {
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	Device& m_device;
+	std::vector<VkDescriptorSet> m_sets;
+	uint32_t m_binding;
+	uint32_t m_capacity;
+	VkDeviceSize m_sliceSize;
+	VkBuffer m_buffer;
+	MemoryAllocation m_memory;
+	std::vector<MaterialData> m_data;      // CPU copy, the GPU slices are write only
+	std::vector<uint32_t> m_freeIndices;
+	std::vector<DirtyRange> m_dirty;       // One per frame, empty when begin >= end
+
+	void CreateBuffer(uint32_t capacity);
+	void DestroyBuffer();
+	void MarkDirty(uint32_t begin, uint32_t end);
+};
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "MemoryAllocator.h"
+
+constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+constexpr VkDeviceSize SMALL_HEAP_SIZE = 1024ull * 1024 * 1024;
+
+MemoryAllocator::MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice) :
+    m_device(device)
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+    m_maxAllocations = properties.limits.maxMemoryAllocationCount;
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    MemoryStats stats = GetStats();
+    if (stats.allocationCount > 0)
+        spdlog::warn("MemoryAllocator: {} allocations still alive at destruction", stats.allocationCount);
+
+    for (Block& block : m_blocks) {
+        if (block.memory != VK_NULL_HANDLE)
+            vkFreeMemory(m_device, block.memory, nullptr);
+    }
+}
+
+uint32_t MemoryAllocator::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < m_memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (m_memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+VkDeviceSize MemoryAllocator::GetBlockSize(uint32_t memoryType) const {
+    uint32_t heapIndex = m_memProperties.memoryTypes[memoryType].heapIndex;
+    VkDeviceSize heapSize = m_memProperties.memoryHeaps[heapIndex].size;
+    // Small heaps (e.g. the 256MB BAR heap) get smaller blocks
+    if (heapSize <= SMALL_HEAP_SIZE)
+        return std::min(DEFAULT_BLOCK_SIZE, heapSize / 8);
+    return DEFAULT_BLOCK_SIZE;
+}
+
+bool MemoryAllocator::IsCoherent(const MemoryAllocation& allocation) const {
+    return (m_memProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+uint32_t MemoryAllocator::GetDeviceAllocationCount() const {
+    uint32_t count = m_dedicatedCount;
+    for (const Block& block : m_blocks) {
+        if (block.memory != VK_NULL_HANDLE)
+            count++;
+    }
+    return count;
+}
+
+VkDeviceMemory MemoryAllocator::AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) {
+    if (GetDeviceAllocationCount() >= m_maxAllocations) {
+        throw std::runtime_error("maxMemoryAllocationCount reached!");
+    }
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+
+    *mapped = nullptr;
+    if (m_memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+
+    return memory;
+}
+
+int32_t MemoryAllocator::CreateBlock(uint32_t memoryType, bool linear) {
+    VkDeviceSize size = GetBlockSize(memoryType);
+    Block block;
+    block.memoryType = memoryType;
+    block.linear = linear;
+    block.memory = AllocateDeviceMemory(size, memoryType, &block.mapped);
+    block.freeList.Reset(size);
+
+    spdlog::debug("MemoryAllocator: new block of {} MB (memory type {}, {})", size / (1024 * 1024), memoryType, linear ? "linear" : "optimal");
+
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        if (m_blocks[i].memory == VK_NULL_HANDLE) {
+            m_blocks[i] = std::move(block);
+            return (int32_t)i;
+        }
+    }
+    m_blocks.push_back(std::move(block));
+    return (int32_t)m_blocks.size() - 1;
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear) {
+    MemoryAllocation allocation;
+    allocation.memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+
+    VkDeviceSize alignment = requirements.alignment;
+    VkDeviceSize size = requirements.size;
+    // Mapped ranges of non coherent memory are flushed in nonCoherentAtomSize units,
+    // so neighbouring allocations must not share an atom.
+    if (!IsCoherent(allocation) && (m_memProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        alignment = std::max(alignment, m_nonCoherentAtomSize);
+        size = FreeList::AlignUp(size, m_nonCoherentAtomSize);
+    }
+    allocation.size = size;
+
+    if (size > GetBlockSize(allocation.memoryType) / 2) {
+        allocation.memory = AllocateDeviceMemory(size, allocation.memoryType, &allocation.mapped);
+        allocation.offset = 0;
+        allocation.block = -1;
+        m_dedicatedCount++;
+        m_dedicatedBytes += size;
+        return allocation;
+    }
+
+    int32_t blockIndex = -1;
+    VkDeviceSize offset = 0;
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        Block& block = m_blocks[i];
+        if (block.memory == VK_NULL_HANDLE || block.memoryType != allocation.memoryType || block.linear != linear)
+            continue;
+        if (block.freeList.Allocate(size, alignment, offset)) {
+            blockIndex = (int32_t)i;
+            break;
+        }
+    }
+
+    if (blockIndex < 0) {
+        blockIndex = CreateBlock(allocation.memoryType, linear);
+        if (!m_blocks[blockIndex].freeList.Allocate(size, alignment, offset)) {
+            throw std::runtime_error("failed to sub-allocate device memory!");
+        }
+    }
+
+    Block& block = m_blocks[blockIndex];
+    block.allocations++;
+
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.block = blockIndex;
+    allocation.mapped = block.mapped ? (char*)block.mapped + offset : nullptr;
+
+    return allocation;
+}
+
+void MemoryAllocator::Free(MemoryAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    if (allocation.block < 0) {
+        vkFreeMemory(m_device, allocation.memory, nullptr);
+        m_dedicatedCount--;
+        m_dedicatedBytes -= allocation.size;
+    }
+    else {
+        Block& block = m_blocks[allocation.block];
+        block.freeList.Free(allocation.offset, allocation.size);
+        block.allocations--;
+
+        // Keep a single empty block per memory type around to avoid thrashing,
+        // this one is freed only if another empty one already is
+        if (block.allocations == 0) {
+            for (size_t i = 0; i < m_blocks.size(); i++) {
+                const Block& other = m_blocks[i];
+                if ((int32_t)i != allocation.block && other.memory != VK_NULL_HANDLE && other.allocations == 0 &&
+                    other.memoryType == block.memoryType && other.linear == block.linear) {
+                    vkFreeMemory(m_device, block.memory, nullptr);
+                    block = Block();
+                    break;
+                }
+            }
+        }
+    }
+
+    allocation = MemoryAllocation();
+}
+
+MemoryStats MemoryAllocator::GetStats() const {
+    MemoryStats stats;
+    for (const Block& block : m_blocks) {
+        if (block.memory == VK_NULL_HANDLE)
+            continue;
+        stats.blockCount++;
+        stats.allocationCount += block.allocations;
+        stats.reservedBytes += block.freeList.GetSize();
+        stats.usedBytes += block.freeList.GetUsed();
+    }
+    stats.dedicatedCount = m_dedicatedCount;
+    stats.allocationCount += m_dedicatedCount;
+    stats.reservedBytes += m_dedicatedBytes;
+    stats.usedBytes += m_dedicatedBytes;
+    stats.deviceAllocationCount = stats.blockCount + m_dedicatedCount;
+    return stats;
+}
+
+void MemoryAllocator::LogStats() const {
+    MemoryStats stats = GetStats();
+    spdlog::info("GPU memory: {} allocations in {} blocks + {} dedicated, {:.2f}/{:.2f} MB used",
+        stats.allocationCount, stats.blockCount, stats.dedicatedCount,
+        stats.usedBytes / (1024.0 * 1024.0), stats.reservedBytes / (1024.0 * 1024.0));
+}
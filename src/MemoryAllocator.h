@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "FreeList.h"
+
+// Handle to a sub-range of a VkDeviceMemory block. Host visible memory is
+// persistently mapped, 'mapped' already points to 'offset' inside the block.
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	uint32_t memoryType = 0;
+	int32_t block = -1;         // -1: dedicated allocation
+	void* mapped = nullptr;
+};
+
+struct MemoryStats {
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;
+	uint32_t deviceAllocationCount = 0;  // Live vkAllocateMemory objects
+	VkDeviceSize reservedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+};
+
+class MemoryAllocator
+{
+public:
+	MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice);
+	~MemoryAllocator();
+
+	// linear: buffers and linear images. Optimal tiled images are kept in
+	// separate blocks so bufferImageGranularity never has to be considered.
+	MemoryAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+	void Free(MemoryAllocation& allocation);
+
+	bool IsCoherent(const MemoryAllocation& allocation) const;
+	VkDeviceSize GetNonCoherentAtomSize() const { return m_nonCoherentAtomSize; }
+
+	MemoryStats GetStats() const;
+	void LogStats() const;
+
+private:
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint32_t memoryType = 0;
+		uint32_t allocations = 0;
+		bool linear = true;
+		void* mapped = nullptr;
+		FreeList freeList;
+	};
+
+	VkDevice m_device;
+	VkPhysicalDeviceMemoryProperties m_memProperties;
+	VkDeviceSize m_nonCoherentAtomSize;
+	uint32_t m_maxAllocations;
+	std::vector<Block> m_blocks;       // Empty slots have memory == VK_NULL_HANDLE
+	uint32_t m_dedicatedCount = 0;
+	VkDeviceSize m_dedicatedBytes = 0;
+
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	VkDeviceSize GetBlockSize(uint32_t memoryType) const;
+	uint32_t GetDeviceAllocationCount() const;
+	VkDeviceMemory AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+	int32_t CreateBlock(uint32_t memoryType, bool linear);
+};
@@ -1,8 +1,16 @@
+#include <algorithm>
 #include <array>
+#include <cmath>
 
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "DescriptorAllocator.h"
 #include "Device.h"
+#include "GeometryArena.h"
 #include "Texture.h"
 #include "Material.h"
+#include "UploadBatch.h"
 #include "Vulkan.h"
 
 #include "Mesh.h"
@@ -42,82 +50,281 @@ std::array<VkVertexInputAttributeDescription, 4> Vertex::getAttributeDescription
     return attributeDescriptions;
 }
 
+VkVertexInputBindingDescription Vertex::getPositionBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(Vertex::pos);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+}
+
+VkVertexInputAttributeDescription Vertex::getPositionAttributeDescription() {
+    VkVertexInputAttributeDescription attributeDescription{};
+    attributeDescription.binding = 0;
+    attributeDescription.location = 0;
+    attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescription.offset = 0;
+
+    return attributeDescription;
+}
+
+// Octahedral mapping of a unit vector to [-1, 1]^2, zero vectors map to +z
+static glm::vec2 EncodeOctahedral(const glm::vec3& n) {
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (sum == 0.0f)
+        return glm::vec2(0.0f);
+
+    glm::vec2 e = glm::vec2(n.x, n.y) / sum;
+    if (n.z < 0.0f) {
+        glm::vec2 sign(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = (glm::vec2(1.0f) - glm::abs(glm::vec2(e.y, e.x))) * sign;
+    }
+    return e;
+}
+
+PackedVertex PackedVertex::Pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsSize) {
+    PackedVertex packed;
+    for (int i = 0; i < 3; i++) {
+        float t = boundsSize[i] > 0.0f ? (vertex.pos[i] - boundsMin[i]) / boundsSize[i] : 0.0f;
+        packed.pos[i] = (uint16_t)std::round(glm::clamp(t, 0.0f, 1.0f) * 65535.0f);
+    }
+    packed.pos[3] = 0;
+    packed.normal = glm::packSnorm2x16(EncodeOctahedral(vertex.normal));
+    packed.color = glm::packUnorm4x8(glm::vec4(vertex.color, 1.0f));
+    packed.texCoord = glm::packHalf2x16(vertex.texCoord);
+    return packed;
+}
+
+VkVertexInputBindingDescription PackedVertex::getBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(PackedVertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+}
+
+std::array<VkVertexInputAttributeDescription, 4> PackedVertex::getAttributeDescriptions() {
+    std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+    attributeDescriptions[0].offset = offsetof(PackedVertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+    attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
+
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[2].offset = offsetof(PackedVertex, color);
+
+    attributeDescriptions[3].binding = 0;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format = VK_FORMAT_R16G16_SFLOAT;
+    attributeDescriptions[3].offset = offsetof(PackedVertex, texCoord);
+
+    return attributeDescriptions;
+}
+
+VkVertexInputBindingDescription PackedVertex::getPositionBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(PackedVertex::pos);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+}
+
+VkVertexInputAttributeDescription PackedVertex::getPositionAttributeDescription() {
+    // Same format as the full vertex, so both passes compute the same depth
+    VkVertexInputAttributeDescription attributeDescription{};
+    attributeDescription.binding = 0;
+    attributeDescription.location = 0;
+    attributeDescription.format = VK_FORMAT_R16G16B16A16_UNORM;
+    attributeDescription.offset = 0;
+
+    return attributeDescription;
+}
+
 Mesh::Mesh(
     const std::vector<Vertex>& vertices, 
     const std::vector<unsigned int>& indices, 
     Material *material,
     const glm::vec3& bboxMin,
-    const glm::vec3& bboxMax)
+    const glm::vec3& bboxMax,
+    UploadBatch* batch,
+    const std::vector<MeshLod>& lods,
+    const MeshletData& meshlets)
 :
     m_vertices(vertices),
     m_indices(indices),
+    m_lods(lods),
+    m_meshletData(meshlets),
+    m_meshlets(meshlets.meshlets),
     m_material(material),
     m_bboxMin(bboxMin),
-    m_bboxMax(bboxMax)
+    m_bboxMax(bboxMax),
+    m_packed(Vulkan::UsesPackedVertices()),
+    m_unpack(1.0f)
 {
-    Device* device = Vulkan::GetDevice();
-    CreateVertexBuffer(device);
-    CreateIndexBuffer(device);
+    if (m_lods.empty())
+        m_lods.push_back({ 0, (uint32_t)m_indices.size(), 0.0f });
+
+    GeometryArena* arena = Vulkan::GetGeometryArena();
+    uint32_t vertexStride = m_packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    uint32_t indexStride = m_vertices.size() < INDEX16_VERTEX_LIMIT ? sizeof(uint16_t) : sizeof(uint32_t);
+    uint32_t positionStride = m_packed ? sizeof(PackedVertex::pos) : sizeof(Vertex::pos);
+    m_geometry = arena->Allocate((uint32_t)m_vertices.size(), vertexStride, (uint32_t)m_indices.size(), indexStride, positionStride);
+    CreateVertexBuffer(arena, batch);
+    CreateIndexBuffer(arena, batch);
 }
 
 Mesh::Mesh(const Mesh& other) :
-    Mesh(other.m_vertices, other.m_indices, other.m_material, other.m_bboxMin, other.m_bboxMin)
+    Mesh(other.m_vertices, other.m_indices, other.m_material, other.m_bboxMin, other.m_bboxMax, nullptr, other.m_lods, other.m_meshletData)
 {
 
 }
 
 Mesh::~Mesh() {
-    Device* device = Vulkan::GetDevice();
-    device->DestroyBuffer(m_indexBuffer);
-    device->FreeMemory(m_indexBufferMemory);
-    device->DestroyBuffer(m_vertexBuffer);
-    device->FreeMemory(m_vertexBufferMemory);
+    Vulkan::GetGeometryArena()->Free(m_geometry);
+    if (m_meshletBuffer != VK_NULL_HANDLE) {
+        Vulkan::GetDescriptorAllocator()->Free(m_meshletSet);
+        Vulkan::GetDevice()->DestroyBuffer(m_meshletBuffer);
+        Vulkan::GetDevice()->FreeMemory(m_meshletMemory);
+    }
 }
 
-void Mesh::Draw(glm::mat4 matrix)
+void Mesh::Draw(const glm::mat4& matrix, const glm::mat3x4& normalMatrix)
 {
     VkDescriptorSet materialDescSet = VK_NULL_HANDLE;
-    if (m_material != nullptr)
+    uint32_t materialIndex = Vulkan::GetDefaultMaterialIndex();
+    if (m_material != nullptr) {
         materialDescSet = m_material->GetDescriptorSet();
-    Vulkan::Draw(matrix, m_vertexBuffer, m_indexBuffer, m_indices.size(), materialDescSet);
-}
+        materialIndex = m_material->GetIndex();
+    }
 
-void Mesh::CreateVertexBuffer(Device* device) {
-    VkDeviceSize bufferSize = sizeof(m_vertices[0]) * m_vertices.size();
+    size_t lod = 0;
+    float threshold = Vulkan::GetLodThreshold();
+    if (m_lods.size() > 1 && threshold > 0.0f) {
+        // Errors are relative to the diagonal, which is what the projected size measures
+        float size = Vulkan::GetProjectedSize(matrix, m_bboxMin, m_bboxMax);
+        while (lod + 1 < m_lods.size() && m_lods[lod + 1].error * size <= threshold)
+            lod++;
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    device->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    // Meshlets only split the full resolution level
+    const Meshlet* meshlets = lod == 0 ? m_meshlets.data() : nullptr;
+    uint32_t meshletCount = lod == 0 ? (uint32_t)m_meshlets.size() : 0;
+
+    if (m_packed) {
+        // The unit box of the packed positions is the same box in the draw matrix space
+        Vulkan::Draw(matrix * m_unpack, normalMatrix, m_geometry, m_lods[lod].firstIndex, m_lods[lod].indexCount, glm::vec3(0.0f), glm::vec3(1.0f), materialDescSet, materialIndex, meshlets, meshletCount, m_meshletSet.set);
+    }
+    else {
+        Vulkan::Draw(matrix, normalMatrix, m_geometry, m_lods[lod].firstIndex, m_lods[lod].indexCount, m_bboxMin, m_bboxMax, materialDescSet, materialIndex, meshlets, meshletCount, m_meshletSet.set);
+    }
+}
 
-    void* data;
-    device->MapMemory(stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_vertices.data(), (size_t)bufferSize);
-    device->UnmapMemory(stagingBufferMemory);
+void Mesh::CreateVertexBuffer(GeometryArena* arena, UploadBatch* batch) {
+    if (!m_packed) {
+        std::vector<glm::vec3> positions(m_vertices.size());
+        for (size_t i = 0; i < m_vertices.size(); i++)
+            positions[i] = m_vertices[i].pos;
+        arena->UploadVertices(m_geometry, m_vertices.data(), batch);
+        arena->UploadPositions(m_geometry, positions.data(), batch);
+        CreateMeshletBuffer(m_vertices.data(), m_vertices.size() * sizeof(Vertex), batch);
+        return;
+    }
 
-    device->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertexBuffer, m_vertexBufferMemory);
+    // Quantized over the bounds of the vertices themselves, the bbox could be looser
+    glm::vec3 boundsMin = m_vertices.empty() ? glm::vec3(0.0f) : m_vertices[0].pos;
+    glm::vec3 boundsMax = boundsMin;
+    for (const Vertex& vertex : m_vertices) {
+        boundsMin = glm::min(boundsMin, vertex.pos);
+        boundsMax = glm::max(boundsMax, vertex.pos);
+    }
+    glm::vec3 boundsSize = boundsMax - boundsMin;
+    m_unpack = glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), boundsSize);
 
-    device->CopyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
+    // The meshlets are culled with the draw matrix too, their cones stay in mesh space
+    glm::vec3 invSize = glm::vec3(
+        boundsSize.x > 0.0f ? 1.0f / boundsSize.x : 0.0f,
+        boundsSize.y > 0.0f ? 1.0f / boundsSize.y : 0.0f,
+        boundsSize.z > 0.0f ? 1.0f / boundsSize.z : 0.0f);
+    for (Meshlet& meshlet : m_meshlets) {
+        meshlet.bboxMin = (meshlet.bboxMin - boundsMin) * invSize;
+        meshlet.bboxMax = (meshlet.bboxMax - boundsMin) * invSize;
+    }
 
-    device->DestroyBuffer(stagingBuffer);
-    device->FreeMemory(stagingBufferMemory);
+    std::vector<PackedVertex> packed(m_vertices.size());
+    std::vector<std::array<uint16_t, 4>> positions(m_vertices.size());
+    for (size_t i = 0; i < m_vertices.size(); i++) {
+        packed[i] = PackedVertex::Pack(m_vertices[i], boundsMin, boundsSize);
+        std::copy(std::begin(packed[i].pos), std::end(packed[i].pos), positions[i].begin());
+    }
+    arena->UploadVertices(m_geometry, packed.data(), batch);
+    arena->UploadPositions(m_geometry, positions.data(), batch);
+    CreateMeshletBuffer(packed.data(), packed.size() * sizeof(PackedVertex), batch);
 }
 
-void Mesh::CreateIndexBuffer(Device* device) {
-    VkDeviceSize bufferSize = sizeof(m_indices[0]) * m_indices.size();
+void Mesh::CreateIndexBuffer(GeometryArena* arena, UploadBatch* batch) {
+    if (m_vertices.size() >= INDEX16_VERTEX_LIMIT) {
+        arena->UploadIndices(m_geometry, m_indices.data(), batch);
+        return;
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    device->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    std::vector<uint16_t> indices(m_indices.begin(), m_indices.end());
+    arena->UploadIndices(m_geometry, indices.data(), batch);
+}
+
+void Mesh::CreateMeshletBuffer(const void* vertices, size_t vertexBytes, UploadBatch* batch) {
+    Device* device = Vulkan::GetDevice();
+    if (!device->HasMeshShader() || m_meshlets.empty())
+        return;
 
-    void* data;
-    device->MapMemory(stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_indices.data(), (size_t)bufferSize);
-    device->UnmapMemory(stagingBufferMemory);
+    // Bindings of the meshlet set: meshlets, meshlet vertices, triangles and vertices,
+    // in the layout of the vertex buffer. One buffer, at aligned offsets.
+    const void* data[] = { m_meshlets.data(), m_meshletData.vertices.data(), m_meshletData.triangles.data(), vertices };
+    VkDeviceSize sizes[] = {
+        m_meshlets.size() * sizeof(Meshlet),
+        m_meshletData.vertices.size() * sizeof(uint32_t),
+        m_meshletData.triangles.size() * sizeof(uint32_t),
+        vertexBytes
+    };
+    VkDeviceSize offsets[4];
+    VkDeviceSize size = 0;
+    for (int i = 0; i < 4; i++) {
+        offsets[i] = size;
+        size += device->PadStorageBufferSize(sizes[i]);
+    }
 
-    device->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indexBuffer, m_indexBufferMemory);
+    device->CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_meshletBuffer, m_meshletMemory);
+    for (int i = 0; i < 4; i++) {
+        if (batch)
+            batch->UploadBuffer(m_meshletBuffer, offsets[i], data[i], sizes[i]);
+        else
+            device->UploadBuffer(m_meshletBuffer, offsets[i], data[i], sizes[i]);
+    }
 
-    device->CopyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
+    m_meshletSet = Vulkan::GetDescriptorAllocator()->Allocate(Vulkan::GetMeshletLayout());
+    VkDescriptorBufferInfo bufferInfos[4];
+    VkWriteDescriptorSet descWrites[4]{};
+    for (uint32_t i = 0; i < 4; i++) {
+        bufferInfos[i].buffer = m_meshletBuffer;
+        bufferInfos[i].offset = offsets[i];
+        bufferInfos[i].range = sizes[i];
 
-    device->DestroyBuffer(stagingBuffer);
-    device->FreeMemory(stagingBufferMemory);
+        descWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[i].dstSet = m_meshletSet.set;
+        descWrites[i].dstBinding = i;
+        descWrites[i].descriptorCount = 1;
+        descWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descWrites[i].pBufferInfo = &bufferInfos[i];
+    }
+    device->UpdateDescriptorSets(4, descWrites);
 }
@@ -7,10 +7,20 @@
 
 #include "assimp/types.h"
 
+#include "DescriptorAllocator.h"
+#include "MemoryAllocator.h"
+
 class Device;
+class GeometryArena;
+class UploadBatch;
 class Texture;
 class Material;
 
+constexpr size_t INDEX16_VERTEX_LIMIT = 65536;     // Meshes with fewer vertices get 16 bit indices
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+constexpr float MESHLET_NO_CONE = 2.0f;            // coneCutoff of the clusters that can not be cone culled, above any cosine
+
 struct Vertex {
     glm::vec3 pos;
     glm::vec3 normal;
@@ -19,6 +29,57 @@ struct Vertex {
 
     static VkVertexInputBindingDescription getBindingDescription();
     static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions();
+    // Position-only stream of the same vertices, just the pos of each one
+    static VkVertexInputBindingDescription getPositionBindingDescription();
+    static VkVertexInputAttributeDescription getPositionAttributeDescription();
+};
+
+// Vertex layout of the meshes with Vulkan::UsesPackedVertices, 20 bytes instead of 44.
+// The vertex formats do the decoding, except for the normal (see the PACKED shaders).
+struct PackedVertex {
+    uint16_t pos[4];        // UNORM, relative to the mesh bounds (w unused). Mesh::Draw folds the bounds into the matrix
+    uint32_t normal;        // Octahedral, 2 x SNORM16
+    uint32_t color;         // RGBA8 UNORM
+    uint32_t texCoord;      // 2 x half float
+
+    static PackedVertex Pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsSize);
+    static VkVertexInputBindingDescription getBindingDescription();
+    static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions();
+    static VkVertexInputBindingDescription getPositionBindingDescription();
+    static VkVertexInputAttributeDescription getPositionAttributeDescription();
+};
+
+// Level of detail, a range of the mesh indices over the same vertices
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;        // Distance the surface moved, relative to the bounds diagonal
+};
+
+// Cluster of triangles of the full resolution level, culled on its own.
+// Same layout as the std430 Meshlet struct of meshlet.task and meshlet.mesh.
+struct Meshlet {
+    glm::vec3 bboxMin;      // Mesh space, the unit box of the positions in Mesh::GetMeshlets when packed
+    uint32_t firstIndex;    // Range of the mesh indices, also the first triangle (/ 3) in MeshletData::triangles
+    glm::vec3 bboxMax;
+    uint32_t indexCount;
+    glm::vec3 center;       // Bounding sphere, mesh space
+    float radius;
+    // Normal cone, mesh space. All the triangles face away from an eye if
+    // dot(normalize(coneApex - eye), coneAxis) >= coneCutoff
+    glm::vec3 coneApex;
+    uint32_t vertexOffset;  // First entry in MeshletData::vertices
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    uint32_t vertexCount;
+    uint32_t padding[3];
+};
+
+// Meshlets of a mesh and their local topology, for the mesh shaders
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;     // Mesh vertex of every meshlet vertex
+    std::vector<uint32_t> triangles;    // Three 8 bit meshlet vertices per triangle, in the order of the mesh indices
 };
 
 class Mesh
@@ -29,32 +90,50 @@ public:
         const std::vector<uint32_t>& indices, 
         Material *material, 
         const glm::vec3& bboxMin, 
-        const glm::vec3& bboxMax
+        const glm::vec3& bboxMax,
+        UploadBatch* batch = nullptr,
+        const std::vector<MeshLod>& lods = {},    // Empty: all the indices are one level
+        const MeshletData& meshlets = {}          // Of the full resolution level
     );
     Mesh(const Mesh& other);
     ~Mesh();
     size_t GetNumVertices() { return m_vertices.size(); };
-    size_t GetNumIndices() { return m_indices.size(); };
+    size_t GetNumIndices() { return m_lods[0].indexCount; };     // Full resolution level
+    size_t GetNumLods() const { return m_lods.size(); }
+    const MeshLod& GetLod(size_t i) const { return m_lods[i]; }
+    const std::vector<Meshlet>& GetMeshlets() const { return m_meshlets; }
     Material* GetMaterial() { return m_material; }
     glm::vec3 GetBBoxMin() const { return m_bboxMin; };
     glm::vec3 GetBBoxMax() const { return m_bboxMax; };
-    void Draw(glm::mat4 matrix);
+    // normalMatrix: transpose(inverse(matrix)), see InstanceData
+    // The level is the coarsest whose error stays under Vulkan::GetLodThreshold on screen.
+    // The full resolution level is drawn with its meshlets.
+    void Draw(const glm::mat4& matrix, const glm::mat3x4& normalMatrix);
 
 private:
     // mesh data
     std::vector<Vertex>   m_vertices;
-    std::vector<uint32_t> m_indices;
+    std::vector<uint32_t> m_indices;     // Every level, one after another
+    std::vector<MeshLod>  m_lods;        // Finest first
+    MeshletData           m_meshletData;
+    std::vector<Meshlet>  m_meshlets;    // Boxes in the space of the draw matrix, the uploaded copy
     Material *m_material;
     glm::vec3 m_bboxMin;
     glm::vec3 m_bboxMax;
 
-    VkBuffer m_vertexBuffer;
-    VkDeviceMemory m_vertexBufferMemory;
-    VkBuffer m_indexBuffer;
-    VkDeviceMemory m_indexBufferMemory;
+    uint32_t m_geometry;    // Handle in the shared GeometryArena, with 16 bit indices below INDEX16_VERTEX_LIMIT and a position stream
+    bool m_packed;          // Uploaded as PackedVertex
+    glm::mat4 m_unpack;     // From the packed positions to the mesh space
+
+    // Meshlets, their topology and a copy of the vertices for the mesh shaders,
+    // only if the device supports them
+    VkBuffer m_meshletBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_meshletMemory;
+    DescriptorAllocation m_meshletSet;
 
 private:
-    void CreateVertexBuffer(Device* device);
-    void CreateIndexBuffer(Device* device);
+    void CreateVertexBuffer(GeometryArena* arena, UploadBatch* batch);
+    void CreateIndexBuffer(GeometryArena* arena, UploadBatch* batch);
+    void CreateMeshletBuffer(const void* vertices, size_t vertexBytes, UploadBatch* batch);
 };
 
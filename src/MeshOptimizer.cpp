@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Mesh.h"
+#include "MeshOptimizer.h"
+
+constexpr int FORSYTH_CACHE_SIZE = 32;      // LRU cache the scores are computed for
+constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float FORSYTH_CACHE_DECAY = 1.5f;
+constexpr float FORSYTH_VALENCE_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_POWER = 0.5f;
+
+constexpr uint32_t FIFO_CACHE_SIZE = 16;    // Simulated for the stats and the overdraw clusters
+constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+// Simulates a FIFO cache with timestamps, a vertex is in the cache if it missed
+// less than FIFO_CACHE_SIZE misses ago
+struct FifoCache {
+    std::vector<uint32_t> timestamps;
+    uint32_t time;
+
+    explicit FifoCache(size_t vertexCount) : timestamps(vertexCount, 0), time(FIFO_CACHE_SIZE + 1) {}
+
+    void Reset() { time += FIFO_CACHE_SIZE + 1; }
+
+    // Returns the misses of the triangle
+    uint32_t Access(const uint32_t* triangle) {
+        uint32_t misses = 0;
+        for (int k = 0; k < 3; k++) {
+            if (time - timestamps[triangle[k]] > FIFO_CACHE_SIZE) {
+                timestamps[triangle[k]] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+};
+
+static float VertexScore(int cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The last triangle's vertices get a fixed score, so it does not matter which of them was used
+        if (cachePosition < 3)
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        else
+            score = std::pow(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY);
+    }
+    // Vertices with few triangles left are finished first, so they leave the cache for good
+    return score + FORSYTH_VALENCE_SCALE * std::pow((float)remainingTriangles, -FORSYTH_VALENCE_POWER);
+}
+
+void MeshOptimizer::Optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const std::vector<MeshLod>& lods) {
+    for (const MeshLod& lod : lods) {
+        OptimizeVertexCache(&indices[lod.firstIndex], lod.indexCount, vertices.size());
+        OptimizeOverdraw(&indices[lod.firstIndex], lod.indexCount, vertices, OVERDRAW_THRESHOLD);
+    }
+    // The full resolution level comes first, the vertices follow its order
+    OptimizeVertexFetch(vertices, indices);
+}
+
+VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    VertexCacheStats stats;
+    if (indexCount == 0 || indexCount % 3 != 0)
+        return stats;
+
+    FifoCache cache(vertexCount);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t misses = 0;
+    uint32_t uniqueVertices = 0;
+    for (size_t i = 0; i < indexCount; i += 3) {
+        misses += cache.Access(&indices[i]);
+        for (int k = 0; k < 3; k++) {
+            if (!referenced[indices[i + k]]) {
+                referenced[indices[i + k]] = true;
+                uniqueVertices++;
+            }
+        }
+    }
+    stats.acmr = (float)misses / (indexCount / 3);
+    stats.atvr = (float)misses / uniqueVertices;
+    return stats;
+}
+
+void MeshOptimizer::OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || indexCount % 3 != 0)
+        return;
+
+    // Triangles of every vertex, the first 'remaining' are not emitted yet
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++)
+        remaining[indices[i]]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; i++)
+        adjacency[cursor[indices[i]]++] = (uint32_t)(i / 3);
+
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScores[v] = VertexScore(-1, remaining[v]);
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+
+    // Three more entries than the cache, for the vertices pushed by the new triangle
+    std::vector<uint32_t> cache, newCache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    size_t nextUnemitted = 0;
+    int64_t best = -1;
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+        // Nothing in the cache has triangles left, restart from the input order
+        if (best < 0) {
+            while (emitted[nextUnemitted])
+                nextUnemitted++;
+            best = (int64_t)nextUnemitted;
+        }
+
+        const uint32_t* triangle = &indices[best * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+        emitted[best] = true;
+
+        newCache.clear();
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = triangle[k];
+            // Remove the triangle from the not emitted ones of the vertex
+            uint32_t* first = &adjacency[offsets[v]];
+            uint32_t* last = first + remaining[v];
+            *std::find(first, last, (uint32_t)best) = *(last - 1);
+            remaining[v]--;
+            newCache.push_back(v);
+        }
+        for (uint32_t v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache.push_back(v);
+        }
+        // Pushed out of the cache
+        for (size_t i = FORSYTH_CACHE_SIZE; i < newCache.size(); i++)
+            vertexScores[newCache[i]] = VertexScore(-1, remaining[newCache[i]]);
+        newCache.resize(std::min(newCache.size(), (size_t)FORSYTH_CACHE_SIZE));
+        cache.swap(newCache);
+
+        for (size_t i = 0; i < cache.size(); i++)
+            vertexScores[cache[i]] = VertexScore((int)i, remaining[cache[i]]);
+
+        // Only the triangles of the cached vertices changed score
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v : cache) {
+            for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; i++) {
+                uint32_t t = adjacency[i];
+                float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void MeshOptimizer::OptimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices, float threshold) {
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || indexCount % 3 != 0)
+        return;
+
+    // Hard boundaries: triangles that miss all their vertices, the cache starts over there anyway
+    FifoCache cache(vertices.size());
+    std::vector<size_t> hardClusters;
+    for (size_t t = 0; t < triangleCount; t++) {
+        if (cache.Access(&indices[t * 3]) == 3)
+            hardClusters.push_back(t);
+    }
+    hardClusters.push_back(triangleCount);
+
+    // Soft boundaries: split a hard cluster as soon as its ACMR so far is close
+    // enough to the ACMR of the whole cluster
+    std::vector<size_t> clusters;
+    for (size_t c = 0; c + 1 < hardClusters.size(); c++) {
+        size_t start = hardClusters[c];
+        size_t end = hardClusters[c + 1];
+
+        cache.Reset();
+        uint32_t misses = 0;
+        for (size_t t = start; t < end; t++)
+            misses += cache.Access(&indices[t * 3]);
+        float targetAcmr = (float)misses / (end - start) * threshold;
+
+        cache.Reset();
+        size_t clusterStart = start;
+        misses = 0;
+        for (size_t t = start; t < end; t++) {
+            misses += cache.Access(&indices[t * 3]);
+            if ((float)misses / (t + 1 - clusterStart) <= targetAcmr && t + 1 < end) {
+                clusters.push_back(clusterStart);
+                clusterStart = t + 1;
+                misses = 0;
+                cache.Reset();
+            }
+        }
+        clusters.push_back(clusterStart);
+    }
+    clusters.push_back(triangleCount);
+
+    // Area weighted centroid and normal of every cluster
+    const size_t clusterCount = clusters.size() - 1;
+    std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; c++) {
+        float clusterArea = 0.0f;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            const glm::vec3& p0 = vertices[indices[t * 3]].pos;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+            normals[c] += normal;
+            clusterArea += area;
+        }
+        meshCentroid += centroids[c];
+        meshArea += clusterArea;
+        centroids[c] = clusterArea > 0.0f ? centroids[c] / clusterArea : vertices[indices[clusters[c] * 3]].pos;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // The clusters facing away from the center are in front of the others
+    // from most points of view, they go first
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        float length = glm::length(normals[c]);
+        sortKeys[c] = length > 0.0f ? glm::dot(centroids[c] - meshCentroid, normals[c] / length) : 0.0f;
+    }
+    std::vector<uint32_t> order(clusterCount);
+    for (uint32_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+    for (uint32_t c : order)
+        output.insert(output.end(), &indices[clusters[c] * 3], &indices[clusters[c + 1] * 3]);
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> output;
+    output.reserve(vertices.size());
+    for (uint32_t& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = (uint32_t)output.size();
+            output.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(output);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct Vertex;
+struct MeshLod;
+
+// Post-transform vertex cache efficiency of an index list, simulated on a FIFO cache
+struct VertexCacheStats {
+	float acmr = 0.0f;  // Vertices transformed per triangle, 0.5 at best, 3 at worst
+	float atvr = 0.0f;  // Vertices transformed per vertex referenced, 1 at best
+};
+
+// Reorders the triangles and vertices of imported meshes for the GPU, without
+// changing what is drawn. Index ranges that are not triangle lists are left as
+// they are.
+class MeshOptimizer
+{
+public:
+	// Every level is reordered for the vertex cache and then for overdraw, then
+	// the vertices are sorted by first use. Unreferenced vertices are removed.
+	static void Optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const std::vector<MeshLod>& lods);
+
+	static VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	// Tom Forsyth's linear-speed vertex cache optimisation
+	static void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	// Splits cache optimized triangles in clusters and draws the outward facing
+	// ones first. threshold: ACMR allowed, relative to the input (1.05 = 5% worse)
+	static void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices, float threshold);
+
+	// Vertices in the order they are first referenced, so they are fetched sequentially
+	static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+};
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "MeshSimplifier.h"
+
+constexpr float LOD_REDUCTION = 0.5f;       // Target index count of a level, from the previous one
+constexpr float LOD_MIN_REDUCTION = 0.8f;   // A level keeping more than this is not worth it, the chain ends
+constexpr float LOD_MAX_ERROR = 0.05f;      // Of the whole chain, relative to the bounds diagonal
+constexpr size_t LOD_MIN_INDICES = 3 * 64;  // Smaller meshes get no levels
+
+// Attribute differences are added to squared relative position errors, so a
+// normal rotated ~10 degrees costs about as much as moving 1.7% of the diagonal
+constexpr float NORMAL_WEIGHT = 0.01f;
+constexpr float TEXCOORD_WEIGHT = 1.0f;
+constexpr float COLOR_WEIGHT = 0.01f;
+
+// Smallest cosine between the normals of a triangle before and after a collapse
+constexpr float MIN_NORMAL_COSINE = 0.25f;
+
+struct PositionKey {
+    uint32_t x, y, z;
+
+    bool operator==(const PositionKey& other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey& key) const {
+        return (size_t)key.x * 73856093u ^ (size_t)key.y * 19349663u ^ (size_t)key.z * 83492791u;
+    }
+};
+
+static PositionKey MakePositionKey(const glm::vec3& pos) {
+    // + 0.0f turns -0.0f into 0.0f, both must weld
+    float values[3] = { pos.x + 0.0f, pos.y + 0.0f, pos.z + 0.0f };
+    PositionKey key;
+    std::memcpy(&key, values, sizeof(key));
+    return key;
+}
+
+static uint64_t MakeEdgeKey(uint32_t a, uint32_t b) {
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+void MeshSimplifier::Quadric::AddPlane(const glm::dvec3& n, double d, double w) {
+    a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+    b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+    c2 += w * n.z * n.z; cd += w * n.z * d;
+    d2 += w * d * d;
+    weight += w;
+}
+
+void MeshSimplifier::Quadric::Add(const Quadric& o) {
+    a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad;
+    b2 += o.b2; bc += o.bc; bd += o.bd;
+    c2 += o.c2; cd += o.cd;
+    d2 += o.d2;
+    weight += o.weight;
+}
+
+double MeshSimplifier::Quadric::Evaluate(const glm::vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double result =
+        a2 * x * x + b2 * y * y + c2 * z * z +
+        2.0 * (ab * x * y + ac * x * z + bc * y * z) +
+        2.0 * (ad * x + bd * y + cd * z) +
+        d2;
+    // Mean squared distance to the planes, rounding can make it slightly negative
+    return weight > 0.0 ? std::max(result / weight, 0.0) : 0.0;
+}
+
+MeshSimplifier::MeshSimplifier(const std::vector<Vertex>& vertices) :
+    m_vertices(vertices),
+    m_weld(vertices.size()),
+    m_seam(vertices.size(), false),
+    m_extent(0.0f)
+{
+    if (vertices.empty())
+        return;
+
+    std::unordered_map<PositionKey, uint32_t, PositionKeyHash> firstVertex;
+    firstVertex.reserve(vertices.size());
+    glm::vec3 bboxMin = vertices[0].pos;
+    glm::vec3 bboxMax = vertices[0].pos;
+    for (uint32_t i = 0; i < vertices.size(); i++) {
+        auto inserted = firstVertex.emplace(MakePositionKey(vertices[i].pos), i);
+        m_weld[i] = inserted.first->second;
+        if (!inserted.second) {
+            m_seam[i] = true;
+            m_seam[inserted.first->second] = true;
+        }
+        bboxMin = glm::min(bboxMin, vertices[i].pos);
+        bboxMax = glm::max(bboxMax, vertices[i].pos);
+    }
+    m_extent = glm::length(bboxMax - bboxMin);
+}
+
+float MeshSimplifier::AttributeCost(uint32_t from, uint32_t to) const {
+    const Vertex& a = m_vertices[from];
+    const Vertex& b = m_vertices[to];
+    glm::vec3 normal = a.normal - b.normal;
+    glm::vec2 texCoord = a.texCoord - b.texCoord;
+    glm::vec3 color = a.color - b.color;
+    return NORMAL_WEIGHT * glm::dot(normal, normal) + TEXCOORD_WEIGHT * glm::dot(texCoord, texCoord) + COLOR_WEIGHT * glm::dot(color, color);
+}
+
+// True if moving 'from' onto 'to' turns the triangle over or collapses it to a sliver.
+// Triangles with both vertices disappear and are not checked.
+static bool FlipsTriangle(const std::vector<Vertex>& vertices, const uint32_t* triangle, uint32_t from, uint32_t to) {
+    if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+        return false;
+
+    glm::vec3 before[3], after[3];
+    for (int k = 0; k < 3; k++) {
+        before[k] = vertices[triangle[k]].pos;
+        after[k] = vertices[triangle[k] == from ? to : triangle[k]].pos;
+    }
+    glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+    glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+    return glm::dot(n0, n1) <= MIN_NORMAL_COSINE * glm::length(n0) * glm::length(n1);
+}
+
+// Vertices of the triangles of 'vertex', itself excluded
+static void GatherNeighbours(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& offsets, const std::vector<uint32_t>& adjacency,
+    uint32_t vertex, std::vector<uint32_t>& neighbours)
+{
+    neighbours.clear();
+    for (uint32_t i = offsets[vertex]; i < offsets[vertex + 1]; i++) {
+        const uint32_t* triangle = &indices[adjacency[i] * 3];
+        for (int k = 0; k < 3; k++) {
+            if (triangle[k] != vertex)
+                neighbours.push_back(triangle[k]);
+        }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+}
+
+std::vector<uint32_t> MeshSimplifier::Simplify(const std::vector<uint32_t>& input, size_t targetIndexCount, float targetError, float& resultError) {
+    std::vector<uint32_t> indices = input;
+    const uint32_t vertexCount = (uint32_t)m_vertices.size();
+    resultError = 0.0f;
+    if (m_extent <= 0.0f || indices.size() <= targetIndexCount)
+        return indices;
+
+    // Seams, and edges without exactly two triangles (borders, non manifold), stay in place
+    std::vector<bool> locked(m_seam);
+    std::unordered_map<uint64_t, uint32_t> edgeTriangles;
+    edgeTriangles.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        for (int k = 0; k < 3; k++)
+            edgeTriangles[MakeEdgeKey(m_weld[indices[i + k]], m_weld[indices[i + (k + 1) % 3]])]++;
+    }
+    for (const auto& [edge, count] : edgeTriangles) {
+        if (count != 2) {
+            locked[(uint32_t)(edge >> 32)] = true;
+            locked[(uint32_t)edge] = true;
+        }
+    }
+
+    // Planes of the triangles around every vertex, weighted by area
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        glm::dvec3 p0 = m_vertices[indices[i + 0]].pos;
+        glm::dvec3 p1 = m_vertices[indices[i + 1]].pos;
+        glm::dvec3 p2 = m_vertices[indices[i + 2]].pos;
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        if (length == 0.0)
+            continue;
+        normal /= length;
+        for (int k = 0; k < 3; k++)
+            quadrics[indices[i + k]].AddPlane(normal, -glm::dot(normal, p0), length * 0.5);
+    }
+
+    const float invExtent2 = 1.0f / (m_extent * m_extent);
+    const float maxCost = targetError * targetError;
+    float reachedCost = 0.0f;
+    size_t triangleCount = indices.size() / 3;
+
+    std::vector<uint32_t> offsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<bool> touched;
+    std::vector<uint32_t> fromNeighbours, toNeighbours;
+
+    // Every pass collapses the cheapest edges whose surroundings have not changed in it
+    while (triangleCount * 3 > targetIndexCount) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (uint32_t index : indices)
+            offsets[index + 1]++;
+        for (uint32_t i = 0; i < vertexCount; i++)
+            offsets[i + 1] += offsets[i];
+        adjacency.resize(indices.size());
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[cursor[indices[i]]++] = (uint32_t)(i / 3);
+
+        collapses.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t from = indices[i + k];
+                uint32_t to = indices[i + (k + 1) % 3];
+                if (locked[from])
+                    continue;
+                float cost = (float)quadrics[from].Evaluate(m_vertices[to].pos) * invExtent2 + AttributeCost(from, to);
+                if (cost <= maxCost)
+                    collapses.push_back({ from, to, cost });
+            }
+        }
+        if (collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        touched.assign(vertexCount, false);
+        size_t collapsed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (triangleCount * 3 <= targetIndexCount)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            bool flips = false;
+            uint32_t shared = 0;
+            for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1] && !flips; i++) {
+                const uint32_t* triangle = &indices[adjacency[i] * 3];
+                flips = FlipsTriangle(m_vertices, triangle, collapse.from, collapse.to);
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                    shared++;
+            }
+            if (flips)
+                continue;
+
+            // Only the vertices opposite to the edge may be common to both ends,
+            // otherwise the surface folds onto itself
+            GatherNeighbours(indices, offsets, adjacency, collapse.from, fromNeighbours);
+            GatherNeighbours(indices, offsets, adjacency, collapse.to, toNeighbours);
+            uint32_t common = 0;
+            for (uint32_t neighbour : fromNeighbours) {
+                if (neighbour != collapse.to && std::binary_search(toNeighbours.begin(), toNeighbours.end(), neighbour))
+                    common++;
+            }
+            if (common != shared)
+                continue;
+
+            for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1]; i++) {
+                uint32_t* triangle = &indices[adjacency[i] * 3];
+                bool degenerate = false;
+                for (int k = 0; k < 3; k++) {
+                    touched[triangle[k]] = true;
+                    degenerate |= triangle[k] == collapse.to;
+                    if (triangle[k] == collapse.from)
+                        triangle[k] = collapse.to;
+                }
+                if (degenerate)
+                    triangleCount--;
+            }
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            reachedCost = std::max(reachedCost, collapse.cost);
+            collapsed++;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a != b && b != c && c != a) {
+                indices[count++] = a;
+                indices[count++] = b;
+                indices[count++] = c;
+            }
+        }
+        indices.resize(count);
+
+        if (collapsed == 0)
+            break;
+    }
+
+    resultError = std::sqrt(reachedCost);
+    return indices;
+}
+
+std::vector<MeshLod> MeshSimplifier::BuildLods(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    std::vector<MeshLod> lods = { { 0, (uint32_t)indices.size(), 0.0f } };
+    // Not a triangle list, there is nothing to simplify
+    if (indices.size() < LOD_MIN_INDICES || indices.size() % 3 != 0)
+        return lods;
+
+    MeshSimplifier simplifier(vertices);
+    std::vector<uint32_t> previous = indices;
+    float error = 0.0f;
+    while (lods.size() < MAX_MESH_LODS && error < LOD_MAX_ERROR) {
+        size_t target = (size_t)(previous.size() * LOD_REDUCTION) / 3 * 3;
+        float lodError;
+        std::vector<uint32_t> lod = simplifier.Simplify(previous, target, LOD_MAX_ERROR - error, lodError);
+        if (lod.empty() || lod.size() > previous.size() * LOD_MIN_REDUCTION)
+            break;
+
+        // Each level is simplified from the previous one, its error adds up
+        error += lodError;
+        lods.push_back({ (uint32_t)indices.size(), (uint32_t)lod.size(), error });
+        indices.insert(indices.end(), lod.begin(), lod.end());
+        previous.swap(lod);
+    }
+    return lods;
+}
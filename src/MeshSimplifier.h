@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "Mesh.h"
+
+constexpr auto MAX_MESH_LODS = 5;   // Including the full resolution level
+
+// Reduces triangle lists over a fixed vertex buffer by quadric edge collapse.
+// A vertex is only moved onto one of its neighbours, so the simplified levels
+// reuse the vertices (and attributes) of the original mesh. Vertices on open
+// borders and on attribute seams (same position, different normal/uv/color)
+// never move, which keeps the silhouette of holes and the texture mapping.
+class MeshSimplifier
+{
+public:
+	explicit MeshSimplifier(const std::vector<Vertex>& vertices);
+
+	// Collapses edges until at most targetIndexCount indices are left or the
+	// next collapse would move the surface more than targetError, relative to
+	// the diagonal of the mesh bounds. resultError receives the largest error
+	// of the collapses done.
+	std::vector<uint32_t> Simplify(const std::vector<uint32_t>& indices, size_t targetIndexCount, float targetError, float& resultError);
+
+	// Appends the simplified levels to 'indices' and returns the range of every
+	// level, the full resolution one first. Errors are accumulated along the chain.
+	static std::vector<MeshLod> BuildLods(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+private:
+	// Plane distance quadric, in double precision to sum many large triangles
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		void AddPlane(const glm::dvec3& normal, double d, double weight);
+		void Add(const Quadric& other);
+		double Evaluate(const glm::vec3& p) const;
+	};
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		float cost;
+	};
+
+	const std::vector<Vertex>& m_vertices;
+	std::vector<uint32_t> m_weld;   // Smallest vertex index with the same position
+	std::vector<bool> m_seam;       // Shares its position with another vertex
+	float m_extent;                 // Diagonal of the bounds
+
+	// Relative to the position error, for the attributes lost when 'from' takes those of 'to'
+	float AttributeCost(uint32_t from, uint32_t to) const;
+};
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cmath>
+
+#include "MeshletBuilder.h"
+
+constexpr uint8_t NOT_IN_MESHLET = 0xff;
+constexpr float MESHLET_MIN_CONE_COSINE = 0.1f;     // Wider cones (~84 degrees from the axis) are almost never culled
+
+MeshletData MeshletBuilder::Build(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount) {
+    MeshletData data;
+    if (indexCount == 0 || indexCount % 3 != 0)
+        return data;
+
+    // Meshlet vertex of every mesh vertex in the open meshlet
+    std::vector<uint8_t> local(vertices.size(), NOT_IN_MESHLET);
+    Meshlet meshlet{};
+
+    auto finish = [&]() {
+        const uint32_t* meshletVertices = &data.vertices[meshlet.vertexOffset];
+        ComputeBounds(meshlet, vertices, indices, meshletVertices);
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+            local[meshletVertices[i]] = NOT_IN_MESHLET;
+        data.meshlets.push_back(meshlet);
+    };
+
+    for (size_t i = 0; i < indexCount; i += 3) {
+        const uint32_t* triangle = &indices[i];
+        uint32_t newVertices = 0;
+        for (int k = 0; k < 3; k++) {
+            if (local[triangle[k]] == NOT_IN_MESHLET)
+                newVertices++;
+        }
+        if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.indexCount / 3 == MESHLET_MAX_TRIANGLES) {
+            finish();
+            meshlet = Meshlet{};
+            meshlet.firstIndex = (uint32_t)i;
+            meshlet.vertexOffset = (uint32_t)data.vertices.size();
+        }
+
+        for (int k = 0; k < 3; k++) {
+            if (local[triangle[k]] == NOT_IN_MESHLET) {
+                local[triangle[k]] = (uint8_t)meshlet.vertexCount++;
+                data.vertices.push_back(triangle[k]);
+            }
+        }
+        data.triangles.push_back(local[triangle[0]] | (local[triangle[1]] << 8) | (local[triangle[2]] << 16));
+        meshlet.indexCount += 3;
+    }
+    finish();
+
+    return data;
+}
+
+void MeshletBuilder::ComputeBounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const uint32_t* indices, const uint32_t* meshletVertices) {
+    meshlet.bboxMin = vertices[meshletVertices[0]].pos;
+    meshlet.bboxMax = meshlet.bboxMin;
+    for (uint32_t i = 1; i < meshlet.vertexCount; i++) {
+        meshlet.bboxMin = glm::min(meshlet.bboxMin, vertices[meshletVertices[i]].pos);
+        meshlet.bboxMax = glm::max(meshlet.bboxMax, vertices[meshletVertices[i]].pos);
+    }
+
+    // Sphere around the center of the box, a bit looser than the smallest one
+    meshlet.center = (meshlet.bboxMin + meshlet.bboxMax) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        meshlet.radius = std::max(meshlet.radius, glm::length(vertices[meshletVertices[i]].pos - meshlet.center));
+
+    // Until proven otherwise the triangles face too many ways to be culled together
+    meshlet.coneApex = meshlet.center;
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = MESHLET_NO_CONE;
+
+    const uint32_t* triangles = &indices[meshlet.firstIndex];
+    const uint32_t triangleCount = meshlet.indexCount / 3;
+    std::vector<glm::vec3> normals(triangleCount, glm::vec3(0.0f));
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        const glm::vec3& p0 = vertices[triangles[t * 3]].pos;
+        glm::vec3 normal = glm::cross(vertices[triangles[t * 3 + 1]].pos - p0, vertices[triangles[t * 3 + 2]].pos - p0);
+        float length = glm::length(normal);
+        // Degenerate triangles are never drawn, any normal fits them
+        if (length > 0.0f) {
+            normals[t] = normal / length;
+            axis += normals[t];
+        }
+    }
+    float axisLength = glm::length(axis);
+    if (axisLength == 0.0f)
+        return;
+    axis /= axisLength;
+
+    float minCosine = 1.0f;
+    for (const glm::vec3& normal : normals) {
+        if (normal != glm::vec3(0.0f))
+            minCosine = std::min(minCosine, glm::dot(normal, axis));
+    }
+    if (minCosine <= MESHLET_MIN_CONE_COSINE)
+        return;
+
+    // Apex behind every triangle plane along the axis, so that an eye in front
+    // of any triangle is never inside the cone
+    float maxDistance = 0.0f;
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        if (normals[t] == glm::vec3(0.0f))
+            continue;
+        float distance = glm::dot(meshlet.center - vertices[triangles[t * 3]].pos, normals[t]) / glm::dot(axis, normals[t]);
+        maxDistance = std::max(maxDistance, distance);
+    }
+
+    meshlet.coneApex = meshlet.center - axis * maxDistance;
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1.0f - minCosine * minCosine);
+}
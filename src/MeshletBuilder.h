@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include "Mesh.h"
+
+// Splits a triangle list in meshlets of at most MESHLET_MAX_VERTICES vertices
+// and MESHLET_MAX_TRIANGLES triangles, with the bounds used to cull them.
+class MeshletBuilder
+{
+public:
+	// Triangles are taken in order, a meshlet is closed when the next triangle
+	// does not fit. The order should already be local, as the one of
+	// MeshOptimizer::OptimizeVertexCache, for the meshlets to be compact.
+	// Index counts that are not a multiple of 3 give no meshlets.
+	static MeshletData Build(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount);
+
+private:
+	// Box, sphere and normal cone of the triangles of the meshlet
+	static void ComputeBounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const uint32_t* indices, const uint32_t* meshletVertices);
+};
@@ -9,10 +9,16 @@
 
 #include <spdlog/spdlog.h>
 
+#include "FrustumCuller.h"
 #include "Mesh.h"
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "Texture.h"
+#include "DescriptorAllocator.h"
 #include "Device.h"
 #include "Material.h"
+#include "UploadBatch.h"
 #include "Vulkan.h"
 #include "Model.h"
 
@@ -40,11 +46,30 @@ Model::~Model() {
         delete m_textures[i];
 }
 
-void Model::Draw(glm::mat4 matrix)
+void Model::UpdateWorldMatrix(const glm::mat4& matrix)
 {
-    glm::mat4 newMatrix = matrix * Transform.GetMatrix();
+    const glm::mat4& local = Transform.GetMatrix();
+    if (Transform.GetVersion() == m_transformVersion && matrix == m_parentMatrix)
+        return;
+
+    m_parentMatrix = matrix;
+    m_transformVersion = Transform.GetVersion();
+    m_worldMatrix = matrix * local;
+    m_normalMatrix = glm::mat3x4(glm::transpose(glm::inverse(m_worldMatrix)));
+}
+
+void Model::Draw(const glm::mat4& matrix)
+{
+    UpdateWorldMatrix(matrix);
+    for (unsigned int i = 0; i < m_meshes.size(); i++)
+        m_meshes[i]->Draw(m_worldMatrix, m_normalMatrix);
+}
+
+void Model::Draw(const glm::mat4& matrix, FrustumCuller& culler)
+{
+    UpdateWorldMatrix(matrix);
     for (unsigned int i = 0; i < m_meshes.size(); i++)
-        m_meshes[i]->Draw(newMatrix);
+        culler.Add(m_meshes[i], &m_worldMatrix, &m_normalMatrix);
 }
 
 void Model::Load(const std::string& path) {
@@ -59,6 +84,7 @@ void Model::Load(const std::string& path) {
         aiProcess_JoinIdenticalVertices |
         aiProcess_GenSmoothNormals |
         aiProcess_Triangulate |
+        aiProcess_SortByPType |
         aiProcess_FlipUVs |
         aiProcess_ValidateDataStructure |
         aiProcess_GenBoundingBoxes |
@@ -97,10 +123,12 @@ void Model::Load(const std::string& path) {
         }
     }
 
-    VkDescriptorPool pool = Vulkan::GetDescriptorPool();
-    VkDescriptorSetLayout layout = Vulkan::GetMaterialLayout();
-    ProcessMaterials(scene, pool, layout);
-    ProcessNode(scene->mRootNode, scene);
+    // All textures and meshes go to the GPU in one submission (more only if the staging ring fills up)
+    UploadBatch batch(*Vulkan::GetDevice());
+    ProcessMaterials(scene, batch);
+    ProcessNode(scene->mRootNode, scene, batch);
+    batch.Flush();
+    spdlog::debug("Model uploaded in {} submissions", batch.GetSubmitCount());
 
     spdlog::info("Model \"{}\":\n\t{:<11} = {}\n\t{:<11} = {}\n\t{:<11} = {}\n\t{:<11} = {}",
         path, "[Meshes]", m_meshes.size(), "[Vertices]", m_numVertices, "[Indices]", m_numIndices, "[Triangles]", m_numIndices / 3);
@@ -108,17 +136,18 @@ void Model::Load(const std::string& path) {
     LogMetadata(scene);
     LogMeshes();
     LogMaterials();
+    Vulkan::GetDescriptorAllocator()->LogStats();
 }
 
-void Model::ProcessMaterials(const aiScene* scene, VkDescriptorPool pool, VkDescriptorSetLayout layout) {
+void Model::ProcessMaterials(const aiScene* scene, UploadBatch& batch) {
     for (unsigned int i = 0; i < scene->mNumMaterials; i++) {
-        Material* material = new Material(scene, scene->mMaterials[i], m_directory, m_textures);
+        Material* material = new Material(scene, scene->mMaterials[i], m_directory, m_textures, &batch);
 
         m_materials.push_back(material);
     }
 }
 
-void Model::ProcessNode(aiNode* node, const aiScene* scene)
+void Model::ProcessNode(aiNode* node, const aiScene* scene, UploadBatch& batch)
 {
     aiVector3D scale, rotation, position;
     aiMatrix4x4 m = node->mTransformation;
@@ -138,7 +167,12 @@ void Model::ProcessNode(aiNode* node, const aiScene* scene)
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
         aiMesh* assimpMesh = scene->mMeshes[node->mMeshes[i]];
-        Mesh* mesh = ProcessMesh(assimpMesh, scene);
+        // Lines and points are split off by aiProcess_SortByPType, only triangles are drawn
+        if (!(assimpMesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)) {
+            spdlog::debug("Skipping mesh \"{}\" without triangles", assimpMesh->mName.C_Str());
+            continue;
+        }
+        Mesh* mesh = ProcessMesh(assimpMesh, scene, batch);
         m_numVertices += mesh->GetNumVertices();
         m_numIndices += mesh->GetNumIndices();
         m_meshes.push_back(mesh);
@@ -146,11 +180,11 @@ void Model::ProcessNode(aiNode* node, const aiScene* scene)
     // then do the same for each of its children
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        ProcessNode(node->mChildren[i], scene);
+        ProcessNode(node->mChildren[i], scene, batch);
     }
 }
 
-Mesh *Model::ProcessMesh(aiMesh* mesh, const aiScene* scene)
+Mesh *Model::ProcessMesh(aiMesh* mesh, const aiScene* scene, UploadBatch& batch)
 {
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
@@ -198,6 +232,9 @@ Mesh *Model::ProcessMesh(aiMesh* mesh, const aiScene* scene)
     for (unsigned int i = 0; i < mesh->mNumFaces; i++)
     {
         aiFace face = mesh->mFaces[i];
+        // The LODs, the optimizer and the meshlets expect a triangle list
+        if (face.mNumIndices != 3)
+            continue;
         for (unsigned int j = 0; j < face.mNumIndices; j++)
             indices.push_back(face.mIndices[j]);
     }
@@ -215,7 +252,19 @@ Mesh *Model::ProcessMesh(aiMesh* mesh, const aiScene* scene)
     m_bboxMax.y = std::max(m_bboxMax.y, bboxMax.y);
     m_bboxMax.z = std::max(m_bboxMax.z, bboxMax.z);
 
-    return new Mesh(vertices, indices, material, bboxMin, bboxMax);
+    // Simplified levels go after the full resolution indices, over the same vertices
+    std::vector<MeshLod> lods = MeshSimplifier::BuildLods(vertices, indices);
+
+    // Same triangles and vertices, in the order the GPU draws them fastest
+    VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(indices.data(), lods[0].indexCount, vertices.size());
+    MeshOptimizer::Optimize(vertices, indices, lods);
+    VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(indices.data(), lods[0].indexCount, vertices.size());
+    m_cacheStats.push_back({ before, after });
+
+    // Clusters of the full resolution level, culled on their own on the GPU
+    MeshletData meshlets = MeshletBuilder::Build(vertices, indices.data(), lods[0].indexCount);
+
+    return new Mesh(vertices, indices, material, bboxMin, bboxMax, &batch, lods, meshlets);
 }
 
 void Model::LogMetadata(const aiScene* scene) const {
@@ -267,6 +316,18 @@ void Model::LogMeshes() const {
         fmt::format_to(std::back_inserter(out), "{:<10}bbox = min({:.3f}, {:.3f}, {:.3f}), max({:.3f}, {:.3f}, {:.3f})\n", " ",
             m_meshes[i]->GetBBoxMin().x, m_meshes[i]->GetBBoxMin().y, m_meshes[i]->GetBBoxMin().z,
             m_meshes[i]->GetBBoxMax().x, m_meshes[i]->GetBBoxMax().y, m_meshes[i]->GetBBoxMax().z);
+        if (i < m_cacheStats.size()) {
+            fmt::format_to(std::back_inserter(out), "{:<10}acmr = {:.3f} -> {:.3f}, atvr = {:.3f} -> {:.3f}\n", " ",
+                m_cacheStats[i].first.acmr, m_cacheStats[i].second.acmr, m_cacheStats[i].first.atvr, m_cacheStats[i].second.atvr);
+        }
+        if (!m_meshes[i]->GetMeshlets().empty()) {
+            fmt::format_to(std::back_inserter(out), "{:<10}meshlets = {}, tris/meshlet = {:.1f}\n", " ",
+                m_meshes[i]->GetMeshlets().size(), (float)m_meshes[i]->GetNumIndices() / 3 / m_meshes[i]->GetMeshlets().size());
+        }
+        for (size_t j = 1; j < m_meshes[i]->GetNumLods(); j++) {
+            const MeshLod& lod = m_meshes[i]->GetLod(j);
+            fmt::format_to(std::back_inserter(out), "{:<10}lod {}: tris = {}, error = {:.4f}\n", " ", j, lod.indexCount / 3, lod.error);
+        }
     }
     spdlog::debug("{:.{}}", out.data(), out.size());
 }
@@ -3,8 +3,10 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <utility>
 
 #include "Components.h"
+#include "MeshOptimizer.h"
 #include "Transform.h"
 
 struct aiNode;
@@ -13,8 +15,10 @@ struct aiMesh;
 struct aiMaterial;
 enum aiTextureType;
 class Device;
+class FrustumCuller;
 class Mesh;
 class Material;
+class UploadBatch;
 
 class Model: public Component
 {
@@ -23,7 +27,9 @@ public:
     Model(std::vector<Material*> materials, std::vector<Mesh*> meshes);
     Model(const std::string &path) { Load(path); }
     ~Model();
-    void Draw(glm::mat4 matrix);
+    void Draw(const glm::mat4& matrix);
+    // Adds the meshes to the culler, which draws the visible ones
+    void Draw(const glm::mat4& matrix, FrustumCuller& culler);
 
     static ComponentType GetTypeStatic() { return ComponentType::Model; }
     ComponentType GetType() { return GetTypeStatic(); }
@@ -38,17 +44,27 @@ protected:
     std::vector<Material *> m_materials;
     std::vector<Texture*> m_textures;
     std::vector<Mesh *> m_meshes;
+    std::vector<std::pair<VertexCacheStats, VertexCacheStats>> m_cacheStats;   // Before and after the MeshOptimizer, of the loaded meshes
     std::string m_directory;
     size_t m_numVertices = 0;
     size_t m_numIndices = 0;
     glm::vec3 m_bboxMin = glm::vec3(0);
     glm::vec3 m_bboxMax = glm::vec3(0);
 
+    // World and normal matrices shared by all the meshes, rebuilt when the
+    // parent matrix or the Transform change
+    glm::mat4 m_parentMatrix = glm::mat4(1.0f);
+    glm::mat4 m_worldMatrix = glm::mat4(1.0f);
+    glm::mat3x4 m_normalMatrix = glm::mat3x4(1.0f);
+    uint32_t m_transformVersion = 0;
+
+    void UpdateWorldMatrix(const glm::mat4& matrix);
+
 private:
     void Load(const std::string &path);
-    void ProcessMaterials(const aiScene* scene, VkDescriptorPool pool, VkDescriptorSetLayout layout);
-    void ProcessNode(aiNode* node, const aiScene* scene);
-    Mesh *ProcessMesh(aiMesh* mesh, const aiScene* scene);
+    void ProcessMaterials(const aiScene* scene, UploadBatch& batch);
+    void ProcessNode(aiNode* node, const aiScene* scene, UploadBatch& batch);
+    Mesh *ProcessMesh(aiMesh* mesh, const aiScene* scene, UploadBatch& batch);
     void LogMetadata(const aiScene* scene) const;
     void LogMeshes() const;
     void LogMaterials() const;
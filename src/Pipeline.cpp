@@ -22,8 +22,17 @@ Pipeline::Pipeline(
     m_pipeline(VK_NULL_HANDLE),
     m_msaa(VkSampleCountFlagBits::VK_SAMPLE_COUNT_1_BIT),
     m_pushConstantsSize(0),
+    m_pushConstantsStages(VK_SHADER_STAGE_VERTEX_BIT),
     m_polygonMode(VkPolygonMode::VK_POLYGON_MODE_FILL),
-    m_cullMode(VK_CULL_MODE_BACK_BIT)
+    m_cullMode(VK_CULL_MODE_BACK_BIT),
+    m_vertexInput(true),
+    m_packedVertices(false),
+    m_positionOnly(false),
+    m_meshShading(false),
+    m_alphaBlending(false),
+    m_depthWrite(true),
+    m_depthCompareOp(VK_COMPARE_OP_LESS),
+    m_colorWrite(true)
 {
     
 }
@@ -38,8 +47,17 @@ Pipeline::Pipeline(const Pipeline& other) :
     m_pipeline(VK_NULL_HANDLE),
     m_msaa(other.m_msaa),
     m_pushConstantsSize(other.m_pushConstantsSize),
+    m_pushConstantsStages(other.m_pushConstantsStages),
     m_polygonMode(other.m_polygonMode),
-    m_cullMode(other.m_cullMode)
+    m_cullMode(other.m_cullMode),
+    m_vertexInput(other.m_vertexInput),
+    m_packedVertices(other.m_packedVertices),
+    m_positionOnly(other.m_positionOnly),
+    m_meshShading(other.m_meshShading),
+    m_alphaBlending(other.m_alphaBlending),
+    m_depthWrite(other.m_depthWrite),
+    m_depthCompareOp(other.m_depthCompareOp),
+    m_colorWrite(other.m_colorWrite)
 {
 
 }
@@ -62,15 +80,23 @@ void Pipeline::Build()
 {
     Cleanup();
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    auto bindingDescription = m_packedVertices ? PackedVertex::getBindingDescription() : Vertex::getBindingDescription();
+    auto attributeDescriptions = m_packedVertices ? PackedVertex::getAttributeDescriptions() : Vertex::getAttributeDescriptions();
+    uint32_t attributeCount = static_cast<uint32_t>(attributeDescriptions.size());
+    if (m_positionOnly) {
+        bindingDescription = m_packedVertices ? PackedVertex::getPositionBindingDescription() : Vertex::getPositionBindingDescription();
+        attributeDescriptions[0] = m_packedVertices ? PackedVertex::getPositionAttributeDescription() : Vertex::getPositionAttributeDescription();
+        attributeCount = 1;
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    if (m_vertexInput) {
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.vertexAttributeDescriptionCount = attributeCount;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    }
 
     VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -119,10 +145,10 @@ void Pipeline::Build()
     multisampling.alphaToOneEnable = VK_FALSE; // Optional
 
     VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+    colorBlendAttachment.colorWriteMask = m_colorWrite ? VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT : 0;
+    colorBlendAttachment.blendEnable = m_alphaBlending ? VK_TRUE : VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = m_alphaBlending ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstColorBlendFactor = m_alphaBlending ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
     colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
     colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
     colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
@@ -153,13 +179,13 @@ void Pipeline::Build()
     VkPushConstantRange pushConstant;
     pushConstant.offset = 0; //this push constant range starts at the beginning
     pushConstant.size = m_pushConstantsSize; //this push constant range takes up the size of a MeshPushConstants struct
-    pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; //this push constant range is accessible only in the vertex shader
+    pushConstant.stageFlags = m_pushConstantsStages;
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = (uint32_t)m_descriptorSetLayouts.size();
     pipelineLayoutInfo.pSetLayouts = m_descriptorSetLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pushConstantRangeCount = m_pushConstantsSize > 0 ? 1 : 0;
     pipelineLayoutInfo.pPushConstantRanges = &pushConstant; // Optional
 
     if (m_device.CreatePipelineLayout(&pipelineLayoutInfo, &m_layout) != VK_SUCCESS) {
@@ -169,8 +195,8 @@ void Pipeline::Build()
     VkPipelineDepthStencilStateCreateInfo depthStencil{};
     depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthWriteEnable = m_depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = m_depthCompareOp;
     depthStencil.depthBoundsTestEnable = VK_FALSE;
     depthStencil.minDepthBounds = 0.0f; // Optional
     depthStencil.maxDepthBounds = 1.0f; // Optional
@@ -182,8 +208,8 @@ void Pipeline::Build()
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.stageCount = static_cast<uint32_t>(m_shader->GetStages().size());
     pipelineInfo.pStages = m_shader->GetStages().data();
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pVertexInputState = m_meshShading ? nullptr : &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = m_meshShading ? nullptr : &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
@@ -22,9 +22,22 @@ public:
 
     void SetShader(Shader* shader) { m_shader = shader; }
     void SetMSAA(VkSampleCountFlagBits msaa) { m_msaa = msaa; }
-    void SetPushConstantsSize(uint32_t size) { m_pushConstantsSize = size; }
+    void SetPushConstantsSize(uint32_t size, VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT) { m_pushConstantsSize = size; m_pushConstantsStages = stages; }
     void SetWireframeMode(bool wireframe) { m_polygonMode = wireframe ? VkPolygonMode::VK_POLYGON_MODE_LINE : VkPolygonMode::VK_POLYGON_MODE_FILL; }
     void SetCullMode(VkCullModeFlagBits cullMode) { m_cullMode = cullMode; }
+    // Without vertex input the vertex shader generates the vertices from gl_VertexIndex
+    void SetVertexInput(bool enabled) { m_vertexInput = enabled; }
+    // PackedVertex instead of Vertex
+    void SetPackedVertices(bool packed) { m_packedVertices = packed; }
+    // Only the position stream of the vertices, see Vertex::getPositionBindingDescription
+    void SetPositionOnly(bool enabled) { m_positionOnly = enabled; }
+    // The shader has task and mesh stages, there is no vertex input nor input assembly
+    void SetMeshShading(bool enabled) { m_meshShading = enabled; }
+    void SetAlphaBlending(bool enabled) { m_alphaBlending = enabled; }
+    void SetDepthWrite(bool enabled) { m_depthWrite = enabled; }
+    void SetDepthCompareOp(VkCompareOp op) { m_depthCompareOp = op; }
+    // Off for the depth only pipelines, which can have no fragment shader
+    void SetColorWrite(bool enabled) { m_colorWrite = enabled; }
 
     VkPipeline Get() { return m_pipeline; }
     VkPipelineLayout GetLayout() { return m_layout; }
@@ -41,6 +54,15 @@ private:
     std::vector<VkDescriptorSetLayout> m_descriptorSetLayouts;
     VkSampleCountFlagBits m_msaa;
     uint32_t m_pushConstantsSize;
+    VkShaderStageFlags m_pushConstantsStages;
     VkPolygonMode m_polygonMode;
     VkCullModeFlagBits m_cullMode;
+    bool m_vertexInput;
+    bool m_packedVertices;
+    bool m_positionOnly;
+    bool m_meshShading;
+    bool m_alphaBlending;
+    bool m_depthWrite;
+    VkCompareOp m_depthCompareOp;
+    bool m_colorWrite;
 };
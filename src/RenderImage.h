@@ -1,6 +1,8 @@
 #pragma once
 #include <vulkan/vulkan.h>
 
+#include "MemoryAllocator.h"
+
 class Device;
 
 class RenderImage
@@ -14,7 +16,7 @@ public:
 private:
 	Device& m_device;
 	VkImage m_image;
-	VkDeviceMemory m_memory;
+	MemoryAllocation m_memory;
 	VkImageView m_view;
 };
 
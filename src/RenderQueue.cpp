@@ -0,0 +1,29 @@
+#include <algorithm>
+#include <cstring>
+
+#include "RenderQueue.h"
+
+uint64_t RenderQueue::MakeKey(uint32_t pipeline, uint32_t material, uint32_t page, VkIndexType indexType, uint32_t mesh, float depth) {
+    // Positive floats keep their order when compared as integers, the upper
+    // 16 bits are enough to sort front to back
+    depth = std::max(depth, 0.0f);
+    uint32_t depthBits;
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    return ((uint64_t)(pipeline & 0xF) << 60) |
+        ((uint64_t)(material & 0xFFFF) << 44) |
+        ((uint64_t)(page & 0x3F) << 38) |
+        ((uint64_t)(indexType == VK_INDEX_TYPE_UINT16 ? 1 : 0) << 37) |
+        ((uint64_t)(mesh & 0x1FFFFF) << 16) |
+        (uint64_t)(depthBits >> 16);
+}
+
+const std::vector<const DrawPacket*>& RenderQueue::Sort() {
+    // Sorting pointers, packets are too big to move around
+    m_sorted.resize(m_packets.size());
+    for (size_t i = 0; i < m_packets.size(); i++)
+        m_sorted[i] = &m_packets[i];
+
+    std::sort(m_sorted.begin(), m_sorted.end(), [](const DrawPacket* a, const DrawPacket* b) { return a->key < b->key; });
+    return m_sorted;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "GeometryArena.h"
+
+struct Meshlet;
+
+// Everything needed to record one mesh draw
+struct DrawPacket {
+	uint64_t key;
+	glm::mat4 matrix;
+	glm::mat3x4 normalMatrix;
+	GeometryRange geometry;
+	VkDescriptorSet materialDescSet;
+	uint32_t materialIndex;
+	glm::vec3 bboxMin;          // Local space
+	glm::vec3 bboxMax;
+	const Meshlet* meshlets;    // Of the geometry range, culled one by one
+	uint32_t meshletCount;
+	VkDescriptorSet meshletSet; // Drawn with the mesh shading pipelines if not VK_NULL_HANDLE
+};
+
+// Draw calls of a frame, collected in scene order and replayed sorted by key
+// so that draws sharing state end up next to each other.
+class RenderQueue
+{
+public:
+	// Most significant first: pipeline (4 bits), material (16), geometry page (6),
+	// index type (1), mesh (21) and view depth (16), so equal meshes are drawn front to back.
+	static uint64_t MakeKey(uint32_t pipeline, uint32_t material, uint32_t page, VkIndexType indexType, uint32_t mesh, float depth);
+
+	void Push(const DrawPacket& packet) { m_packets.push_back(packet); }
+	void Clear() { m_packets.clear(); }
+	bool IsEmpty() const { return m_packets.empty(); }
+
+	// Packets in key order, valid until the next Push or Clear
+	const std::vector<const DrawPacket*>& Sort();
+
+private:
+	std::vector<DrawPacket> m_packets;
+	std::vector<const DrawPacket*> m_sorted;
+};
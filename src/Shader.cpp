@@ -13,17 +13,29 @@ Shader::Shader(Device& device, const std::string& vertexShaderFilename, const st
     m_stages = CreateStages(vertexShaderFilename, fragmentShaderFilename);
 }
 
+Shader::Shader(Device& device, const std::string& computeShaderFilename) :
+    m_device(device)
+{
+    m_stages = { CreateComputeStage(computeShaderFilename) };
+}
+
+Shader::Shader(Device& device, const std::string& taskShaderFilename, const std::string& meshShaderFilename, const std::string& fragmentShaderFilename) :
+    m_device(device)
+{
+    m_stages = CreateMeshStages(taskShaderFilename, meshShaderFilename, fragmentShaderFilename);
+}
+
 Shader::~Shader() {
+    m_device.DestroyShaderModule(m_meshShaderModule);
+    m_device.DestroyShaderModule(m_taskShaderModule);
+    m_device.DestroyShaderModule(m_compShaderModule);
     m_device.DestroyShaderModule(m_fragShaderModule);
     m_device.DestroyShaderModule(m_vertShaderModule);
 }
 
 std::vector<VkPipelineShaderStageCreateInfo> Shader::CreateStages(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename) {
     auto vertShaderCode = ReadFile(vertexShaderFilename);
-    auto fragShaderCode = ReadFile(fragmentShaderFilename);
-
     m_vertShaderModule = m_device.CreateShaderModule(vertShaderCode);
-    m_fragShaderModule = m_device.CreateShaderModule(fragShaderCode);
 
     VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -31,6 +43,12 @@ std::vector<VkPipelineShaderStageCreateInfo> Shader::CreateStages(const std::str
     vertShaderStageInfo.module = m_vertShaderModule;
     vertShaderStageInfo.pName = "main";
 
+    if (fragmentShaderFilename.empty())
+        return { vertShaderStageInfo };
+
+    auto fragShaderCode = ReadFile(fragmentShaderFilename);
+    m_fragShaderModule = m_device.CreateShaderModule(fragShaderCode);
+
     VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -40,6 +58,50 @@ std::vector<VkPipelineShaderStageCreateInfo> Shader::CreateStages(const std::str
     return { vertShaderStageInfo, fragShaderStageInfo };
 }
 
+VkPipelineShaderStageCreateInfo Shader::CreateComputeStage(const std::string& computeShaderFilename) {
+    auto compShaderCode = ReadFile(computeShaderFilename);
+
+    m_compShaderModule = m_device.CreateShaderModule(compShaderCode);
+
+    VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+    compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compShaderStageInfo.module = m_compShaderModule;
+    compShaderStageInfo.pName = "main";
+
+    return compShaderStageInfo;
+}
+
+std::vector<VkPipelineShaderStageCreateInfo> Shader::CreateMeshStages(const std::string& taskShaderFilename, const std::string& meshShaderFilename, const std::string& fragmentShaderFilename) {
+    auto taskShaderCode = ReadFile(taskShaderFilename);
+    auto meshShaderCode = ReadFile(meshShaderFilename);
+    auto fragShaderCode = ReadFile(fragmentShaderFilename);
+
+    m_taskShaderModule = m_device.CreateShaderModule(taskShaderCode);
+    m_meshShaderModule = m_device.CreateShaderModule(meshShaderCode);
+    m_fragShaderModule = m_device.CreateShaderModule(fragShaderCode);
+
+    VkPipelineShaderStageCreateInfo taskShaderStageInfo{};
+    taskShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    taskShaderStageInfo.stage = VK_SHADER_STAGE_TASK_BIT_EXT;
+    taskShaderStageInfo.module = m_taskShaderModule;
+    taskShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo meshShaderStageInfo{};
+    meshShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    meshShaderStageInfo.stage = VK_SHADER_STAGE_MESH_BIT_EXT;
+    meshShaderStageInfo.module = m_meshShaderModule;
+    meshShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStageInfo.module = m_fragShaderModule;
+    fragShaderStageInfo.pName = "main";
+
+    return { taskShaderStageInfo, meshShaderStageInfo, fragShaderStageInfo };
+}
+
 std::vector<char> Shader::ReadFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
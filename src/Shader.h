@@ -13,7 +13,12 @@ public:
 		All
 	};
 
+	// An empty fragmentShaderFilename leaves only the vertex stage, for depth only pipelines
 	Shader(Device& device, const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename);
+	// Compute shader, GetStages() has a single stage
+	Shader(Device& device, const std::string& computeShaderFilename);
+	// Task, mesh and fragment shaders (VK_EXT_mesh_shader)
+	Shader(Device& device, const std::string& taskShaderFilename, const std::string& meshShaderFilename, const std::string& fragmentShaderFilename);
 	~Shader();
 
 	std::vector<VkPipelineShaderStageCreateInfo>& GetStages() { return m_stages; }
@@ -21,10 +26,15 @@ public:
 private:
 	Device& m_device;
 	std::vector<VkPipelineShaderStageCreateInfo> m_stages;
-	VkShaderModule m_vertShaderModule;
-	VkShaderModule m_fragShaderModule;
+	VkShaderModule m_vertShaderModule = VK_NULL_HANDLE;
+	VkShaderModule m_fragShaderModule = VK_NULL_HANDLE;
+	VkShaderModule m_compShaderModule = VK_NULL_HANDLE;
+	VkShaderModule m_taskShaderModule = VK_NULL_HANDLE;
+	VkShaderModule m_meshShaderModule = VK_NULL_HANDLE;
 
 	std::vector<char> ReadFile(const std::string& filename);
 	std::vector<VkPipelineShaderStageCreateInfo> CreateStages(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename);
+	VkPipelineShaderStageCreateInfo CreateComputeStage(const std::string& computeShaderFilename);
+	std::vector<VkPipelineShaderStageCreateInfo> CreateMeshStages(const std::string& taskShaderFilename, const std::string& meshShaderFilename, const std::string& fragmentShaderFilename);
 };
 
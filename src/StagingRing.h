@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+
+#include "FreeList.h"
+
+// Position of the ring after a submission, returned by Commit(). Releasing it
+// gives back everything allocated up to that point.
+struct StagingMarker {
+	uint64_t end = 0;
+	uint64_t bytes = 0;
+};
+
+// Ring allocator over [0, size) for the upload staging buffer. Allocations are
+// released in submission order, so only the head and tail need tracking.
+class StagingRing
+{
+public:
+	StagingRing() = default;
+	StagingRing(uint64_t size) { Reset(size); }
+
+	void Reset(uint64_t size) {
+		m_size = size;
+		m_head = 0;
+		m_tail = 0;
+		m_used = 0;
+		m_pending = 0;
+	}
+
+	// Returns false when there is no contiguous space left. Never splits an allocation.
+	bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+		if (m_used == 0)
+			m_head = m_tail = 0;
+		else if (m_head == m_tail)
+			return false;
+
+		uint64_t aligned = FreeList::AlignUp(m_head, alignment);
+		uint64_t waste = aligned - m_head;
+		if (m_head >= m_tail) {
+			if (aligned + size > m_size) {
+				// Wrap around, the end of the ring is wasted until the tail passes it
+				if (size > m_tail)
+					return false;
+				waste = m_size - m_head;
+				aligned = 0;
+			}
+		}
+		else if (aligned + size > m_tail) {
+			return false;
+		}
+
+		m_head = aligned + size;
+		m_used += waste + size;
+		m_pending += waste + size;
+		offset = aligned;
+		return true;
+	}
+
+	StagingMarker Commit() {
+		StagingMarker marker = { m_head, m_pending };
+		m_pending = 0;
+		return marker;
+	}
+
+	// Markers must be released in the order they were committed. A marker with
+	// no bytes (e.g. the graphics queue acquire of a transfer queue upload) owns
+	// nothing, and its end may already be stale once the ring has emptied and
+	// restarted at 0, so it must not move the tail.
+	void Release(const StagingMarker& marker) {
+		if (marker.bytes == 0)
+			return;
+		m_tail = marker.end;
+		m_used -= marker.bytes;
+	}
+
+	uint64_t GetSize() const { return m_size; }
+	uint64_t GetUsed() const { return m_used; }
+
+private:
+	uint64_t m_size = 0;
+	uint64_t m_head = 0;
+	uint64_t m_tail = 0;
+	uint64_t m_used = 0;
+	uint64_t m_pending = 0;    // Allocated since the last Commit()
+};
@@ -6,11 +6,11 @@
 #include "Swapchain.h"
 #include "Window.h"
 
-Swapchain::Swapchain(Device& device, Window& window, bool vSync):
+Swapchain::Swapchain(Device& device, Window& window, bool vSync, uint32_t imageCount):
 m_device(device),
 m_vSync(vSync)
 {
-    m_swapchain = Create(m_device.GetPhysicalDevice(), window, vSync);
+    m_swapchain = Create(m_device.GetPhysicalDevice(), window, vSync, imageCount);
     CreateImageViews();
 }
 
@@ -28,7 +28,7 @@ bool Swapchain::IsVSyncEnabled() const {
     return m_vSync;
 }
 
-VkSwapchainKHR Swapchain::Create(VkPhysicalDevice physicalDevice, Window& window, bool vSync) {
+VkSwapchainKHR Swapchain::Create(VkPhysicalDevice physicalDevice, Window& window, bool vSync, uint32_t imageCount) {
     VkSurfaceKHR surface = window.GetVulkanSurface();
     SupportDetails swapChainSupport = QuerySupport(physicalDevice, surface);
 
@@ -36,7 +36,9 @@ VkSwapchainKHR Swapchain::Create(VkPhysicalDevice physicalDevice, Window& window
     VkPresentModeKHR presentMode = ChoosePresentMode(swapChainSupport.presentModes, vSync);
     VkExtent2D extent = ChooseExtent(swapChainSupport.capabilities, window);
 
-    uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    if (imageCount == 0)
+        imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
     if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
         imageCount = swapChainSupport.capabilities.maxImageCount;
     }
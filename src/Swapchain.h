@@ -16,7 +16,8 @@ public:
 	};
 
 public:
-	Swapchain(Device& device, Window& window, bool vSync);
+	// imageCount: requested minimum, clamped to the surface limits. 0 for one more than the surface minimum
+	Swapchain(Device& device, Window& window, bool vSync, uint32_t imageCount = 0);
 	~Swapchain();
 	
 	VkSwapchainKHR Get() const { return m_swapchain; };
@@ -24,6 +25,7 @@ public:
 	const VkFormat& GetImageFormat() const { return m_imageFormat; }
 	const VkExtent2D& GetExtent() const { return m_extent; }
 	const VkFramebuffer &GetFramebuffer(size_t index) { return m_framebuffers[index]; }
+	uint32_t GetImageCount() const { return (uint32_t)m_images.size(); }
 	bool IsVSyncEnabled() const;
 
 	VkResult AcquireNextImage(
@@ -46,7 +48,7 @@ private:
 	std::vector<VkFramebuffer> m_framebuffers;
 	bool m_vSync;
 
-	VkSwapchainKHR Create(VkPhysicalDevice physicalDevice, Window& window, bool vSync);
+	VkSwapchainKHR Create(VkPhysicalDevice physicalDevice, Window& window, bool vSync, uint32_t imageCount);
 	void CreateImageViews();
 	VkSurfaceFormatKHR ChooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes, bool vSync);
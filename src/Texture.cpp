@@ -10,6 +10,8 @@
 
 #include "Device.h"
 #include "Texture.h"
+#include "TextureTable.h"
+#include "UploadBatch.h"
 #include "Vulkan.h"
 
 Texture::Texture() :
@@ -24,9 +26,10 @@ Texture::Texture() :
     CreateImage();
     CreateImageView();
     CreateSampler();
+    AddToTextureTable();
 }
 
-Texture::Texture(const std::string& filename, bool mipmapping) :
+Texture::Texture(const std::string& filename, bool mipmapping, UploadBatch* batch) :
     m_filename(filename),
     m_width(0),
     m_height(0),
@@ -35,14 +38,15 @@ Texture::Texture(const std::string& filename, bool mipmapping) :
     m_createdFromFile(true),
     m_default(false)
 {
-    CreateImage(filename);
+    CreateImage(filename, batch);
     if (IsValid()) {
         CreateImageView();
         CreateSampler();
+        AddToTextureTable();
     }
 }
 
-Texture::Texture(const unsigned char* buffer, size_t size, const std::string& internalName, const std::string& format) :
+Texture::Texture(const unsigned char* buffer, size_t size, const std::string& internalName, const std::string& format, UploadBatch* batch) :
     m_filename(internalName),
     m_width(0),
     m_height(0),
@@ -51,14 +55,18 @@ Texture::Texture(const unsigned char* buffer, size_t size, const std::string& in
     m_createdFromFile(false),
     m_default(false)
 {
-    CreateImage(buffer, size);
+    CreateImage(buffer, size, batch);
     CreateImageView();
     CreateSampler();
+    AddToTextureTable();
 }
 
 Texture::~Texture() {
     if (IsValid()) {
         Device* device = Vulkan::GetDevice();
+        device->WaitUpload(m_upload);
+        if (Vulkan::GetTextureTable())
+            Vulkan::GetTextureTable()->Remove(m_tableIndex);
         device->DestroySampler(m_sampler);
         device->DestroyImageView(m_imageView);
         device->DestroyImage(m_image);
@@ -75,10 +83,10 @@ void Texture::CreateImage() {
 
     m_mipLevels = 1;
 
-    CreateImage(imageSize, pixels);
+    CreateImage(imageSize, pixels, nullptr);
 }
 
-void Texture::CreateImage(const std::string& filename) {
+void Texture::CreateImage(const std::string& filename, UploadBatch* batch) {
     stbi_uc* pixels = stbi_load(filename.c_str(), &m_width, &m_height, &m_channels, STBI_rgb_alpha);
 
     if (!pixels) {
@@ -92,12 +100,12 @@ void Texture::CreateImage(const std::string& filename) {
 
     m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
 
-    CreateImage(imageSize, pixels);
+    CreateImage(imageSize, pixels, batch);
 
     stbi_image_free(pixels);
 }
 
-void Texture::CreateImage(const unsigned char* buffer, size_t size) {
+void Texture::CreateImage(const unsigned char* buffer, size_t size, UploadBatch* batch) {
     stbi_uc* pixels = stbi_load_from_memory(buffer, size, &m_width, &m_height, &m_channels, STBI_rgb_alpha);
     VkDeviceSize imageSize = m_width * m_height * 4;
 
@@ -107,34 +115,26 @@ void Texture::CreateImage(const unsigned char* buffer, size_t size) {
 
     m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
 
-    CreateImage(imageSize, pixels);
+    CreateImage(imageSize, pixels, batch);
 
     stbi_image_free(pixels);
 }
 
-void Texture::CreateImage(VkDeviceSize imageSize, unsigned char *pixels) {
+void Texture::CreateImage(VkDeviceSize imageSize, unsigned char *pixels, UploadBatch* batch) {
     Device* device = Vulkan::GetDevice();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    device->CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    device->MapMemory(stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    device->UnmapMemory(stagingBufferMemory);
-
     device->CreateImage(m_width, m_height, m_mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_image, m_deviceMemory);
 
-    device->TransitionImageLayout(m_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels);
-    device->CopyBufferToImage(stagingBuffer, m_image, static_cast<uint32_t>(m_width), static_cast<uint32_t>(m_height));
-    GenerateMipmaps(m_image, VK_FORMAT_R8G8B8A8_SRGB, m_width, m_height, m_mipLevels);
-
-    device->DestroyBuffer(stagingBuffer);
-    device->FreeMemory(stagingBufferMemory);
+    auto recordMipmaps = [this](VkCommandBuffer commandBuffer) {
+        GenerateMipmaps(commandBuffer, m_image, VK_FORMAT_R8G8B8A8_SRGB, m_width, m_height, m_mipLevels);
+    };
+    if (batch)
+        batch->UploadImage(m_image, static_cast<uint32_t>(m_width), static_cast<uint32_t>(m_height), m_mipLevels, 4, pixels, recordMipmaps);
+    else
+        m_upload = device->UploadImage(m_image, static_cast<uint32_t>(m_width), static_cast<uint32_t>(m_height), m_mipLevels, 4, pixels, recordMipmaps);
 }
 
-void Texture::GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
+void Texture::GenerateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
     Device* device = Vulkan::GetDevice();
     // Check if image format supports linear blitting
     VkFormatProperties formatProperties;
@@ -144,8 +144,6 @@ void Texture::GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWi
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = device->BeginSingleTimeCommands();
-
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.image = image;
@@ -218,8 +216,6 @@ void Texture::GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWi
         0, nullptr,
         0, nullptr,
         1, &barrier);
-
-    device->EndSingleTimeCommands(commandBuffer);
 }
 
 void Texture::CreateImageView() {
@@ -265,3 +261,9 @@ VkDescriptorImageInfo Texture::GetDescriptorImageInfo() const {
 bool Texture::IsValid() const {
     return ((m_width > 0) && (m_height > 0) && (m_channels > 0));
 }
+
+void Texture::AddToTextureTable() {
+    TextureTable* table = Vulkan::GetTextureTable();
+    if (table)
+        m_tableIndex = table->Add(m_imageView, m_sampler);
+}
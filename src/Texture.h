@@ -3,14 +3,18 @@
 #include <string>
 #include <vulkan/vulkan.h>
 
-class Device;
+#include "Device.h"
+#include "MemoryAllocator.h"
+
+class UploadBatch;
 
 class Texture
 {
 public:
 	Texture();
-	Texture(const std::string &filename, bool mipmapping=true);
-	Texture(const unsigned char* buffer, size_t size, const std::string& internalName, const std::string& format);
+	// With a batch the image is usable once the batch has been submitted
+	Texture(const std::string &filename, bool mipmapping=true, UploadBatch* batch=nullptr);
+	Texture(const unsigned char* buffer, size_t size, const std::string& internalName, const std::string& format, UploadBatch* batch=nullptr);
 	~Texture();
 
 	VkDescriptorImageInfo GetDescriptorImageInfo() const;
@@ -22,6 +26,8 @@ public:
 	bool IsCreatedFromFile() const { return m_createdFromFile; };
 	const std::string& GetFormat() const { return m_format; }
 	bool IsValid() const;
+	// Index in the bindless TextureTable, 0 if there is no table
+	uint32_t GetTableIndex() const { return m_tableIndex; }
 
 private:
 	std::string m_filename;
@@ -34,16 +40,19 @@ private:
 	bool m_createdFromFile;
 	uint32_t m_mipLevels;
 	VkImage m_image;
-	VkDeviceMemory m_deviceMemory;
+	MemoryAllocation m_deviceMemory;
+	UploadToken m_upload = 0;
 	VkImageView m_imageView;
 	VkSampler m_sampler;
+	uint32_t m_tableIndex = 0;
 
 	void CreateImage();
-	void CreateImage(const std::string& filename);
-	void CreateImage(const unsigned char* buffer, size_t size);
-	void CreateImage(VkDeviceSize imageSize, unsigned char* pixels);
-	void GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+	void CreateImage(const std::string& filename, UploadBatch* batch);
+	void CreateImage(const unsigned char* buffer, size_t size, UploadBatch* batch);
+	void CreateImage(VkDeviceSize imageSize, unsigned char* pixels, UploadBatch* batch);
+	void GenerateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
 	void CreateImageView();
 	void CreateSampler();
+	void AddToTextureTable();
 };
 
@@ -0,0 +1,110 @@
+#include <array>
+#include <stdexcept>
+
+#include "Device.h"
+#include "TextureTable.h"
+
+TextureTable::TextureTable(Device& device, uint32_t capacity) :
+    m_device(device),
+    m_capacity(capacity)
+{
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = capacity;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = capacity;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // Unused slots are never read, free slots can be rewritten while in flight
+    VkDescriptorBindingFlagsEXT flags =
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+    std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags = { flags, flags };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    flagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+    flagsInfo.pBindingFlags = bindingFlags.data();
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (m_device.CreateDescriptorSetLayout(&layoutInfo, &m_layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture table layout!");
+    }
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0] = { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, capacity };
+    poolSizes[1] = { VK_DESCRIPTOR_TYPE_SAMPLER, capacity };
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+
+    if (m_device.CreateDescriptorPool(&poolInfo, &m_pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture table pool!");
+    }
+
+    m_set = m_device.AllocateDescriptorSet(m_pool, m_layout);
+}
+
+TextureTable::~TextureTable() {
+    m_device.DestroyDescriptorPool(m_pool);
+    m_device.DestroyDescriptorSetLayout(m_layout);
+}
+
+uint32_t TextureTable::Add(VkImageView imageView, VkSampler sampler) {
+    uint32_t index;
+    if (!m_freeIndices.empty()) {
+        index = m_freeIndices.back();
+        m_freeIndices.pop_back();
+    }
+    else {
+        if (m_count >= m_capacity) {
+            throw std::runtime_error("texture table is full!");
+        }
+        index = m_count++;
+    }
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = imageView;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    VkDescriptorImageInfo samplerInfo{};
+    samplerInfo.sampler = sampler;
+
+    std::array<VkWriteDescriptorSet, 2> descWrites{};
+    descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[0].dstSet = m_set;
+    descWrites[0].dstBinding = 0;
+    descWrites[0].dstArrayElement = index;
+    descWrites[0].descriptorCount = 1;
+    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    descWrites[0].pImageInfo = &imageInfo;
+    descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[1].dstSet = m_set;
+    descWrites[1].dstBinding = 1;
+    descWrites[1].dstArrayElement = index;
+    descWrites[1].descriptorCount = 1;
+    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    descWrites[1].pImageInfo = &samplerInfo;
+    m_device.UpdateDescriptorSets(static_cast<uint32_t>(descWrites.size()), descWrites.data());
+
+    return index;
+}
+
+void TextureTable::Remove(uint32_t index) {
+    // The slot keeps pointing to the destroyed view until reused, which is
+    // fine with partially bound descriptors as long as nothing samples it
+    m_freeIndices.push_back(index);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+class Device;
+
+// Bindless textures: one descriptor set with an array of sampled images and an
+// array of samplers (binding 0 and 1), both indexed by texture index. Needs
+// VK_EXT_descriptor_indexing. The set is update after bind, so textures can be
+// added while frames that don't use them are in flight.
+class TextureTable
+{
+public:
+	TextureTable(Device& device, uint32_t capacity);
+	~TextureTable();
+
+	TextureTable(const TextureTable&) = delete;
+	TextureTable& operator=(const TextureTable&) = delete;
+
+	uint32_t Add(VkImageView imageView, VkSampler sampler);
+	// The GPU must not be using the texture anymore
+	void Remove(uint32_t index);
+
+	VkDescriptorSetLayout GetLayout() const { return m_layout; }
+	VkDescriptorSet GetDescriptorSet() const { return m_set; }
+	uint32_t GetCount() const { return m_count - (uint32_t)m_freeIndices.size(); }
+	uint32_t GetCapacity() const { return m_capacity; }
+
+private:
+	Device& m_device;
+	uint32_t m_capacity;
+	uint32_t m_count = 0;               // Highest used index + 1
+	std::vector<uint32_t> m_freeIndices;
+	VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+	VkDescriptorPool m_pool = VK_NULL_HANDLE;
+	VkDescriptorSet m_set = VK_NULL_HANDLE;
+};
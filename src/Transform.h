@@ -22,14 +22,26 @@ struct Transform: Component
 	glm::vec3 Rotation = { 0.0f, 0.0f, 0.0f };
 	glm::vec3 Scale = { 1.0f, 1.0f, 1.0f };
 
-	glm::mat4 GetMatrix() const {
-		glm::vec3 translation = Translation;
-		translation.y *= -1.0f;
-		return glm::toMat4(glm::quat(Rotation))
-			* glm::translate(glm::mat4(1.0f), translation)
-			* glm::scale(glm::mat4(1.0f), Scale);
+	// Cached, only rebuilt when Translation, Rotation or Scale change
+	const glm::mat4& GetMatrix() const {
+		if (m_version == 0 || Translation != m_translation || Rotation != m_rotation || Scale != m_scale) {
+			m_translation = Translation;
+			m_rotation = Rotation;
+			m_scale = Scale;
+
+			glm::vec3 translation = Translation;
+			translation.y *= -1.0f;
+			m_matrix = glm::toMat4(glm::quat(Rotation))
+				* glm::translate(glm::mat4(1.0f), translation)
+				* glm::scale(glm::mat4(1.0f), Scale);
+			m_version++;
+		}
+		return m_matrix;
 	}
 
+	// Changes every time GetMatrix() rebuilds the matrix
+	uint32_t GetVersion() const { return m_version; }
+
 	static ComponentType GetTypeStatic() { return ComponentType::Transform; }
 	ComponentType GetType() { return GetTypeStatic(); }
 
@@ -44,4 +56,11 @@ struct Transform: Component
 		spdlog::debug("scale: {}, {}, {}", Scale.x, Scale.y, Scale.z);
 		spdlog::debug("");
 	}
+
+private:
+	mutable glm::mat4 m_matrix = glm::mat4(1.0f);
+	mutable glm::vec3 m_translation;
+	mutable glm::vec3 m_rotation;
+	mutable glm::vec3 m_scale;
+	mutable uint32_t m_version = 0;     // 0: not built yet
 };
\ No newline at end of file
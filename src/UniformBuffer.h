@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "Device.h"
+
+// Uniform buffer with one slot of type T per frame in flight (or any other
+// count), mapped once for its whole life. Slots are padded to
+// minUniformBufferOffsetAlignment, as UpdateUniformDescriptorSets expects.
+template<typename T>
+class UniformBuffer
+{
+public:
+	UniformBuffer(Device& device, uint32_t slotCount) :
+		m_device(device),
+		m_slotCount(slotCount)
+	{
+		m_slotSize = device.PadUniformBufferSize(sizeof(T));
+		// Not necessarily coherent, Flush() takes care of it
+		device.CreateBuffer(m_slotSize * slotCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, m_buffer, m_memory);
+	}
+
+	~UniformBuffer() {
+		m_device.DestroyBuffer(m_buffer);
+		m_device.FreeMemory(m_memory);
+	}
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	// Write only, the memory can be uncached. Flush after writing.
+	T* Get(uint32_t slot) { return (T*)((char*)m_memory.mapped + slot * m_slotSize); }
+	void Flush(uint32_t slot) { m_device.FlushMemory(m_memory, slot * m_slotSize, sizeof(T)); }
+	void Write(uint32_t slot, const T& data) {
+		*Get(slot) = data;
+		Flush(slot);
+	}
+
+	VkBuffer GetBuffer() const { return m_buffer; }
+	VkDeviceSize GetSlotSize() const { return m_slotSize; }
+	uint32_t GetSlotCount() const { return m_slotCount; }
+
+private:
+	Device& m_device;
+	uint32_t m_slotCount;
+	VkDeviceSize m_slotSize;
+	VkBuffer m_buffer;
+	MemoryAllocation m_memory;
+};
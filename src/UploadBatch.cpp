@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "UploadBatch.h"
+
+constexpr VkAccessFlags UPLOAD_READ_ACCESS = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+constexpr VkPipelineStageFlags UPLOAD_READ_STAGES = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+UploadBatch::UploadBatch(Device& device) :
+    m_device(device)
+{
+
+}
+
+UploadBatch::~UploadBatch() {
+    Submit();
+}
+
+VkCommandBuffer UploadBatch::GetCommandBuffer() {
+    if (m_commandBuffer == VK_NULL_HANDLE)
+        m_commandBuffer = m_device.BeginUploadCommands(m_device.m_transferCommandPool);
+    return m_commandBuffer;
+}
+
+VkDeviceSize UploadBatch::AllocateStaging(VkDeviceSize size, VkDeviceSize alignment) {
+    m_device.RetireUploads(false);
+
+    VkDeviceSize offset;
+    while (!m_device.m_stagingRing.Allocate(size, alignment, offset)) {
+        if (m_commandBuffer != VK_NULL_HANDLE)
+            Submit();
+        else if (!m_device.m_pendingUploads.empty())
+            m_device.RetireUploads(true);
+        else
+            throw std::runtime_error("staging allocation bigger than the ring!");
+    }
+    return offset;
+}
+
+void UploadBatch::UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    // Big uploads are split so they never need the whole ring
+    VkDeviceSize maxChunkSize = m_device.m_stagingRing.GetSize() / 4;
+
+    const char* src = (const char*)data;
+    while (size > 0) {
+        VkDeviceSize chunkSize = std::min(size, maxChunkSize);
+        VkDeviceSize stagingOffset = AllocateStaging(chunkSize, 4);
+        memcpy((char*)m_device.m_stagingMemory.mapped + stagingOffset, src, (size_t)chunkSize);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = stagingOffset;
+        copyRegion.dstOffset = dstOffset;
+        copyRegion.size = chunkSize;
+        vkCmdCopyBuffer(GetCommandBuffer(), m_device.m_stagingBuffer, dstBuffer, 1, &copyRegion);
+
+        // Meshes are usually packed one after another, one barrier covers them all
+        if (!m_bufferBarriers.empty() && m_bufferBarriers.back().buffer == dstBuffer &&
+            m_bufferBarriers.back().offset + m_bufferBarriers.back().size == dstOffset) {
+            m_bufferBarriers.back().size += chunkSize;
+        }
+        else {
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.buffer = dstBuffer;
+            barrier.offset = dstOffset;
+            barrier.size = chunkSize;
+            m_bufferBarriers.push_back(barrier);
+        }
+
+        src += chunkSize;
+        dstOffset += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+void UploadBatch::UploadImage(
+    VkImage image,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mipLevels,
+    uint32_t texelSize,
+    const void* pixels,
+    const std::function<void(VkCommandBuffer)>& recordGraphics)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // Chunks are made of whole rows
+    VkDeviceSize rowSize = (VkDeviceSize)width * texelSize;
+    uint32_t rowsPerChunk = (uint32_t)std::max<VkDeviceSize>(1, (m_device.m_stagingRing.GetSize() / 4) / rowSize);
+
+    const char* src = (const char*)pixels;
+    for (uint32_t row = 0; row < height; row += rowsPerChunk) {
+        uint32_t rows = std::min(rowsPerChunk, height - row);
+        VkDeviceSize chunkSize = rowSize * rows;
+        // bufferOffset must be a multiple of 4 and of the texel size
+        VkDeviceSize stagingOffset = AllocateStaging(chunkSize, std::max(4u, texelSize));
+        memcpy((char*)m_device.m_stagingMemory.mapped + stagingOffset, src, (size_t)chunkSize);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = stagingOffset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { 0, (int32_t)row, 0 };
+        region.imageExtent = { width, rows, 1 };
+
+        vkCmdCopyBufferToImage(GetCommandBuffer(), m_device.m_stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        src += chunkSize;
+    }
+
+    // The image stays in TRANSFER_DST_OPTIMAL until the graphics work runs
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    m_imageBarriers.push_back(barrier);
+    m_graphicsWork.push_back(recordGraphics);
+}
+
+UploadToken UploadBatch::Submit() {
+    if (m_commandBuffer == VK_NULL_HANDLE)
+        return m_lastToken;
+
+    UploadToken token = ++m_device.m_lastUpload;
+
+    if (!m_device.HasTransferQueue()) {
+        // Same queue, the graphics work goes in the same command buffer
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = UPLOAD_READ_ACCESS;
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, UPLOAD_READ_STAGES, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        for (auto& work : m_graphicsWork)
+            work(m_commandBuffer);
+
+        m_device.SubmitUploadCommands(m_device.m_graphicsQueue, m_device.m_transferCommandPool, m_commandBuffer, VK_NULL_HANDLE, false, token, true);
+    }
+    else if (m_bufferBarriers.empty() && m_imageBarriers.empty()) {
+        // Only the first rows of an image, the rest comes in the next submission
+        m_device.SubmitUploadCommands(m_device.m_transferQueue, m_device.m_transferCommandPool, m_commandBuffer, VK_NULL_HANDLE, false, token, true);
+    }
+    else {
+        // Release on the transfer queue...
+        for (VkBufferMemoryBarrier& barrier : m_bufferBarriers) {
+            barrier.srcQueueFamilyIndex = m_device.m_transferFamily;
+            barrier.dstQueueFamilyIndex = m_device.m_graphicsFamily;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+        }
+        for (VkImageMemoryBarrier& barrier : m_imageBarriers) {
+            barrier.srcQueueFamilyIndex = m_device.m_transferFamily;
+            barrier.dstQueueFamilyIndex = m_device.m_graphicsFamily;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+            0, nullptr,
+            (uint32_t)m_bufferBarriers.size(), m_bufferBarriers.data(),
+            (uint32_t)m_imageBarriers.size(), m_imageBarriers.data());
+        VkSemaphore semaphore = m_device.SubmitUploadCommands(m_device.m_transferQueue, m_device.m_transferCommandPool, m_commandBuffer, VK_NULL_HANDLE, true, token, false);
+
+        // ...and acquire on the graphics queue
+        for (VkBufferMemoryBarrier& barrier : m_bufferBarriers) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = UPLOAD_READ_ACCESS;
+        }
+        for (VkImageMemoryBarrier& barrier : m_imageBarriers) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        }
+        VkCommandBuffer graphicsBuffer = m_device.BeginUploadCommands(m_device.m_commandPool);
+        vkCmdPipelineBarrier(graphicsBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, UPLOAD_READ_STAGES, 0,
+            0, nullptr,
+            (uint32_t)m_bufferBarriers.size(), m_bufferBarriers.data(),
+            (uint32_t)m_imageBarriers.size(), m_imageBarriers.data());
+
+        for (auto& work : m_graphicsWork)
+            work(graphicsBuffer);
+
+        m_device.SubmitUploadCommands(m_device.m_graphicsQueue, m_device.m_commandPool, graphicsBuffer, semaphore, false, token, true);
+    }
+
+    m_commandBuffer = VK_NULL_HANDLE;
+    m_bufferBarriers.clear();
+    m_imageBarriers.clear();
+    m_graphicsWork.clear();
+    m_lastToken = token;
+    m_submitCount++;
+    return token;
+}
+
+void UploadBatch::Flush() {
+    m_device.WaitUpload(Submit());
+}
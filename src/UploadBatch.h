@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "Device.h"
+
+// Records many uploads into a single transfer command buffer (plus a graphics
+// one for ownership and mipmaps) so a whole model goes out in one submission.
+// The batch submits early on its own if the staging ring fills up.
+class UploadBatch
+{
+public:
+	UploadBatch(Device& device);
+	~UploadBatch();
+
+	void UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+	// Same contract as Device::UploadImage
+	void UploadImage(
+		VkImage image,
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevels,
+		uint32_t texelSize,
+		const void* pixels,
+		const std::function<void(VkCommandBuffer)>& recordGraphics);
+
+	// Submits everything recorded so far without waiting
+	UploadToken Submit();
+	// Submits and waits for the whole batch with a single fence wait
+	void Flush();
+
+	uint32_t GetSubmitCount() const { return m_submitCount; }
+
+private:
+	Device& m_device;
+	VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+	std::vector<VkBufferMemoryBarrier> m_bufferBarriers;
+	std::vector<VkImageMemoryBarrier> m_imageBarriers;
+	std::vector<std::function<void(VkCommandBuffer)>> m_graphicsWork;
+	UploadToken m_lastToken = 0;
+	uint32_t m_submitCount = 0;
+
+	VkCommandBuffer GetCommandBuffer();
+	VkDeviceSize AllocateStaging(VkDeviceSize size, VkDeviceSize alignment);
+};
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <stdexcept>
 
 #include <vulkan/vulkan.h>
@@ -7,12 +10,24 @@
 #include "backends/imgui_impl_vulkan.h"
 #include "backends/imgui_impl_glfw.h"
 
+#include "CullingPass.h"
+#include "DepthPyramid.h"
+#include "DescriptorAllocator.h"
 #include "Device.h"
+#include "GeometryArena.h"
+#include "IndirectBuffer.h"
+#include "InstanceBuffer.h"
+#include "JobSystem.h"
+#include "MaterialTable.h"
+#include "Mesh.h"
 #include "Pipeline.h"
 #include "RenderImage.h"
+#include "RenderQueue.h"
 #include "Shader.h"
 #include "Swapchain.h"
 #include "Texture.h"
+#include "TextureTable.h"
+#include "UniformBuffer.h"
 #include "ValidationLayers.h"
 #include "Window.h"
 
@@ -25,51 +40,162 @@ VkFormat FindDepthFormat();
 std::vector<VkDescriptorSetLayoutBinding> GetGlobalBindings();
 std::vector<VkDescriptorSetLayoutBinding> GetMaterialBindings();
 void CreateGraphicsPipeline();
+std::vector<VkDescriptorSetLayoutBinding> GetMeshletBindings();
 void CreateRenderImages();
 void CheckExtensions(const Window& window);
 void CreateCommandBuffers();
+void CreateRecordingContexts();
 void CreateSyncObjects();
+void CreateFrameResources();
+void DestroyFrameResources();
 void CleanupSwapChain();
+void FlushRenderQueue();
 void FramebufferResizeCallback(int width, int height);
 
+constexpr VkDeviceSize GEOMETRY_VERTEX_PAGE_SIZE = 64ull * 1024 * 1024;
+constexpr VkDeviceSize GEOMETRY_INDEX_PAGE_SIZE = 32ull * 1024 * 1024;
+constexpr uint32_t MATERIAL_TABLE_CAPACITY = 256;
+constexpr uint32_t DESCRIPTOR_SETS_PER_POOL = 64;
+constexpr uint32_t TEXTURE_TABLE_CAPACITY = 4096;
+constexpr uint32_t INSTANCE_BUFFER_CAPACITY = 1024;
+constexpr uint32_t MIN_DRAWS_PER_THREAD = 128;
+constexpr uint32_t MESHLET_TASK_GROUP_SIZE = 32;    // local_size_x of meshlet.task, meshlets per task workgroup
+constexpr uint32_t MESH_SHADING_KEY = 8;            // Added to the pipeline of the sort key, mesh shaded draws go last
+
 VkInstance g_instance;
 ValidationLayers g_validationLayers({ "VK_LAYER_KHRONOS_validation" });
 Device* g_device;
 Swapchain* g_swapchain;
-VkDescriptorPool g_descriptorPool;
+DescriptorAllocator* g_descriptors;
 VkDescriptorSetLayout g_globalLayout, g_materialLayout;
-VkBuffer g_globalBuffer;
-VkDeviceMemory g_globalMemory;
+UniformBuffer<GlobalUBO>* g_globalUniform;
+GlobalUBO g_globalData;
+std::vector<DescriptorAllocation> g_globalAllocations;
 std::vector<VkDescriptorSet> g_globalSet;
+MaterialTable* g_materialTable;
+InstanceBuffer* g_instances;
+uint32_t g_instanceCount;           // Instances written in the current frame
+uint32_t g_indirectCommandCount;    // Indirect commands written in the current frame
+uint32_t g_indirectBucketCount;     // Draw counts written in the current frame
+uint32_t g_cullObjectCount;         // CullingPass objects written in the current frame
+uint32_t g_defaultMaterial;
 RenderImage* g_color;
 RenderImage* g_depth;
 VkRenderPass g_renderPass;
+VkRenderPass g_earlyRenderPass;     // g_renderPass split around the occlusion culling
+VkRenderPass g_lateRenderPass;
 Pipeline* g_phongPipeline;
 Pipeline* g_unlitPipeline;
 Pipeline* g_selectedPipeline;
+uint32_t g_selectedPipelineId = 0;
 Shader* g_phongShader;
 Shader* g_unlitShader;
+// Same materials and outputs, with task and mesh shaders. Only with VK_EXT_mesh_shader
+VkDescriptorSetLayout g_meshletLayout = VK_NULL_HANDLE;
+Shader* g_phongMeshShader = nullptr;
+Shader* g_unlitMeshShader = nullptr;
+Pipeline* g_phongMeshPipeline = nullptr;
+Pipeline* g_unlitMeshPipeline = nullptr;
+Pipeline* g_selectedMeshPipeline = nullptr;
+bool g_meshShading = false;
+// Push constants of meshlet.task
+struct MeshletConstants {
+    uint32_t firstInstance;
+    uint32_t meshletCount;
+};
+// Depth prepass from the position streams, then the same shaders with an EQUAL depth test
+Shader* g_depthShader;
+Pipeline* g_depthPipeline;
+Pipeline* g_phongDepthEqualPipeline;
+Pipeline* g_unlitDepthEqualPipeline;
+Pipeline* g_selectedDepthEqualPipeline;
+bool g_depthPrepass = false;
+Shader* g_gridShader;
+Pipeline* g_gridPipeline;
+// Push constants of grid.frag
+struct GridConstants {
+    glm::vec4 minorColor;   // a: spacing
+    glm::vec4 majorColor;   // a: spacing
+    float fadeDistance;
+    float lineWidth;
+    uint32_t flags;         // 1: lines, 2: axes
+};
+GridSettings g_gridSettings;
+bool g_gridQueued = false;
 Texture* g_dummyTexture;
+TextureTable* g_textureTable = nullptr;
+GeometryArena* g_geometry;
+RenderQueue g_renderQueue;
+IndirectBuffer* g_indirect;
+bool g_indirectDraw = false;
+Shader* g_cullShader;
+CullingPass* g_culling;
+bool g_gpuCulling = false;
+bool g_renderPassBegun = false;
+Shader* g_hizDepthShader;
+Shader* g_hizReduceShader;
+DepthPyramid* g_depthPyramid;
+glm::mat4 g_pyramidViewproj{ 1.0f };    // The pyramid depth was rendered with
+bool g_occlusionCulling = false;
+bool g_clusterCulling = false;
+float g_lodThreshold = 1.0f;            // Pixels
+
+// A run of equal packets drawn as one instanced draw
+struct InstancedDraw {
+    const DrawPacket* packet;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+std::vector<InstancedDraw> g_instancedDraws;
+
+// A run of draws sharing page and material set, issued with one indirect call.
+// Its commands are written by the host or by the CullingPass.
+struct IndirectBucket {
+    const DrawPacket* packet;   // First draw, for the bindings
+    uint32_t drawCount;
+    uint32_t bucket;            // Entry of the count buffer
+    uint32_t firstCommand;
+};
+std::vector<IndirectBucket> g_indirectBuckets;
+
+// Command pool of a recording thread for one frame, reset when the frame begins
+struct RecordingContext {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;   // Secondary
+    uint32_t used = 0;
+};
+std::vector<std::vector<RecordingContext>> g_recording;    // [frame][thread]
+bool g_secondaryRecording = false;
+VkSubpassContents g_renderPassContents = VK_SUBPASS_CONTENTS_INLINE;
+
+RenderStats g_renderStats;
+RenderStats g_lastRenderStats;    // The UI is built before the queue is flushed
 
 std::vector<VkCommandBuffer> commandBuffers;
 std::vector<VkSemaphore> imageAvailableSemaphores;
 std::vector<VkSemaphore> renderFinishedSemaphores;
 std::vector<VkFence> inFlightFences;
 
-int g_guiMinImageCount = 2;
 VkDescriptorPool g_guiDescriptorPool = VK_NULL_HANDLE;
 
 uint32_t g_imageIndex;
 uint32_t currentFrame = 0;
+uint32_t g_framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+uint32_t g_swapchainImageCount = 0;     // Requested, 0 for the surface default
+bool g_frameConfigChanged = false;
 
 Window* g_window = nullptr;
 bool g_framebufferResized = false;
 bool g_vSyncChanged = false;
 bool g_vSync = true;
+bool g_packedVertices = false;
 
-void Vulkan::Init(Window &window, bool vSync) {
+void Vulkan::Init(Window &window, bool vSync, bool bindless, uint32_t framesInFlight, uint32_t swapchainImageCount, bool packedVertices) {
     g_window = &window;
     g_vSync = vSync;
+    g_packedVertices = packedVertices;
+    g_framesInFlight = framesInFlight == 0 ? DEFAULT_FRAMES_IN_FLIGHT : std::min(framesInFlight, (uint32_t)MAX_FRAMES_IN_FLIGHT);
+    g_swapchainImageCount = swapchainImageCount;
     CreateInstance(window);
     g_validationLayers.CreateDebugMessenger(g_instance);
 
@@ -77,38 +203,78 @@ void Vulkan::Init(Window &window, bool vSync) {
     if (window.GetVulkanSurface() == VK_NULL_HANDLE)
         throw std::runtime_error("failed to create window surface!");
 
-    g_device = new Device(g_instance, window, g_validationLayers);
-    g_swapchain = new Swapchain(*g_device, window, vSync);
+    g_device = new Device(g_instance, window, g_validationLayers, bindless);
+    g_swapchain = new Swapchain(*g_device, window, vSync, g_swapchainImageCount);
+    g_geometry = new GeometryArena(*g_device, GEOMETRY_VERTEX_PAGE_SIZE, GEOMETRY_INDEX_PAGE_SIZE);
 
     CreateRenderPass();
 
-    g_descriptorPool = g_device->CreateDescriptorPool();
+    // Descriptors per set, enough for any of the layouts
+    g_descriptors = new DescriptorAllocator(*g_device, {
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 }
+    }, DESCRIPTOR_SETS_PER_POOL);
 
     g_globalLayout = g_device->CreateDescriptorSetLayout(GetGlobalBindings());
-    size_t sizeUniform = g_device->PadUniformBufferSize(sizeof(GlobalUBO));
-    g_device->CreateBuffer(
-        sizeUniform * MAX_FRAMES_IN_FLIGHT,
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        g_globalBuffer,
-        g_globalMemory);
-    g_globalSet = g_device->AllocateDescriptorSets(g_descriptorPool, g_globalLayout, MAX_FRAMES_IN_FLIGHT);
-    g_device->UpdateUniformDescriptorSets(g_globalSet, 0, g_globalBuffer, sizeof(GlobalUBO));
-
     g_materialLayout = g_device->CreateDescriptorSetLayout(GetMaterialBindings());
+    if (g_device->HasMeshShader())
+        g_meshletLayout = g_device->CreateDescriptorSetLayout(GetMeshletBindings());
+    g_cullShader = new Shader(*g_device, "shaders/cull.comp.spv");
+    bool msaa = g_device->GetMSAASamples() != VK_SAMPLE_COUNT_1_BIT;
+    g_hizDepthShader = new Shader(*g_device, msaa ? "shaders/hiz_depth_msaa.comp.spv" : "shaders/hiz_depth.comp.spv");
+    g_hizReduceShader = new Shader(*g_device, "shaders/hiz_reduce.comp.spv");
+    g_depthPyramid = new DepthPyramid(*g_device, g_hizDepthShader, g_hizReduceShader);
+    g_gridShader = new Shader(*g_device, "shaders/grid.vert.spv", "shaders/grid.frag.spv");
+    g_depthShader = new Shader(*g_device, "shaders/depth.vert.spv", "");
+
+    CreateFrameResources();
+    g_materialTable = new MaterialTable(*g_device, g_globalSet, 1, MATERIAL_TABLE_CAPACITY);
+
+    // The PACKED vertex shader variants decode PackedVertex
+    const char* phongVert = g_packedVertices ? "shaders/phong_packed.vert.spv" : "shaders/phong.vert.spv";
+    const char* unlitVert = g_packedVertices ? "shaders/unlit_packed.vert.spv" : "shaders/unlit.vert.spv";
+    if (g_packedVertices)
+        spdlog::info("Packed vertices enabled ({} bytes per vertex)", sizeof(PackedVertex));
+
+    // Falls back to per material descriptor sets if descriptor indexing is not available
+    if (g_device->HasDescriptorIndexing()) {
+        g_textureTable = new TextureTable(*g_device, TEXTURE_TABLE_CAPACITY);
+        spdlog::info("Bindless textures enabled ({} slots)", TEXTURE_TABLE_CAPACITY);
+        g_phongShader = new Shader(*g_device, phongVert, "shaders/phong_bindless.frag.spv");
+        g_unlitShader = new Shader(*g_device, unlitVert, "shaders/unlit_bindless.frag.spv");
+    }
+    else {
+        g_phongShader = new Shader(*g_device, phongVert, "shaders/phong.frag.spv");
+        g_unlitShader = new Shader(*g_device, unlitVert, "shaders/unlit.frag.spv");
+    }
 
-    g_phongShader = new Shader(*g_device, "shaders/phong.vert.spv", "shaders/phong.frag.spv");
-    g_unlitShader = new Shader(*g_device, "shaders/unlit.vert.spv", "shaders/unlit.frag.spv");
+    if (g_device->HasMeshShader()) {
+        const char* meshletMesh = g_packedVertices ? "shaders/meshlet_packed.mesh.spv" : "shaders/meshlet.mesh.spv";
+        const char* phongFrag = g_textureTable ? "shaders/phong_bindless.frag.spv" : "shaders/phong.frag.spv";
+        const char* unlitFrag = g_textureTable ? "shaders/unlit_bindless.frag.spv" : "shaders/unlit.frag.spv";
+        g_phongMeshShader = new Shader(*g_device, "shaders/meshlet.task.spv", meshletMesh, phongFrag);
+        g_unlitMeshShader = new Shader(*g_device, "shaders/meshlet.task.spv", meshletMesh, unlitFrag);
+        spdlog::info("Mesh shaders supported");
+    }
 
     CreateGraphicsPipeline();
 
     CreateRenderImages();
     g_swapchain->CreateFramebuffers(*g_color, *g_depth, g_renderPass);
 
-    CreateCommandBuffers();
-    CreateSyncObjects();
-
     g_dummyTexture = new Texture();
 
+    // Used by meshes without material
+    MaterialData defaultMaterial{};
+    defaultMaterial.diffuse = glm::vec3(1.0f);
+    defaultMaterial.ambient = glm::vec3(0.1f);
+    defaultMaterial.shininess = 32.0f;
+    defaultMaterial.diffuseTexture = g_dummyTexture->GetTableIndex();
+    defaultMaterial.specularTexture = g_dummyTexture->GetTableIndex();
+    g_defaultMaterial = g_materialTable->Allocate();
+    g_materialTable->Set(g_defaultMaterial, defaultMaterial);
+
     g_window->EventSubscribe_OnFramebufferResize(&FramebufferResizeCallback);
 }
 
@@ -137,22 +303,32 @@ void CreateInstance(Window& window) {
     }
 }
 
-void CreateRenderPass() {
+// The early and late parts split the frame around the occlusion culling. They are
+// compatible with the whole one, so pipelines, framebuffers and secondary command
+// buffers are shared.
+enum class RenderPassPart {
+    Whole,
+    Early,      // Clears, keeps the color and leaves the depth ready to be sampled
+    Late        // Continues from the early one
+};
+
+static VkRenderPass CreateRenderPass(RenderPassPart part) {
     VkAttachmentDescription colorAttachment{};
     colorAttachment.format = g_swapchain->GetImageFormat();
     colorAttachment.samples = g_device->GetMSAASamples();
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.loadOp = part == RenderPassPart::Late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.initialLayout = part == RenderPassPart::Late ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentDescription colorAttachmentResolve{};
     colorAttachmentResolve.format = g_swapchain->GetImageFormat();
     colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    // Resolved again by the late part
+    colorAttachmentResolve.storeOp = part == RenderPassPart::Early ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -165,12 +341,12 @@ void CreateRenderPass() {
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = FindDepthFormat();
     depthAttachment.samples = g_device->GetMSAASamples();
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.loadOp = part == RenderPassPart::Late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = part == RenderPassPart::Early ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.initialLayout = part == RenderPassPart::Late ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = part == RenderPassPart::Early ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference depthAttachmentRef{};
     depthAttachmentRef.attachment = 1;
@@ -187,7 +363,8 @@ void CreateRenderPass() {
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDependency dependency{};
+    std::vector<VkSubpassDependency> dependencies(1);
+    VkSubpassDependency& dependency = dependencies[0];
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
     dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
@@ -195,6 +372,24 @@ void CreateRenderPass() {
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+    if (part == RenderPassPart::Late) {
+        // Loads what the early part wrote, after the pyramid was built from the depth
+        dependency.srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    }
+    else if (part == RenderPassPart::Early) {
+        // The depth is read by the pyramid build
+        VkSubpassDependency depthRead{};
+        depthRead.srcSubpass = 0;
+        depthRead.dstSubpass = VK_SUBPASS_EXTERNAL;
+        depthRead.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        depthRead.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        depthRead.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        depthRead.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies.push_back(depthRead);
+    }
+
     std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, colorAttachmentResolve };
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -202,12 +397,20 @@ void CreateRenderPass() {
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
 
-    if (g_device->CreateRenderPass(&renderPassInfo, &g_renderPass) != VK_SUCCESS) {
+    VkRenderPass renderPass;
+    if (g_device->CreateRenderPass(&renderPassInfo, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
+    return renderPass;
+}
+
+void CreateRenderPass() {
+    g_renderPass = CreateRenderPass(RenderPassPart::Whole);
+    g_earlyRenderPass = CreateRenderPass(RenderPassPart::Early);
+    g_lateRenderPass = CreateRenderPass(RenderPassPart::Late);
 }
 
 VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -230,38 +433,56 @@ VkFormat FindDepthFormat() {
     return FindSupportedFormat(
         { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
         VK_IMAGE_TILING_OPTIMAL,
-        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
     );
 }
 
 std::vector<VkDescriptorSetLayoutBinding> GetGlobalBindings() {
+    VkShaderStageFlags meshStages = g_device->HasMeshShader() ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT : 0;
     VkDescriptorSetLayoutBinding binding0{};
     binding0.binding = 0;
     binding0.descriptorCount = 1;
     binding0.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    binding0.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    binding0.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT | meshStages;
+    VkDescriptorSetLayoutBinding binding1{};
+    binding1.binding = 1;
+    binding1.descriptorCount = 1;
+    binding1.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding1.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    VkDescriptorSetLayoutBinding binding2{};
+    binding2.binding = 2;
+    binding2.descriptorCount = 1;
+    binding2.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding2.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT | meshStages;
 
-    return { binding0 };
+    return { binding0, binding1, binding2 };
 }
 
 std::vector<VkDescriptorSetLayoutBinding> GetMaterialBindings() {
     VkDescriptorSetLayoutBinding binding0{};
     binding0.binding = 0;
     binding0.descriptorCount = 1;
-    binding0.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    binding0.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    binding0.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding0.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     VkDescriptorSetLayoutBinding binding1{};
     binding1.binding = 1;
     binding1.descriptorCount = 1;
     binding1.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     binding1.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    VkDescriptorSetLayoutBinding binding2{};
-    binding2.binding = 2;
-    binding2.descriptorCount = 1;
-    binding2.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    binding2.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    return { binding0, binding1, binding2 };
+    return { binding0, binding1 };
+}
+
+// Buffers of a Mesh for the mesh shaders: meshlets, meshlet vertices, triangles and vertices
+std::vector<VkDescriptorSetLayoutBinding> GetMeshletBindings() {
+    std::vector<VkDescriptorSetLayoutBinding> bindings(4);
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].stageFlags = i == 0 ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT : VK_SHADER_STAGE_MESH_BIT_EXT;
+    }
+    return bindings;
 }
 
 void CreateGraphicsPipeline() {
@@ -269,9 +490,11 @@ void CreateGraphicsPipeline() {
         g_globalLayout,
         g_materialLayout
     };
-    g_phongPipeline = new Pipeline(*g_device, g_renderPass, g_swapchain, g_phongShader, { g_globalLayout, g_materialLayout });
+    // Bindless pipelines read the textures from the table instead of a per material set
+    VkDescriptorSetLayout textureLayout = g_textureTable ? g_textureTable->GetLayout() : g_materialLayout;
+    g_phongPipeline = new Pipeline(*g_device, g_renderPass, g_swapchain, g_phongShader, { g_globalLayout, textureLayout });
     g_phongPipeline->SetMSAA(g_device->GetMSAASamples());
-    g_phongPipeline->SetPushConstantsSize(sizeof(PushConstants));
+    g_phongPipeline->SetPackedVertices(g_packedVertices);
     g_phongPipeline->Build();
 
     g_unlitPipeline = new Pipeline(*g_phongPipeline);
@@ -279,12 +502,57 @@ void CreateGraphicsPipeline() {
     g_unlitPipeline->Build();
 
     g_selectedPipeline = g_phongPipeline;
+
+    if (g_device->HasMeshShader()) {
+        g_phongMeshPipeline = new Pipeline(*g_device, g_renderPass, g_swapchain, g_phongMeshShader, { g_globalLayout, textureLayout, g_meshletLayout });
+        g_phongMeshPipeline->SetMSAA(g_device->GetMSAASamples());
+        g_phongMeshPipeline->SetMeshShading(true);
+        g_phongMeshPipeline->SetPushConstantsSize(sizeof(MeshletConstants), VK_SHADER_STAGE_TASK_BIT_EXT);
+        g_phongMeshPipeline->Build();
+
+        g_unlitMeshPipeline = new Pipeline(*g_phongMeshPipeline);
+        g_unlitMeshPipeline->SetShader(g_unlitMeshShader);
+        g_unlitMeshPipeline->Build();
+    }
+    g_selectedMeshPipeline = g_phongMeshPipeline;
+
+    // No fragment shader, the depth of the position stream is all it writes
+    g_depthPipeline = new Pipeline(*g_device, g_renderPass, g_swapchain, g_depthShader, { g_globalLayout });
+    g_depthPipeline->SetMSAA(g_device->GetMSAASamples());
+    g_depthPipeline->SetPackedVertices(g_packedVertices);
+    g_depthPipeline->SetPositionOnly(true);
+    g_depthPipeline->SetColorWrite(false);
+    g_depthPipeline->Build();
+
+    // Only the nearest surface is left equal to the prepass depth, so only it is shaded
+    g_phongDepthEqualPipeline = new Pipeline(*g_phongPipeline);
+    g_phongDepthEqualPipeline->SetDepthCompareOp(VK_COMPARE_OP_EQUAL);
+    g_phongDepthEqualPipeline->SetDepthWrite(false);
+    g_phongDepthEqualPipeline->Build();
+
+    g_unlitDepthEqualPipeline = new Pipeline(*g_phongDepthEqualPipeline);
+    g_unlitDepthEqualPipeline->SetShader(g_unlitShader);
+    g_unlitDepthEqualPipeline->Build();
+
+    g_selectedDepthEqualPipeline = g_phongDepthEqualPipeline;
+
+    // Blended over the scene, without writing depth
+    g_gridPipeline = new Pipeline(*g_device, g_renderPass, g_swapchain, g_gridShader, { g_globalLayout });
+    g_gridPipeline->SetMSAA(g_device->GetMSAASamples());
+    g_gridPipeline->SetVertexInput(false);
+    g_gridPipeline->SetCullMode(VK_CULL_MODE_NONE);
+    g_gridPipeline->SetAlphaBlending(true);
+    g_gridPipeline->SetDepthWrite(false);
+    g_gridPipeline->SetPushConstantsSize(sizeof(GridConstants), VK_SHADER_STAGE_FRAGMENT_BIT);
+    g_gridPipeline->Build();
 }
 
 void CreateRenderImages() {
     VkExtent2D extent = g_swapchain->GetExtent();
-    g_color = new RenderImage(*g_device, g_swapchain->GetImageFormat(), extent, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
-    g_depth = new RenderImage(*g_device, FindDepthFormat(), extent, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+    // Not transient, both are kept between the early and late render passes
+    g_color = new RenderImage(*g_device, g_swapchain->GetImageFormat(), extent, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+    g_depth = new RenderImage(*g_device, FindDepthFormat(), extent, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+    g_depthPyramid->SetSource(g_depth->GetView(), extent, g_device->GetMSAASamples());
 }
 
 void CheckExtensions(const Window &window) {
@@ -312,7 +580,7 @@ void CheckExtensions(const Window &window) {
 }
 
 void CreateCommandBuffers() {
-    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    commandBuffers.resize(g_framesInFlight);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -325,10 +593,22 @@ void CreateCommandBuffers() {
     }
 }
 
+void CreateRecordingContexts() {
+    uint32_t threadCount = JobSystem::GetThreadCount();
+    uint32_t graphicsFamily = g_device->FindQueueFamilies().graphicsFamily.value();
+
+    g_recording.resize(g_framesInFlight);
+    for (std::vector<RecordingContext>& frame : g_recording) {
+        frame.resize(threadCount);
+        for (RecordingContext& context : frame)
+            context.pool = g_device->CreateCommandPool(graphicsFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    }
+}
+
 void CreateSyncObjects() {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    imageAvailableSemaphores.resize(g_framesInFlight);
+    renderFinishedSemaphores.resize(g_framesInFlight);
+    inFlightFences.resize(g_framesInFlight);
 
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -337,7 +617,7 @@ void CreateSyncObjects() {
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < g_framesInFlight; i++) {
         if (g_device->CreateSemaphore(&semaphoreInfo, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
             g_device->CreateSemaphore(&semaphoreInfo, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
             g_device->CreateFence(&fenceInfo, &inFlightFences[i]) != VK_SUCCESS) {
@@ -347,13 +627,157 @@ void CreateSyncObjects() {
     }
 }
 
+// Everything with one copy per frame in flight, except the MaterialTable that
+// keeps its entries across a change (see MaterialTable::SetSets)
+void CreateFrameResources() {
+    g_globalUniform = new UniformBuffer<GlobalUBO>(*g_device, g_framesInFlight);
+    for (uint32_t i = 0; i < g_framesInFlight; i++) {
+        g_globalAllocations.push_back(g_descriptors->Allocate(g_globalLayout));
+        g_globalSet.push_back(g_globalAllocations.back().set);
+    }
+    VkBuffer globalBuffer = g_globalUniform->GetBuffer();
+    g_device->UpdateUniformDescriptorSets(g_globalSet, 0, globalBuffer, sizeof(GlobalUBO));
+    g_instances = new InstanceBuffer(*g_device, g_globalSet, 2, INSTANCE_BUFFER_CAPACITY);
+    g_indirect = new IndirectBuffer(*g_device, g_framesInFlight, INSTANCE_BUFFER_CAPACITY);
+    g_culling = new CullingPass(*g_device, *g_descriptors, g_globalLayout, g_cullShader, g_framesInFlight, INSTANCE_BUFFER_CAPACITY);
+
+    CreateCommandBuffers();
+    CreateRecordingContexts();
+    CreateSyncObjects();
+    currentFrame = 0;
+}
+
+void DestroyFrameResources() {
+    delete g_culling;
+    delete g_indirect;
+    delete g_instances;
+    delete g_globalUniform;
+    for (DescriptorAllocation& allocation : g_globalAllocations)
+        g_descriptors->Free(allocation);
+    g_globalAllocations.clear();
+    g_globalSet.clear();
+
+    for (std::vector<RecordingContext>& frame : g_recording) {
+        for (RecordingContext& context : frame)
+            g_device->DestroyCommandPool(context.pool);
+    }
+    g_recording.clear();
+
+    g_device->FreeCommandBuffers(g_device->GetCommandPool(), (uint32_t)commandBuffers.size(), commandBuffers.data());
+    commandBuffers.clear();
+
+    for (size_t i = 0; i < inFlightFences.size(); i++) {
+        g_device->DestroySemaphore(renderFinishedSemaphores[i]);
+        g_device->DestroySemaphore(imageAvailableSemaphores[i]);
+        g_device->DestroyFence(inFlightFences[i]);
+    }
+    renderFinishedSemaphores.clear();
+    imageAvailableSemaphores.clear();
+    inFlightFences.clear();
+}
+
+bool Vulkan::UsesPackedVertices() {
+    return g_packedVertices;
+}
+
 void Vulkan::SetVSync(bool value) {
     g_vSyncChanged = true;
     g_vSync = value;
 }
 
+void Vulkan::SetFramesInFlight(uint32_t count) {
+    count = std::clamp(count, 1u, (uint32_t)MAX_FRAMES_IN_FLIGHT);
+    if (count != g_framesInFlight) {
+        g_framesInFlight = count;
+        g_frameConfigChanged = true;
+    }
+}
+
+uint32_t Vulkan::GetFramesInFlight() {
+    return g_framesInFlight;
+}
+
+void Vulkan::SetSwapchainImageCount(uint32_t count) {
+    if (count != g_swapchainImageCount) {
+        g_swapchainImageCount = count;
+        g_frameConfigChanged = true;
+    }
+}
+
+uint32_t Vulkan::GetSwapchainImageCount() {
+    return g_swapchain->GetImageCount();
+}
+
+bool Vulkan::SetIndirectDraw(bool value) {
+    // Instanced draws use firstInstance to find their instance data
+    g_indirectDraw = value && g_device->HasDrawIndirectFirstInstance();
+    return g_indirectDraw;
+}
+
+bool Vulkan::SetGpuCulling(bool value) {
+    // Culled draws are always indirect
+    g_gpuCulling = value && g_device->HasDrawIndirectFirstInstance();
+    return g_gpuCulling;
+}
+
+bool Vulkan::SetOcclusionCulling(bool value) {
+    // A pyramid left from before would only make the late phase draw more
+    if (value && !g_occlusionCulling)
+        g_depthPyramid->Invalidate();
+    g_occlusionCulling = value && g_device->HasDrawIndirectFirstInstance();
+    return g_occlusionCulling;
+}
+
+bool Vulkan::SetClusterCulling(bool value) {
+    g_clusterCulling = value && g_device->HasDrawIndirectFirstInstance();
+    return g_clusterCulling;
+}
+
+bool Vulkan::SetMeshShading(bool value) {
+    // Applied to the draws queued from now on
+    g_meshShading = value && g_device->HasMeshShader();
+    return g_meshShading;
+}
+
+void Vulkan::SetLodThreshold(float pixels) {
+    g_lodThreshold = std::max(pixels, 0.0f);
+}
+
+float Vulkan::GetLodThreshold() {
+    return g_lodThreshold;
+}
+
+float Vulkan::GetProjectedSize(const glm::mat4& matrix, const glm::vec3& bboxMin, const glm::vec3& bboxMax) {
+    // Bounding sphere of the box, scaled by the largest axis scale of the matrix
+    float scale2 = std::max({ glm::dot(glm::vec3(matrix[0]), glm::vec3(matrix[0])),
+        glm::dot(glm::vec3(matrix[1]), glm::vec3(matrix[1])), glm::dot(glm::vec3(matrix[2]), glm::vec3(matrix[2])) });
+    float diameter = glm::length(bboxMax - bboxMin) * std::sqrt(scale2);
+    glm::vec4 viewCenter = g_globalData.view * matrix * glm::vec4((bboxMin + bboxMax) * 0.5f, 1.0f);
+    float distance = -viewCenter.z - diameter * 0.5f;
+    if (distance <= 0.0f)
+        return std::numeric_limits<float>::max();
+
+    return diameter / distance * std::abs(g_globalData.proj[1][1]) * 0.5f * g_swapchain->GetExtent().height;
+}
+
+void Vulkan::SetSecondaryRecording(bool value) {
+    // Applied when the next render pass begins
+    g_secondaryRecording = value;
+}
+
+void Vulkan::SetDepthPrepass(bool value) {
+    g_depthPrepass = value;
+}
+
+uint32_t Vulkan::GetRecordingThreadCount() {
+    return (uint32_t)g_recording[0].size();
+}
+
 void Vulkan::SetPipeline(int id) {
     g_selectedPipeline = id == 0 ? g_phongPipeline : g_unlitPipeline;
+    g_selectedMeshPipeline = id == 0 ? g_phongMeshPipeline : g_unlitMeshPipeline;
+    g_selectedDepthEqualPipeline = id == 0 ? g_phongDepthEqualPipeline : g_unlitDepthEqualPipeline;
+    g_selectedPipelineId = id;
 }
 
 void RecreateSwapChain() {
@@ -368,15 +792,29 @@ void RecreateSwapChain() {
 
     CleanupSwapChain();
 
-    g_swapchain = new Swapchain(*g_device, *g_window, g_vSync);
+    // Frames in flight are recreated even if only the image count changed, it is cheap
+    if (g_frameConfigChanged) {
+        DestroyFrameResources();
+        CreateFrameResources();
+        g_materialTable->SetSets(g_globalSet);
+    }
+
+    g_swapchain = new Swapchain(*g_device, *g_window, g_vSync, g_swapchainImageCount);
 
     CreateRenderPass();
     CreateGraphicsPipeline();
     CreateRenderImages();
     g_swapchain->CreateFramebuffers(*g_color, *g_depth, g_renderPass);
 
+    if (g_frameConfigChanged) {
+        if (g_guiDescriptorPool != VK_NULL_HANDLE)
+            ImGui_ImplVulkan_SetMinImageCount(std::max(g_swapchain->GetImageCount(), 2u));
+        spdlog::info("{} frames in flight, {} swapchain images", g_framesInFlight, g_swapchain->GetImageCount());
+    }
+
     g_framebufferResized = false;
     g_vSyncChanged = false;
+    g_frameConfigChanged = false;
 }
 
 void FramebufferResizeCallback(int width, int height) {
@@ -391,6 +829,15 @@ Device* Vulkan::GetDevice() {
     return g_device;
 }
 
+GeometryArena* Vulkan::GetGeometryArena() {
+    return g_geometry;
+}
+
+void Vulkan::CompactGeometry() {
+    g_device->WaitIdle();
+    g_geometry->Compact();
+}
+
 void Vulkan::BeginDrawing() {
     g_device->WaitForFences(1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
@@ -407,6 +854,9 @@ void Vulkan::BeginDrawing() {
     // Only reset the fence if we are submitting work
     g_device->ResetFences(1, &inFlightFences[currentFrame]);
 
+    // The GPU is done with this frame's copy of the material table
+    g_materialTable->Update(currentFrame);
+
     VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
     vkResetCommandBuffer(commandBuffer, 0);
 
@@ -419,51 +869,623 @@ void Vulkan::BeginDrawing() {
         throw std::runtime_error("failed to begin recording command buffer!");
     }
 
+    // Begun by the first flush, the culling dispatch must go before it
+    g_renderPassBegun = false;
+
+    // The secondary command buffers of the frame have finished too
+    for (RecordingContext& context : g_recording[currentFrame]) {
+        g_device->ResetCommandPool(context.pool);
+        context.used = 0;
+    }
+
+    g_renderQueue.Clear();
+    g_gridQueued = false;
+    g_instanceCount = 0;
+    g_indirectCommandCount = 0;
+    g_indirectBucketCount = 0;
+    g_cullObjectCount = 0;
+    g_lastRenderStats = g_renderStats;
+    g_renderStats = RenderStats();
+
+    OcclusionStats occlusion = g_culling->ReadStats(currentFrame);
+    g_renderStats.frustumCulled = occlusion.frustumCulled;
+    g_renderStats.backfacing = occlusion.backfacing;
+    g_renderStats.occluded = occlusion.occluded - occlusion.disoccluded;
+    g_renderStats.disoccluded = occlusion.disoccluded;
+}
+
+static void CmdBeginRenderPass(VkRenderPass renderPass) {
+    VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+
     std::array<VkClearValue, 2> clearValues{};
     clearValues[0].color = { {0.01f, 0.01f, 0.01f, 1.0f} };
     clearValues[1].depthStencil = { 1.0f, 0 };
 
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = g_renderPass;
+    renderPassInfo.renderPass = renderPass;
     renderPassInfo.framebuffer = g_swapchain->GetFramebuffer(g_imageIndex);
     renderPassInfo.renderArea.offset = { 0, 0 };
     renderPassInfo.renderArea.extent = g_swapchain->GetExtent();
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // Everything inside the render pass goes in secondary command buffers, or nothing does
+    g_renderPassContents = g_secondaryRecording ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, g_renderPassContents);
+}
+
+static void BeginRenderPass() {
+    if (g_renderPassBegun)
+        return;
+
+    CmdBeginRenderPass(g_renderPass);
+    g_renderPassBegun = true;
+}
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_selectedPipeline->Get());
+void Vulkan::Draw(const glm::mat4& matrix, const glm::mat3x4& normalMatrix, uint32_t geometry, uint32_t firstIndex, uint32_t indexCount, const glm::vec3& bboxMin, const glm::vec3& bboxMax, VkDescriptorSet materialDescSet, uint32_t materialIndex,
+                  const Meshlet* meshlets, uint32_t meshletCount, VkDescriptorSet meshletSet) {
+    DrawPacket packet;
+    packet.matrix = matrix;
+    packet.normalMatrix = normalMatrix;
+    packet.geometry = g_geometry->GetRange(geometry);
+    packet.geometry.firstIndex += firstIndex;
+    packet.geometry.indexCount = indexCount;
+    packet.materialDescSet = materialDescSet;
+    packet.materialIndex = materialIndex;
+    packet.bboxMin = bboxMin;
+    packet.bboxMax = bboxMax;
+    packet.meshlets = meshlets;
+    packet.meshletCount = meshletCount;
+    packet.meshletSet = g_meshShading && meshletCount > 0 ? meshletSet : VK_NULL_HANDLE;
+
+    glm::vec4 viewCenter = g_globalData.view * matrix * glm::vec4((bboxMin + bboxMax) * 0.5f, 1.0f);
+    uint32_t pipeline = packet.meshletSet != VK_NULL_HANDLE ? g_selectedPipelineId + MESH_SHADING_KEY : g_selectedPipelineId;
+    packet.key = RenderQueue::MakeKey(pipeline, materialIndex, packet.geometry.page, packet.geometry.indexType, geometry, -viewCenter.z);
+
+    g_renderQueue.Push(packet);
+    g_renderStats.triangles += indexCount / 3;
 }
 
-void Vulkan::Draw(glm::mat4 matrix, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, VkDescriptorSet materialDescSet) {
-    
+// Binds the buffers of a geometry page / a material set if they are not bound yet.
+// The index buffer of a page is bound again when the index type changes.
+static void BindGeometryPage(VkCommandBuffer commandBuffer, const GeometryRange& geometry, uint32_t& boundPage, VkIndexType& boundIndexType, RenderStats& stats) {
+    if (geometry.page == boundPage && geometry.indexType == boundIndexType)
+        return;
+
+    if (geometry.page != boundPage) {
+        VkBuffer vertexBuffers[] = { g_geometry->GetVertexBuffer(geometry.page) };
+        VkDeviceSize offsets[] = { 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    }
+    vkCmdBindIndexBuffer(commandBuffer, g_geometry->GetIndexBuffer(geometry.page), 0, geometry.indexType);
+    boundPage = geometry.page;
+    boundIndexType = geometry.indexType;
+    stats.bufferBinds++;
+}
+
+static void BindMaterialSet(VkCommandBuffer commandBuffer, VkPipelineLayout layout, VkDescriptorSet materialDescSet, VkDescriptorSet& boundSet, RenderStats& stats) {
+    if (g_textureTable || materialDescSet == VK_NULL_HANDLE || materialDescSet == boundSet)
+        return;
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &materialDescSet, 0, nullptr);
+    boundSet = materialDescSet;
+    stats.descriptorSetBinds++;
+}
+
+// Packets drawn with the same bindings, in bindless mode the material set does not matter
+static bool SameBucket(const DrawPacket* a, const DrawPacket* b) {
+    return a->geometry.page == b->geometry.page && a->geometry.indexType == b->geometry.indexType &&
+        (g_textureTable || a->materialDescSet == b->materialDescSet);
+}
+
+// Issues 'count' indirect commands from 'firstCommand'. With VK_KHR_draw_indirect_count
+// the number of draws is read from counts[bucket], 'count' is the maximum.
+static void DrawIndirect(VkCommandBuffer commandBuffer, uint32_t firstCommand, uint32_t bucket, uint32_t count, RenderStats& stats) {
+    VkBuffer indirectBuffer = g_indirect->GetCommandBuffer(currentFrame);
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize offset = (VkDeviceSize)firstCommand * stride;
+
+    if (g_device->HasDrawIndirectCount()) {
+        g_device->CmdDrawIndexedIndirectCount(commandBuffer, indirectBuffer, offset, g_indirect->GetCountBuffer(currentFrame), bucket * sizeof(uint32_t), count, stride);
+        stats.draws++;
+    }
+    else if (g_device->HasMultiDrawIndirect()) {
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, offset, count, stride);
+        stats.draws++;
+    }
+    else {
+        for (uint32_t i = 0; i < count; i++)
+            vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, offset + i * stride, 1, stride);
+        stats.draws += count;
+    }
+}
+
+// Instanced draws are written to the indirect buffer, to be issued with one
+// indirect call per bucket of draws sharing page and material set
+static void PrepareIndirectDraws() {
+    uint32_t drawCount = (uint32_t)g_instancedDraws.size();
+    uint32_t firstCommand = g_indirectCommandCount;
+    uint32_t firstBucket = g_indirectBucketCount;
+    VkDrawIndexedIndirectCommand* commands = g_indirect->MapCommands(currentFrame, firstCommand + drawCount);
+    uint32_t* counts = g_indirect->MapCounts(currentFrame, firstBucket + drawCount);
+
+    for (uint32_t i = 0; i < drawCount; i++) {
+        const InstancedDraw& draw = g_instancedDraws[i];
+        VkDrawIndexedIndirectCommand& command = commands[firstCommand + i];
+        command.indexCount = draw.packet->geometry.indexCount;
+        command.instanceCount = draw.instanceCount;
+        command.firstIndex = draw.packet->geometry.firstIndex;
+        command.vertexOffset = draw.packet->geometry.vertexOffset;
+        command.firstInstance = draw.firstInstance;
+    }
+
+    g_indirectBuckets.clear();
+    uint32_t first = 0;
+    while (first < drawCount) {
+        const DrawPacket* packet = g_instancedDraws[first].packet;
+        uint32_t end = first + 1;
+        while (end < drawCount && SameBucket(g_instancedDraws[end].packet, packet))
+            end++;
+
+        IndirectBucket bucket{ packet, end - first, firstBucket + (uint32_t)g_indirectBuckets.size(), firstCommand + first };
+        counts[bucket.bucket] = bucket.drawCount;
+        g_indirectBuckets.push_back(bucket);
+        first = end;
+    }
+
+    g_indirectCommandCount += drawCount;
+    g_indirectBucketCount += (uint32_t)g_indirectBuckets.size();
+    g_indirect->Flush(currentFrame, g_indirectCommandCount, g_indirectBucketCount);
+}
+
+// Writes the bounds of the packets and records the CullingPass that fills their
+// command slots. Each packet is drawn on its own, or each of its meshlets with
+// cluster culling, and the visible ones of a bucket end up in no particular order.
+// With occlusion this is the early phase, and a second set of commands and counts
+// is reserved for the late one. Returns the number of objects culled.
+static uint32_t DispatchCulling(VkCommandBuffer commandBuffer, const std::vector<const DrawPacket*>& packets, uint32_t firstInstance, bool occlusion) {
+    uint32_t packetCount = (uint32_t)packets.size();
+    uint32_t objectCount = 0;
+    for (const DrawPacket* packet : packets)
+        objectCount += g_clusterCulling && packet->meshletCount > 0 ? packet->meshletCount : 1;
+    uint32_t firstObject = g_cullObjectCount;
+    uint32_t firstCommand = g_indirectCommandCount;
+    uint32_t firstBucket = g_indirectBucketCount;
+    uint32_t phases = occlusion ? 2 : 1;
+    // Without a count buffer the culled commands are left in place with no instances
+    bool compact = g_device->HasDrawIndirectCount();
+
+    g_indirect->MapCommands(currentFrame, firstCommand + objectCount * phases);
+    uint32_t* counts = g_indirect->MapCounts(currentFrame, firstBucket + packetCount * phases);
+    CullObject* objects = g_culling->Map(currentFrame, firstObject + objectCount);
+
+    g_indirectBuckets.clear();
+    uint32_t object = 0;
+    uint32_t first = 0;
+    while (first < packetCount) {
+        uint32_t end = first + 1;
+        while (end < packetCount && SameBucket(packets[end], packets[first]))
+            end++;
+
+        IndirectBucket bucket{ packets[first], 0, firstBucket + (uint32_t)g_indirectBuckets.size(), firstCommand + object };
+        counts[bucket.bucket] = 0;
+        for (uint32_t i = first; i < end; i++) {
+            const DrawPacket* packet = packets[i];
+            CullObject whole;
+            whole.bboxMin = packet->bboxMin;
+            whole.bboxMax = packet->bboxMax;
+            whole.bucket = bucket.bucket;
+            whole.firstCommand = bucket.firstCommand;
+            whole.coneApex = glm::vec3(0.0f);
+            whole.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+            whole.coneCutoff = MESHLET_NO_CONE;
+            whole.indexCount = packet->geometry.indexCount;
+            whole.firstIndex = packet->geometry.firstIndex;
+            whole.vertexOffset = packet->geometry.vertexOffset;
+            whole.instance = firstInstance + i;
+
+            if (!g_clusterCulling || packet->meshletCount == 0) {
+                whole.command = firstCommand + object;
+                objects[firstObject + object++] = whole;
+                continue;
+            }
+            for (uint32_t m = 0; m < packet->meshletCount; m++) {
+                const Meshlet& meshlet = packet->meshlets[m];
+                CullObject& cluster = objects[firstObject + object];
+                cluster = whole;
+                cluster.bboxMin = meshlet.bboxMin;
+                cluster.bboxMax = meshlet.bboxMax;
+                cluster.coneApex = meshlet.coneApex;
+                cluster.coneAxis = meshlet.coneAxis;
+                cluster.coneCutoff = meshlet.coneCutoff;
+                cluster.indexCount = meshlet.indexCount;
+                cluster.firstIndex = packet->geometry.firstIndex + meshlet.firstIndex;
+                cluster.command = firstCommand + object++;
+            }
+            g_renderStats.meshlets += packet->meshletCount;
+        }
+        bucket.drawCount = firstCommand + object - bucket.firstCommand;
+        g_indirectBuckets.push_back(bucket);
+        first = end;
+    }
+
+    uint32_t bucketCount = (uint32_t)g_indirectBuckets.size();
+    if (occlusion) {
+        for (uint32_t i = 0; i < bucketCount; i++)
+            counts[firstBucket + bucketCount + i] = 0;
+    }
+
+    g_indirectCommandCount += objectCount * phases;
+    g_indirectBucketCount += bucketCount * phases;
+    g_cullObjectCount += objectCount;
+    g_culling->Flush(currentFrame, firstObject, objectCount);
+    g_indirect->Flush(currentFrame, 0, g_indirectBucketCount);
+    // Once per frame, before the early phase binds the set the late phase binds again
+    g_culling->Prepare(currentFrame, g_indirect->GetCommandBuffer(currentFrame), g_indirect->GetCountBuffer(currentFrame), g_depthPyramid);
+
+    // Until a pyramid is built everything in the frustum is drawn by the early phase
+    CullOcclusion params;
+    params.phase = occlusion && g_depthPyramid->IsValid() ? CullPhase::Early : CullPhase::Frustum;
+    params.pyramid = g_depthPyramid;
+    params.viewproj = g_pyramidViewproj;
+    g_culling->Record(commandBuffer, currentFrame, g_globalSet[currentFrame], firstObject, objectCount, compact, params);
+    g_renderStats.instances += packetCount;
+    return objectCount;
+}
+
+// Binds the pipeline and the descriptor sets shared by all its draws. In bindless
+// mode these are the only sets of the frame, besides the meshlet sets.
+static void BindPipeline(VkCommandBuffer commandBuffer, Pipeline* pipeline, RenderStats& stats) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->Get());
+    stats.pipelineBinds++;
+
+    VkDescriptorSet descSets[] = { g_globalSet[currentFrame], g_textureTable ? g_textureTable->GetDescriptorSet() : VK_NULL_HANDLE };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->GetLayout(), 0, g_textureTable ? 2 : 1, descSets, 0, nullptr);
+    stats.descriptorSetBinds++;
+}
+
+// One task workgroup per MESHLET_TASK_GROUP_SIZE meshlets and instance, the task
+// shader culls them and launches a mesh workgroup per visible meshlet
+static void DrawMeshlets(VkCommandBuffer commandBuffer, VkPipelineLayout layout, const InstancedDraw& draw, VkDescriptorSet& boundMeshletSet, RenderStats& stats) {
+    const DrawPacket* packet = draw.packet;
+    if (packet->meshletSet != boundMeshletSet) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &packet->meshletSet, 0, nullptr);
+        boundMeshletSet = packet->meshletSet;
+        stats.descriptorSetBinds++;
+    }
+
+    MeshletConstants constants{ draw.firstInstance, packet->meshletCount };
+    vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_TASK_BIT_EXT, 0, sizeof(MeshletConstants), &constants);
+    g_device->CmdDrawMeshTasks(commandBuffer, (packet->meshletCount + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE, draw.instanceCount, 1);
+    stats.draws++;
+    stats.meshlets += packet->meshletCount * draw.instanceCount;
+}
+
+// Indirect commands address the full vertex streams, so only the draws recorded
+// directly get a depth prepass
+static bool HasDepthPrepass(bool indirect) {
+    return g_depthPrepass && !indirect;
+}
+
+// Records the depth prepass of instanced draws [first, end) from the position
+// streams. Mesh shaded draws are left out, they test and write depth themselves.
+static void RecordDepthDraws(VkCommandBuffer commandBuffer, uint32_t first, uint32_t end, RenderStats& stats) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_depthPipeline->Get());
+    stats.pipelineBinds++;
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_depthPipeline->GetLayout(), 0, 1, &g_globalSet[currentFrame], 0, nullptr);
+    stats.descriptorSetBinds++;
+
+    uint32_t boundPage = UINT32_MAX;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    for (uint32_t i = first; i < end; i++) {
+        const InstancedDraw& draw = g_instancedDraws[i];
+        const DrawPacket* packet = draw.packet;
+        if (packet->meshletSet != VK_NULL_HANDLE)
+            continue;
+
+        // The positions are in the same vertex buffer, drawn with the same indices
+        BindGeometryPage(commandBuffer, packet->geometry, boundPage, boundIndexType, stats);
+        vkCmdDrawIndexed(commandBuffer, packet->geometry.indexCount, draw.instanceCount, packet->geometry.firstIndex, packet->geometry.positionOffset, draw.firstInstance);
+        stats.draws++;
+    }
+}
+
+// Records instanced draws [first, end), or indirect buckets if 'indirect'. Only
+// reads shared state, so ranges can be recorded in parallel.
+static void RecordDraws(VkCommandBuffer commandBuffer, bool indirect, uint32_t first, uint32_t end, RenderStats& stats) {
+    Pipeline* boundPipeline = nullptr;
+    VkDescriptorSet boundMaterialSet = VK_NULL_HANDLE;
+    VkDescriptorSet boundMeshletSet = VK_NULL_HANDLE;
+    uint32_t boundPage = UINT32_MAX;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    for (uint32_t i = first; i < end; i++) {
+        const DrawPacket* packet = indirect ? g_indirectBuckets[i].packet : g_instancedDraws[i].packet;
+
+        // Sorting put the mesh shaded draws after the others. The layouts of the
+        // two pipelines are not compatible, the sets are bound again.
+        bool meshShaded = !indirect && packet->meshletSet != VK_NULL_HANDLE;
+        Pipeline* pipeline = meshShaded ? g_selectedMeshPipeline : (HasDepthPrepass(indirect) ? g_selectedDepthEqualPipeline : g_selectedPipeline);
+        if (pipeline != boundPipeline) {
+            BindPipeline(commandBuffer, pipeline, stats);
+            boundPipeline = pipeline;
+            boundMaterialSet = VK_NULL_HANDLE;
+            boundMeshletSet = VK_NULL_HANDLE;
+        }
+        VkPipelineLayout layout = pipeline->GetLayout();
+        BindMaterialSet(commandBuffer, layout, packet->materialDescSet, boundMaterialSet, stats);
+
+        if (meshShaded) {
+            DrawMeshlets(commandBuffer, layout, g_instancedDraws[i], boundMeshletSet, stats);
+            continue;
+        }
+
+        BindGeometryPage(commandBuffer, packet->geometry, boundPage, boundIndexType, stats);
+        if (indirect) {
+            const IndirectBucket& bucket = g_indirectBuckets[i];
+            DrawIndirect(commandBuffer, bucket.firstCommand, bucket.bucket, bucket.drawCount, stats);
+        }
+        else {
+            const InstancedDraw& draw = g_instancedDraws[i];
+            vkCmdDrawIndexed(commandBuffer, packet->geometry.indexCount, draw.instanceCount, packet->geometry.firstIndex, packet->geometry.vertexOffset, draw.firstInstance);
+            stats.draws++;
+        }
+    }
+}
+
+// Secondary command buffer of 'thread' for the current frame, continuing the render pass
+static VkCommandBuffer BeginSecondary(uint32_t thread) {
+    RecordingContext& context = g_recording[currentFrame][thread];
+    if (context.used == context.commandBuffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = context.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (g_device->AllocateCommandBuffers(&allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+        context.commandBuffers.push_back(commandBuffer);
+    }
+    VkCommandBuffer commandBuffer = context.commandBuffers[context.used++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = g_renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = g_swapchain->GetFramebuffer(g_imageIndex);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
+    }
+    return commandBuffer;
+}
+
+static void EndSecondary(VkCommandBuffer commandBuffer) {
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+static void AddStats(RenderStats& stats, const RenderStats& other) {
+    stats.draws += other.draws;
+    stats.instances += other.instances;
+    stats.pipelineBinds += other.pipelineBinds;
+    stats.descriptorSetBinds += other.descriptorSetBinds;
+    stats.bufferBinds += other.bufferBinds;
+    stats.meshlets += other.meshlets;
+}
+
+// Splits the draws in contiguous ranges, recorded by jobs into secondary command
+// buffers that the primary executes in order. With a depth prepass each range
+// records it in a separate buffer, executed before all the shaded ones.
+static void RecordDrawsParallel(bool indirect, uint32_t count) {
+    uint32_t threadCount = std::min(JobSystem::GetThreadCount(), (count + MIN_DRAWS_PER_THREAD - 1) / MIN_DRAWS_PER_THREAD);
+    threadCount = std::max(threadCount, 1u);
+    bool prepass = HasDepthPrepass(indirect);
+    uint32_t shadedFirst = prepass ? threadCount : 0;
+
+    std::vector<VkCommandBuffer> secondaries(shadedFirst + threadCount);
+    std::vector<RenderStats> stats(threadCount);
+    auto record = [&](uint32_t range) {
+        uint32_t first = (uint32_t)((uint64_t)count * range / threadCount);
+        uint32_t end = (uint32_t)((uint64_t)count * (range + 1) / threadCount);
+        // Command pools are per job thread, a thread only runs one job at a time
+        uint32_t thread = JobSystem::GetThreadIndex();
+        if (prepass) {
+            secondaries[range] = BeginSecondary(thread);
+            RecordDepthDraws(secondaries[range], first, end, stats[range]);
+            EndSecondary(secondaries[range]);
+        }
+        VkCommandBuffer& secondary = secondaries[shadedFirst + range];
+        secondary = BeginSecondary(thread);
+        RecordDraws(secondary, indirect, first, end, stats[range]);
+        EndSecondary(secondary);
+    };
+
+    JobCounter counter;
+    for (uint32_t i = 1; i < threadCount; i++)
+        JobSystem::Run([&record, i]() { record(i); }, &counter);
+    record(0);
+    JobSystem::Wait(counter);
+
+    vkCmdExecuteCommands(commandBuffers[currentFrame], (uint32_t)secondaries.size(), secondaries.data());
+    for (const RenderStats& threadStats : stats)
+        AddStats(g_renderStats, threadStats);
+}
+
+// Records the draws prepared by FlushRenderQueue in the current render pass
+static void RecordQueuedDraws(bool indirect) {
+    uint32_t count = indirect ? (uint32_t)g_indirectBuckets.size() : (uint32_t)g_instancedDraws.size();
+    if (g_renderPassContents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+        RecordDrawsParallel(indirect, count);
+    }
+    else {
+        if (HasDepthPrepass(indirect))
+            RecordDepthDraws(commandBuffers[currentFrame], 0, count, g_renderStats);
+        RecordDraws(commandBuffers[currentFrame], indirect, 0, count, g_renderStats);
+    }
+}
+
+// Draws what the early phase of DispatchCulling found visible, builds the depth
+// pyramid from that depth and draws what the late phase finds visible against it.
+// The late render pass stays open for the rest of the frame.
+static void DrawOcclusionCulled(VkCommandBuffer commandBuffer, uint32_t firstObject, uint32_t objectCount) {
+    CmdBeginRenderPass(g_earlyRenderPass);
+    RecordQueuedDraws(true);
+    vkCmdEndRenderPass(commandBuffer);
+
+    g_depthPyramid->Build(commandBuffer);
+    g_pyramidViewproj = g_globalData.viewproj;
+
+    // Same buckets, in the commands and counts reserved after the early ones
+    uint32_t bucketCount = (uint32_t)g_indirectBuckets.size();
+    CullOcclusion params;
+    params.phase = CullPhase::Late;
+    params.pyramid = g_depthPyramid;
+    params.viewproj = g_pyramidViewproj;
+    params.commandOffset = objectCount;
+    params.bucketOffset = bucketCount;
+    g_culling->Record(commandBuffer, currentFrame, g_globalSet[currentFrame], firstObject, objectCount, g_device->HasDrawIndirectCount(), params);
+    for (IndirectBucket& bucket : g_indirectBuckets) {
+        bucket.firstCommand += objectCount;
+        bucket.bucket += bucketCount;
+    }
+
+    CmdBeginRenderPass(g_lateRenderPass);
+    g_renderPassBegun = true;
+    RecordQueuedDraws(true);
+}
+
+// Records the queued draws, only binding what changed from the previous draw.
+// Consecutive packets with the same mesh and material become one instanced draw,
+// unless they are culled on the GPU. Draws are expected to be flushed once per
+// frame: the instance and indirect buffers can only grow before they are
+// referenced, and culling is skipped once the render pass has begun.
+void FlushRenderQueue() {
+    if (g_renderQueue.IsEmpty())
+        return;
+
     VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
 
-    PushConstants constants{};
-    constants.model = matrix;
-    constants.normal = glm::mat3x4(glm::transpose(glm::inverse(matrix)));
-    vkCmdPushConstants(commandBuffer, g_selectedPipeline->GetLayout(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &constants);
+    const std::vector<const DrawPacket*>& packets = g_renderQueue.Sort();
+    uint32_t firstInstance = g_instanceCount;
+    InstanceData* instances = g_instances->Map(currentFrame, firstInstance + (uint32_t)packets.size());
+    for (size_t i = 0; i < packets.size(); i++) {
+        InstanceData& instance = instances[firstInstance + i];
+        instance.model = packets[i]->matrix;
+        instance.normal = packets[i]->normalMatrix;
+        instance.materialIndex = packets[i]->materialIndex;
+    }
+    g_instances->Flush(currentFrame, firstInstance, (uint32_t)packets.size());
+    g_instanceCount += (uint32_t)packets.size();
+
+    // The task shaders cull the mesh shaded draws, which are recorded directly
+    bool gpuCulling = g_gpuCulling && !g_meshShading && !g_renderPassBegun;
+    bool occlusion = gpuCulling && g_occlusionCulling;
+    bool indirect = gpuCulling || (g_indirectDraw && !g_meshShading);
+    uint32_t firstObject = g_cullObjectCount;
+    uint32_t objectCount = 0;
+    if (gpuCulling) {
+        objectCount = DispatchCulling(commandBuffer, packets, firstInstance, occlusion);
+    }
+    else {
+        // Sorting already put equal meshes with equal materials together
+        g_instancedDraws.clear();
+        size_t i = 0;
+        while (i < packets.size()) {
+            const DrawPacket* packet = packets[i];
+            size_t end = i + 1;
+            while (end < packets.size() &&
+                packets[end]->geometry.page == packet->geometry.page &&
+                packets[end]->geometry.indexType == packet->geometry.indexType &&
+                packets[end]->geometry.firstIndex == packet->geometry.firstIndex &&
+                packets[end]->geometry.vertexOffset == packet->geometry.vertexOffset &&
+                packets[end]->materialDescSet == packet->materialDescSet &&
+                packets[end]->meshletSet == packet->meshletSet)
+                end++;
+
+            g_instancedDraws.push_back({ packet, firstInstance + (uint32_t)i, (uint32_t)(end - i) });
+            g_renderStats.instances += (uint32_t)(end - i);
+            i = end;
+        }
+
+        if (indirect)
+            PrepareIndirectDraws();
+    }
+
+    if (occlusion) {
+        DrawOcclusionCulled(commandBuffer, firstObject, objectCount);
+    }
+    else {
+        BeginRenderPass();
+        RecordQueuedDraws(indirect);
+    }
+
+    g_renderQueue.Clear();
+}
 
-    VkBuffer vertexBuffers[] = { vertexBuffer };
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+void Vulkan::DrawGrid(const GridSettings& settings) {
+    g_gridSettings = settings;
+    g_gridQueued = settings.lines || settings.axes;
+}
 
-    std::vector<VkDescriptorSet> combinedDescSets;
-    combinedDescSets.push_back(g_globalSet[currentFrame]);
-    if (materialDescSet != nullptr)
-        combinedDescSets.push_back(materialDescSet);
+static void RecordGrid(VkCommandBuffer commandBuffer) {
+    if (!g_gridQueued)
+        return;
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_selectedPipeline->GetLayout(), 0, (uint32_t)combinedDescSets.size(), combinedDescSets.data(), 0, nullptr);
+    GridConstants constants{};
+    constants.minorColor = glm::vec4(g_gridSettings.minorColor, g_gridSettings.minorSpacing);
+    constants.majorColor = glm::vec4(g_gridSettings.majorColor, g_gridSettings.majorSpacing);
+    constants.fadeDistance = g_gridSettings.fadeDistance;
+    constants.lineWidth = g_gridSettings.lineWidth;
+    constants.flags = (g_gridSettings.lines ? 1 : 0) | (g_gridSettings.axes ? 2 : 0);
+
+    VkPipelineLayout layout = g_gridPipeline->GetLayout();
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_gridPipeline->Get());
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &g_globalSet[currentFrame], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GridConstants), &constants);
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+    g_renderStats.draws++;
+    g_renderStats.pipelineBinds++;
+    g_renderStats.descriptorSetBinds++;
+    g_gridQueued = false;
+}
 
-    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+// The grid when no UI was drawn this frame
+static void FlushGrid() {
+    if (!g_gridQueued)
+        return;
+
+    if (g_renderPassContents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+        VkCommandBuffer secondary = BeginSecondary(0);
+        RecordGrid(secondary);
+        EndSecondary(secondary);
+        vkCmdExecuteCommands(commandBuffers[currentFrame], 1, &secondary);
+    }
+    else {
+        RecordGrid(commandBuffers[currentFrame]);
+    }
 }
 
 void Vulkan::EndDrawing() {
     VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
 
+    FlushRenderQueue();
+    BeginRenderPass();
+    FlushGrid();
+
+    *g_globalUniform->Get(currentFrame) = g_globalData;
+    g_globalUniform->Flush(currentFrame);
+
     vkCmdEndRenderPass(commandBuffer);
 
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
@@ -491,24 +1513,30 @@ void Vulkan::EndDrawing() {
 
     VkResult result = vkQueuePresentKHR(g_device->GetPresentQueue(), &presentInfo);
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || g_framebufferResized || g_vSyncChanged) {
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || g_framebufferResized || g_vSyncChanged || g_frameConfigChanged) {
         RecreateSwapChain();
     }
     else if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to present swap chain image!");
     }
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    currentFrame = (currentFrame + 1) % g_framesInFlight;
 }
 
-void Vulkan::UpdateUniformBuffer(size_t bufferSize, void *data) {
-    VkDeviceSize offset = currentFrame * g_device->PadUniformBufferSize(bufferSize);
-    g_device->UpdateUniformBuffer(g_globalMemory, offset, bufferSize, data);
+MaterialTable* Vulkan::GetMaterialTable() { return g_materialTable; }
+TextureTable* Vulkan::GetTextureTable() { return g_textureTable; }
+const RenderStats& Vulkan::GetRenderStats() { return g_lastRenderStats; }
+uint32_t Vulkan::GetDefaultMaterialIndex() { return g_defaultMaterial; }
+
+GlobalUBO* Vulkan::GetGlobalUniform() {
+    return &g_globalData;
 }
 
-VkDescriptorPool Vulkan::GetDescriptorPool() { return g_descriptorPool; }
+DescriptorAllocator* Vulkan::GetDescriptorAllocator() { return g_descriptors; }
 VkDescriptorSetLayout Vulkan::GetMaterialLayout() { return g_materialLayout; }
 
+VkDescriptorSetLayout Vulkan::GetMeshletLayout() { return g_meshletLayout; }
+
 void Vulkan::WaitIdle() {
     g_device->WaitIdle();
 }
@@ -520,7 +1548,15 @@ void CleanupSwapChain() {
 
     delete g_phongPipeline;
     delete g_unlitPipeline;
+    delete g_phongMeshPipeline;
+    delete g_unlitMeshPipeline;
+    delete g_depthPipeline;
+    delete g_phongDepthEqualPipeline;
+    delete g_unlitDepthEqualPipeline;
+    delete g_gridPipeline;
     g_device->DestroyRenderPass(g_renderPass);
+    g_device->DestroyRenderPass(g_earlyRenderPass);
+    g_device->DestroyRenderPass(g_lateRenderPass);
 }
 
 void Vulkan::Cleanup() {
@@ -529,21 +1565,27 @@ void Vulkan::Cleanup() {
     CleanupSwapChain();
 
     delete g_dummyTexture;
-
-    g_device->DestroyBuffer(g_globalBuffer);
-    g_device->FreeMemory(g_globalMemory);
+    delete g_textureTable;
+    delete g_geometry;
+
+    delete g_materialTable;
+    DestroyFrameResources();
+    delete g_depthPyramid;
+    delete g_cullShader;
+    delete g_hizDepthShader;
+    delete g_hizReduceShader;
     g_device->DestroyDescriptorSetLayout(g_globalLayout);
     g_device->DestroyDescriptorSetLayout(g_materialLayout);
-    g_device->DestroyDescriptorPool(g_descriptorPool);
+    if (g_meshletLayout != VK_NULL_HANDLE)
+        g_device->DestroyDescriptorSetLayout(g_meshletLayout);
+    delete g_descriptors;
 
     delete g_phongShader;
     delete g_unlitShader;
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        g_device->DestroySemaphore(renderFinishedSemaphores[i]);
-        g_device->DestroySemaphore(imageAvailableSemaphores[i]);
-        g_device->DestroyFence(inFlightFences[i]);
-    }
+    delete g_phongMeshShader;
+    delete g_unlitMeshShader;
+    delete g_gridShader;
+    delete g_depthShader;
 
     delete g_device;
     g_validationLayers.DestroyDebugMessenger();
@@ -604,8 +1646,9 @@ void Vulkan::ImGuiInit() {
     init_info.DescriptorPool = g_guiDescriptorPool;
     init_info.RenderPass = g_renderPass;
     init_info.Subpass = 0;
-    init_info.MinImageCount = g_guiMinImageCount;
-    init_info.ImageCount = 2;
+    init_info.MinImageCount = std::max(g_swapchain->GetImageCount(), 2u);
+    // UI vertex buffers are cycled per frame, enough for any frames in flight count
+    init_info.ImageCount = MAX_FRAMES_IN_FLIGHT;
     init_info.MSAASamples = g_device->GetMSAASamples();
     init_info.Allocator = VK_NULL_HANDLE;
     init_info.CheckVkResultFn = check_vk_result;
@@ -619,8 +1662,22 @@ void Vulkan::ImGuiBeginDrawing() {
 }
 
 void Vulkan::ImGuiEndDrawing() {
+    // The scene and the grid go below the UI
+    FlushRenderQueue();
+    BeginRenderPass();
+
     ImGui::Render();
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffers[currentFrame]);
+    if (g_renderPassContents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+        VkCommandBuffer secondary = BeginSecondary(0);
+        RecordGrid(secondary);
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), secondary);
+        EndSecondary(secondary);
+        vkCmdExecuteCommands(commandBuffers[currentFrame], 1, &secondary);
+    }
+    else {
+        RecordGrid(commandBuffers[currentFrame]);
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffers[currentFrame]);
+    }
 }
 
 void Vulkan::ImGuiCleanup() {
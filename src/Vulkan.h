@@ -2,7 +2,8 @@
 
 #include <glm/glm.hpp>
 
-constexpr auto MAX_FRAMES_IN_FLIGHT = 2;
+constexpr auto MAX_FRAMES_IN_FLIGHT = 4;       // Upper bound of Vulkan::SetFramesInFlight
+constexpr auto DEFAULT_FRAMES_IN_FLIGHT = 2;
 constexpr auto MAX_LIGHTS = 8;
 
 struct Light {
@@ -24,26 +25,108 @@ struct GlobalUBO {
     glm::ivec4 numLights;   // x:directional, y:point, z:spot
 };
 
-struct PushConstants {
-    glm::mat4 model;
-    glm::mat3x4 normal;     // normalMatrix (3x3). Para evitar problemas de alineacion se usa una de 3x4
+// Commands recorded by the render queue in a frame
+struct RenderStats {
+    uint32_t draws = 0;
+    uint32_t instances = 0;
+    uint32_t pipelineBinds = 0;
+    uint32_t descriptorSetBinds = 0;
+    uint32_t bufferBinds = 0;          // Vertex + index buffer pairs
+    uint32_t triangles = 0;            // Queued, at the LOD selected for each draw
+    uint32_t meshlets = 0;             // Culled one by one, on every instance
+    // Counted by the GPU culling, frames in flight behind the rest
+    uint32_t frustumCulled = 0;
+    uint32_t backfacing = 0;           // Meshlets whose normal cone faces away from the eye
+    uint32_t occluded = 0;
+    uint32_t disoccluded = 0;          // Occluded in the last frame's depth but not in this one
 };
 
+// Ground grid and axes, computed in a fragment shader over the whole screen
+struct GridSettings {
+    bool lines = true;
+    bool axes = true;
+    glm::vec3 minorColor = { 0.2f, 0.2f, 0.2f };
+    float minorSpacing = 0.1f;
+    glm::vec3 majorColor = { 0.9f, 0.9f, 0.9f };
+    float majorSpacing = 1.0f;
+    float fadeDistance = 25.0f;     // Lines fade out from half this distance to the camera
+    float lineWidth = 1.5f;         // Pixels
+};
+
+class DescriptorAllocator;
+class GeometryArena;
+class MaterialTable;
 class Texture;
+class TextureTable;
+struct Meshlet;
 
 class Vulkan {
 public:
-    static void                    Init(Window& window, bool vSync);
+    // bindless: use a TextureTable if VK_EXT_descriptor_indexing is supported
+    // framesInFlight: 0 for DEFAULT_FRAMES_IN_FLIGHT
+    // swapchainImageCount: requested minimum, 0 for one more than the surface minimum
+    // packedVertices: meshes are uploaded as PackedVertex instead of Vertex
+    static void                    Init(Window& window, bool vSync, bool bindless = false, uint32_t framesInFlight = 0, uint32_t swapchainImageCount = 0, bool packedVertices = false);
     static Device*                 GetDevice();
     static Texture*                GetDummyTexture();
-    static VkDescriptorPool        GetDescriptorPool();
+    static GeometryArena*          GetGeometryArena();
+    static MaterialTable*          GetMaterialTable();
+    static TextureTable*           GetTextureTable();   // nullptr when not bindless
+    static uint32_t                GetDefaultMaterialIndex();
+    static DescriptorAllocator*    GetDescriptorAllocator();
     static VkDescriptorSetLayout   GetMaterialLayout();
+    // Set 2 of the mesh shading pipelines, VK_NULL_HANDLE without VK_EXT_mesh_shader
+    static VkDescriptorSetLayout   GetMeshletLayout();
+    static bool                    UsesPackedVertices();
     static void                    SetVSync(bool value);
+    // Applied at the end of the frame, like VSync. Clamped to [1, MAX_FRAMES_IN_FLIGHT]
+    static void                    SetFramesInFlight(uint32_t count);
+    static uint32_t                GetFramesInFlight();
+    // Applied at the end of the frame. 0 for one more than the surface minimum
+    static void                    SetSwapchainImageCount(uint32_t count);
+    static uint32_t                GetSwapchainImageCount();   // Images actually created
     static void                    SetPipeline(int id);
+    // Issue the draws from an indirect buffer. Returns false if not supported
+    static bool                    SetIndirectDraw(bool value);
+    // Frustum cull the draws in a compute pass. Returns false if not supported
+    static bool                    SetGpuCulling(bool value);
+    // Also test the GPU culled draws against a depth pyramid of the previous frame,
+    // then draw what became visible. Only applied with GPU culling. Returns false if not supported
+    static bool                    SetOcclusionCulling(bool value);
+    // Also cull the meshlets of the draws one by one, against the frustum and their
+    // normal cone. Only applied with GPU culling. Returns false if not supported
+    static bool                    SetClusterCulling(bool value);
+    // Draw the meshes that have meshlets with task and mesh shaders, which cull them
+    // like SetClusterCulling. Replaces the indirect draws and the GPU culling
+    // while enabled. Returns false if VK_EXT_mesh_shader is not supported
+    static bool                    SetMeshShading(bool value);
+    // Record the draws in secondary command buffers, split across threads
+    static void                    SetSecondaryRecording(bool value);
+    // Draw the depth of the meshes from their position streams first, so the shaded
+    // draws only run the fragment shader on the nearest surface. Only for the draws
+    // that are not indirect, mesh shaded draws keep their own depth test
+    static void                    SetDepthPrepass(bool value);
+    // Largest error in pixels allowed for a mesh LOD, 0 always draws the full resolution
+    static void                    SetLodThreshold(float pixels);
+    static float                   GetLodThreshold();
+    // Pixels of screen height covered by the bounding sphere of a local box, with the current view
+    static float                   GetProjectedSize(const glm::mat4& matrix, const glm::vec3& bboxMin, const glm::vec3& bboxMax);
+    static uint32_t                GetRecordingThreadCount();
     static void                    BeginDrawing();
     static void                    EndDrawing();
-    static void                    Draw(glm::mat4 matrix, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, VkDescriptorSet materialDescSet);
-    static void                    UpdateUniformBuffer(size_t bufferSize, void* data);
+    // Queues the draw, it is recorded sorted by state at ImGuiEndDrawing/EndDrawing.
+    // geometry: GeometryArena handle, bbox: local space, for depth sorting and culling
+    // firstIndex, indexCount: range of the geometry indices to draw (a LOD), firstIndex relative to the geometry
+    // meshlets: split of that range, must stay valid until the frame ends. meshletSet: their
+    // buffers for the mesh shaders, a set of GetMeshletLayout (VK_NULL_HANDLE to always draw indexed)
+    static void                    Draw(const glm::mat4& matrix, const glm::mat3x4& normalMatrix, uint32_t geometry, uint32_t firstIndex, uint32_t indexCount, const glm::vec3& bboxMin, const glm::vec3& bboxMax, VkDescriptorSet materialDescSet, uint32_t materialIndex,
+                                        const Meshlet* meshlets = nullptr, uint32_t meshletCount = 0, VkDescriptorSet meshletSet = VK_NULL_HANDLE);
+    // One full screen draw after the queued draws and before the UI, this frame only
+    static void                    DrawGrid(const GridSettings& settings);
+    // Copied to the current frame slot at EndDrawing. Set view before queuing draws
+    static GlobalUBO*              GetGlobalUniform();
+    static const RenderStats&      GetRenderStats();     // Previous frame
+    static void                    CompactGeometry();
     static void                    WaitIdle();
     static void                    Cleanup();
 
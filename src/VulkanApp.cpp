@@ -23,17 +23,19 @@
 #include "nfd.h"
 
 #include "Device.h"
+#include "DescriptorAllocator.h"
+#include "FrustumCuller.h"
+#include "GeometryArena.h"
+#include "JobSystem.h"
 #include "Mesh.h"
 #include "Model.h"
 #include "Texture.h"
 #include "Camera.h"
-#include "Axes.h"
-#include "Grid.h"
 #include "Prism.h"
 #include "Vulkan.h"
 #include "VulkanApp.h"
 
-VulkanApp::VulkanApp() :
+VulkanApp::VulkanApp(bool bindless, uint32_t framesInFlight, uint32_t swapchainImages, bool packedVertices) :
     m_window(WIDTH, HEIGHT, "Vulkan"),
     m_camController(m_window, m_cam),
     m_fps(0.5f),
@@ -41,11 +43,15 @@ VulkanApp::VulkanApp() :
     m_showGrid(true),
     m_showAxis(true),
     m_vSync(true),
+    m_framesInFlight(framesInFlight),
+    m_swapchainImages(swapchainImages),
     m_selectedShader(0)
 {
     spdlog::set_level(spdlog::level::level_enum::trace);
 
-    Vulkan::Init(m_window, m_vSync);
+    JobSystem::Init();
+    Vulkan::Init(m_window, m_vSync, bindless, framesInFlight, swapchainImages, packedVertices);
+    m_framesInFlight = Vulkan::GetFramesInFlight();
 
     Vulkan::ImGuiInit();
 
@@ -55,16 +61,6 @@ VulkanApp::VulkanApp() :
     m_window.EventSubscribe_OnKey(std::bind(&VulkanApp::KeyCallback, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
 
     m_cam.SetPerspective(45.0f, m_window.GetAspectRatio(), 0.01f, 100.0f);
-
-    m_grid1 = new GameObject("Grid1");
-    m_grid1->AddComponent<Grid>(10, 1.0f, 0.002f);
-
-    m_grid2 = new GameObject("Grid2");
-    glm::vec3 color = { 0.2f, 0.2f, 0.2f };
-    m_grid2->AddComponent<Grid>(20, 0.1f, 0.0018f, color);
-
-    m_axes = new GameObject("Axes");
-    m_axes->AddComponent<Axes>(100.0f, 0.0021f);
 }
 
 VulkanApp::~VulkanApp() {
@@ -76,6 +72,7 @@ void VulkanApp::run() {
         m_timerFrame.Start();
 
         Update(m_deltaTime);
+        JobSystem::RunMainThreadJobs();
         Draw(m_deltaTime);
 
         if (m_cleanModels)
@@ -111,8 +108,11 @@ GameObject* VulkanApp::NewGameObject(const std::string name, std::string modelPa
 }
 
 void VulkanApp::DrawGameObject(GameObject *gameObject) {
-    glm::mat4 matrix = gameObject->GetComponent<Transform>()->GetMatrix();
-    gameObject->GetComponent<Model>()->Draw(matrix);
+    const glm::mat4& matrix = gameObject->GetComponent<Transform>()->GetMatrix();
+    if (m_cpuCulling)
+        gameObject->GetComponent<Model>()->Draw(matrix, m_culler);
+    else
+        gameObject->GetComponent<Model>()->Draw(matrix);
 }
 
 static void PrintGlmMatrix(const glm::mat4& m, const std::string& name) {
@@ -164,7 +164,7 @@ void VulkanApp::UpdateUniformBuffer() {
     global.lights[2].attenuation = glm::vec4(1.0, 1.4, 3.6, 0); // x:constant, y:linear, z:quadratic
     global.lights[2].cutOff = glm::vec4(cos(12.5), cos(17.5), 0, 0); // x:inner, y:outter
 
-    Vulkan::UpdateUniformBuffer(sizeof(GlobalUBO), &global);
+    *Vulkan::GetGlobalUniform() = global;
 }
 
 void VulkanApp::Update(float deltaTime) {
@@ -179,17 +179,21 @@ void VulkanApp::Draw(float deltaTime) {
 
     UpdateUniformBuffer();
 
-    if (m_showGrid) {
-        DrawGameObject(m_grid1);
-        DrawGameObject(m_grid2);
-    }
-    if (m_showAxis)
-        DrawGameObject(m_axes);
+    if (m_cpuCulling)
+        m_culler.Begin(m_cam.GetProjection() * m_cam.GetView());
+
+    GridSettings grid;
+    grid.lines = m_showGrid;
+    grid.axes = m_showAxis;
+    Vulkan::DrawGrid(grid);
 
     for (int i = 0; i < m_gameObjects.size(); i++) {
         DrawGameObject(m_gameObjects[i]);
     }
 
+    if (m_cpuCulling)
+        m_culler.Draw();
+
     GuiDraw();
 
     Vulkan::EndDrawing();
@@ -198,9 +202,6 @@ void VulkanApp::Draw(float deltaTime) {
 void VulkanApp::Cleanup() {
     Vulkan::WaitIdle();
 
-    m_grid1->Dispose();
-    m_grid2->Dispose();
-    m_axes->Dispose();
     for (int i=0; i<m_gameObjects.size(); i++)
         m_gameObjects[i]->Dispose();
 
@@ -209,6 +210,8 @@ void VulkanApp::Cleanup() {
     Vulkan::Cleanup();
 
     NFD_Quit();
+
+    JobSystem::Shutdown();
 }
 
 void VulkanApp::GuiDraw() {
@@ -225,11 +228,72 @@ void VulkanApp::GuiDraw() {
     if (ImGui::Checkbox("VSync", &m_vSync)) {
         Vulkan::SetVSync(m_vSync);
     }
+    if (ImGui::SliderInt("Frames in flight", &m_framesInFlight, 1, MAX_FRAMES_IN_FLIGHT)) {
+        Vulkan::SetFramesInFlight(m_framesInFlight);
+    }
+    if (ImGui::SliderInt("Swapchain images", &m_swapchainImages, 0, 8, m_swapchainImages == 0 ? "Default" : "%d")) {
+        Vulkan::SetSwapchainImageCount(m_swapchainImages);
+    }
+    ImGui::SameLine();
+    ImGui::Text("(%u)", Vulkan::GetSwapchainImageCount());
+    if (ImGui::Checkbox("Indirect draw", &m_indirectDraw)) {
+        m_indirectDraw = Vulkan::SetIndirectDraw(m_indirectDraw);
+    }
+    if (ImGui::Checkbox("GPU culling", &m_gpuCulling)) {
+        m_gpuCulling = Vulkan::SetGpuCulling(m_gpuCulling);
+    }
+    if (m_gpuCulling) {
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Occlusion culling", &m_occlusionCulling)) {
+            m_occlusionCulling = Vulkan::SetOcclusionCulling(m_occlusionCulling);
+        }
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Cluster culling", &m_clusterCulling)) {
+            m_clusterCulling = Vulkan::SetClusterCulling(m_clusterCulling);
+        }
+    }
+    if (ImGui::Checkbox("Mesh shaders", &m_meshShading)) {
+        m_meshShading = Vulkan::SetMeshShading(m_meshShading);
+    }
+    if (ImGui::Checkbox("Parallel recording", &m_secondaryRecording)) {
+        Vulkan::SetSecondaryRecording(m_secondaryRecording);
+    }
+    ImGui::SameLine();
+    ImGui::Text("(%u threads)", Vulkan::GetRecordingThreadCount());
+    if (ImGui::Checkbox("Depth prepass", &m_depthPrepass)) {
+        Vulkan::SetDepthPrepass(m_depthPrepass);
+    }
+    ImGui::Checkbox("CPU culling", &m_cpuCulling);
+    if (ImGui::SliderFloat("LOD error", &m_lodThreshold, 0.0f, 8.0f, m_lodThreshold == 0.0f ? "Off" : "%.1f px")) {
+        Vulkan::SetLodThreshold(m_lodThreshold);
+    }
+    if (m_cpuCulling) {
+        const CullingStats& cullStats = m_culler.GetStats();
+        ImGui::Text("Culling (%s): %u visible, %u culled", FrustumCuller::GetKernelName(), cullStats.visible, cullStats.culled);
+    }
     if (ImGui::Combo("Shader", &m_selectedShader, "Phong\0Unlit\0")) {
         Vulkan::SetPipeline(m_selectedShader);
     }
     ImGui::Text("FPS: %d (%.2f ms)", m_fps.GetFPS(), m_fps.GetFrametime()*1000.0f);
 
+    MemoryStats memStats = Vulkan::GetDevice()->GetMemoryStats();
+    ImGui::Text("GPU memory: %.1f/%.1f MB", memStats.usedBytes / (1024.0f * 1024.0f), memStats.reservedBytes / (1024.0f * 1024.0f));
+    ImGui::Text("Allocations: %u (%u device allocations)", memStats.allocationCount, memStats.deviceAllocationCount);
+    GeometryStats geoStats = Vulkan::GetGeometryArena()->GetStats();
+    ImGui::Text("Geometry: %.1f/%.1f MB (%u meshes, %u pages)", geoStats.usedBytes / (1024.0f * 1024.0f), geoStats.reservedBytes / (1024.0f * 1024.0f), geoStats.allocationCount, geoStats.pageCount);
+    DescriptorStats descStats = Vulkan::GetDescriptorAllocator()->GetStats();
+    ImGui::Text("Descriptor sets: %u/%u (%u pools)", descStats.setCount, descStats.setCapacity, descStats.poolCount);
+    const RenderStats& renderStats = Vulkan::GetRenderStats();
+    ImGui::Text("Draws: %u (%u instances, %u triangles, %u meshlets)", renderStats.draws, renderStats.instances, renderStats.triangles, renderStats.meshlets);
+    ImGui::Text("Binds: %u pipeline, %u descriptor, %u buffer", renderStats.pipelineBinds, renderStats.descriptorSetBinds, renderStats.bufferBinds);
+    if (m_gpuCulling)
+        ImGui::Text("GPU culling: %u outside, %u backfacing, %u occluded, %u disoccluded", renderStats.frustumCulled, renderStats.backfacing, renderStats.occluded, renderStats.disoccluded);
+    JobStats jobStats = JobSystem::GetStats();
+    uint32_t queued = jobStats.mainThreadQueueDepth;
+    for (uint32_t depth : jobStats.queueDepth)
+        queued += depth;
+    ImGui::Text("Jobs: %u threads, %u queued, %llu executed, %llu stolen", JobSystem::GetThreadCount(), queued, (unsigned long long)jobStats.executed, (unsigned long long)jobStats.steals);
+
     //bool open = true;
     //ImGui::ShowDemoWindow(&open);
 
@@ -262,6 +326,7 @@ void VulkanApp::CleanModels() {
         delete m_gameObjects[i];
     }
     m_gameObjects.clear();
+    Vulkan::CompactGeometry();
 
     m_cleanModels = false;
 }
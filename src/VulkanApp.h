@@ -11,15 +11,16 @@
 #include "CameraController.h"
 #include "Timer.h"
 #include "FPS.h"
+#include "FrustumCuller.h"
 
 class Device;
 class Model;
-class Axes;
 class Prism;
 
 class VulkanApp {
 public:
-    VulkanApp();
+    // 0 for the defaults
+    VulkanApp(bool bindless = false, uint32_t framesInFlight = 0, uint32_t swapchainImages = 0, bool packedVertices = false);
     ~VulkanApp();
 
     void run();
@@ -36,12 +37,22 @@ private:
 
     Camera m_cam;
     CameraController m_camController;
-    GameObject *m_grid1, *m_grid2;
-    GameObject *m_axes;
     float m_deltaTime;
     Timer m_timerFrame;
     FPS m_fps;
     bool m_vSync;
+    int m_framesInFlight;
+    int m_swapchainImages;
+    bool m_indirectDraw = false;
+    bool m_gpuCulling = false;
+    bool m_occlusionCulling = false;
+    bool m_clusterCulling = false;
+    bool m_meshShading = false;
+    bool m_cpuCulling = false;
+    bool m_secondaryRecording = false;
+    bool m_depthPrepass = false;
+    float m_lodThreshold = 1.0f;     // Pixels, as Vulkan starts
+    FrustumCuller m_culler;
     bool m_showGrid;
     bool m_showAxis;
 
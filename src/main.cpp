@@ -1,9 +1,26 @@
+#include <cstdlib>
+#include <cstring>
 #include <spdlog/spdlog.h>
 #include "VulkanApp.h"
 
-int main() {
+int main(int argc, char* argv[]) {
+    bool bindless = false;
+    uint32_t framesInFlight = 0;
+    uint32_t swapchainImages = 0;
+    bool packedVertices = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bindless") == 0)
+            bindless = true;
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+            framesInFlight = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--swapchain-images") == 0 && i + 1 < argc)
+            swapchainImages = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--packed-vertices") == 0)
+            packedVertices = true;
+    }
+
     try {
-        VulkanApp app;
+        VulkanApp app(bindless, framesInFlight, swapchainImages, packedVertices);
         app.run();
     }
     catch (const std::exception& e) {